@@ -80,11 +80,25 @@
 #define configUSE_MALLOC_FAILED_HOOK            1
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
-/* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS           0
+/* Run time and task stats gathering related definitions. The run time counter
+is the microsecond timer, read by telemetry.cc. */
+#define configGENERATE_RUN_TIME_STATS           1
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    0
 
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t ulGetRunTimeCounterValue( void );
+#ifdef __cplusplus
+}
+#endif
+#endif /* __ASSEMBLER__ */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()        ulGetRunTimeCounterValue()
+
 /* Co-routine related definitions. */
 #define configUSE_CO_ROUTINES                   0
 #define configMAX_CO_ROUTINE_PRIORITIES         1
@@ -130,6 +144,7 @@ to exclude the API function. */
 #define INCLUDE_xTaskGetIdleTaskHandle          1
 #define INCLUDE_eTaskGetState                   1
 #define INCLUDE_xTimerPendFunctionCall          1
+#define INCLUDE_xTimerGetTimerDaemonTaskHandle  1
 #define INCLUDE_xTaskAbortDelay                 1
 #define INCLUDE_xTaskGetHandle                  1
 #define INCLUDE_xTaskResumeFromISR              1
@@ -137,5 +152,22 @@ to exclude the API function. */
 
 /* A header file that defines trace macro can be included here. */
 
+/* Records the task switches when CONFIG_DEBUG_TRACE is enabled, see trace.cc.
+pxCurrentTCB is the task of the core switching. Otherwise the scheduler has no
+hook to call. */
+#ifndef __ASSEMBLER__
+#include "config.h"
+#if CONFIG_DEBUG_TRACE
+#ifdef __cplusplus
+extern "C" {
+#endif
+void vTraceTaskSwitchedIn( void * pvTask );
+#ifdef __cplusplus
+}
+#endif
+#define traceTASK_SWITCHED_IN()                 vTraceTaskSwitchedIn( pxCurrentTCB )
+#endif /* CONFIG_DEBUG_TRACE */
+#endif /* __ASSEMBLER__ */
+
 #endif /* FREERTOS_CONFIG_H */
 
@@ -26,6 +26,12 @@ void GenericInputDevice::SetConfigModifier(
   config_modifier_ = config_modifier;
 }
 
+void GenericInputDevice::NotifyKeyEvents(const KeyEvent* events, size_t num) {
+  for (auto& output : *keyboard_output_) {
+    output->ProcessKeyEvents(events, num);
+  }
+}
+
 DeviceRegistry* DeviceRegistry::GetRegistry() {
   static DeviceRegistry registry;
   return &registry;
@@ -174,16 +180,7 @@ void DeviceRegistry::InitializeAllDevices() {
     Dedup(&input_devices_);
   }
 
-  CreateDefaultConfigImpl();
-
-  // Initialize the config from flash if there's any
-  std::string config_file;
-  if (ReadFileContent(CONFIG_FLASH_JSON_FILE_NAME, &config_file) == OK &&
-      !config_file.empty() && ParseConfig(config_file, &global_config_) != OK) {
-    // Reinitialize to default
-    CreateDefaultConfigImpl();
-  }
-
+  LoadConfigImpl();
   UpdateConfigImpl();
 
   initialized_ = true;
@@ -270,8 +267,22 @@ void DeviceRegistry::CreateDefaultConfigImpl() {
   }
 }
 
+void DeviceRegistry::LoadConfigImpl() {
+  CreateDefaultConfigImpl();
+
+  // Initialize the config from flash if there's any
+  std::string config_file;
+  if (ReadFileContent(CONFIG_FLASH_JSON_FILE_NAME, &config_file) == OK &&
+      !config_file.empty() && ParseConfig(config_file, &global_config_) != OK) {
+    // Reinitialize to default
+    CreateDefaultConfigImpl();
+  }
+}
+
 void DeviceRegistry::UpdateConfig() { GetRegistry()->UpdateConfigImpl(); }
 
+void DeviceRegistry::LoadConfig() { GetRegistry()->LoadConfigImpl(); }
+
 void DeviceRegistry::CreateDefaultConfig() {
   GetRegistry()->CreateDefaultConfigImpl();
 }
@@ -284,3 +295,7 @@ void DeviceRegistry::SaveConfig() {
   }
   LOG_INFO("Done saving config");
 }
+
+ConfigObject* DeviceRegistry::GetGlobalConfig() {
+  return &GetRegistry()->global_config_;
+}
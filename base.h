@@ -29,6 +29,15 @@ class GenericDevice {
   uint8_t tag_;
 };
 
+// Lock key LEDs set by the host in the keyboard output report
+enum HostLED : uint8_t {
+  HOST_LED_NUM_LOCK = 1 << 0,
+  HOST_LED_CAPS_LOCK = 1 << 1,
+  HOST_LED_SCROLL_LOCK = 1 << 2,
+  HOST_LED_COMPOSE = 1 << 3,
+  HOST_LED_KANA = 1 << 4,
+};
+
 class GenericOutputDevice : virtual public GenericDevice {
  public:
   virtual void SetSlow(bool slow) { slow_ = slow; }
@@ -36,6 +45,9 @@ class GenericOutputDevice : virtual public GenericDevice {
 
   // OutputTick is called from a different task than the rest methods.
   virtual void OutputTick() = 0;
+  // Called from the same task as OutputTick(), right before it, when the host
+  // LED state changes. `state` is a mask of HostLED.
+  virtual void OnHostLEDStateChange(uint8_t state) {}
 
   virtual void StartOfInputTick() = 0;
   virtual void FinalizeInputTickOutput() = 0;
@@ -44,19 +56,35 @@ class GenericOutputDevice : virtual public GenericDevice {
   bool slow_;
 };
 
+// A debounced key press or release.
+struct KeyEvent {
+  uint64_t timestamp_us;
+  uint8_t keycode;
+  uint8_t sink_idx;
+  uint8_t source_idx;
+  bool pressed;
+};
+
 class KeyboardOutputDevice : virtual public GenericOutputDevice {
  public:
-  virtual void SendKeycode(uint8_t keycode) = 0;
-  virtual void SendKeycode(const std::vector<uint8_t>& keycode) = 0;
+  // Only called when keys change state. Devices need to keep track of the
+  // pressed keys themselves. The buffer is only valid during the call.
+  virtual void ProcessKeyEvents(const KeyEvent* events, size_t num) = 0;
   virtual void SendConsumerKeycode(uint16_t keycode) = 0;
   virtual void ChangeActiveLayers(const std::vector<bool>& layers) = 0;
 };
 
+// Mouse movement and pan are fixed point numbers in 1/kMouseUnit counts, so
+// that slow movements aren't lost to rounding.
+constexpr int32_t kMouseUnit = 256;
+
 class MouseOutputDevice : virtual public GenericOutputDevice {
  public:
   virtual void MouseKeycode(uint8_t keycode) = 0;
-  virtual void MouseMovement(int8_t x, int8_t y) = 0;
-  virtual void Pan(int8_t x, int8_t y) = 0;
+  // Movements from all the calls in one input tick add up. Devices carry the
+  // fractions of a count over to the next report.
+  virtual void MouseMovement(int32_t x, int32_t y) = 0;
+  virtual void Pan(int32_t x, int32_t y) = 0;
 };
 
 class ScreenOutputDevice : virtual public GenericOutputDevice {
@@ -119,6 +147,9 @@ class GenericInputDevice : virtual public GenericDevice {
       std::shared_ptr<ConfigModifier> config_modifier);
 
  protected:
+  // Sends the key events to all the keyboard outputs
+  virtual void NotifyKeyEvents(const KeyEvent* events, size_t num);
+
   const std::vector<std::shared_ptr<KeyboardOutputDevice>>* keyboard_output_;
   const std::vector<std::shared_ptr<MouseOutputDevice>>* mouse_output_;
   const std::vector<std::shared_ptr<ScreenOutputDevice>>* screen_output_;
@@ -177,6 +208,12 @@ class DeviceRegistry {
   static void UpdateConfig();
   static void CreateDefaultConfig();
   static void SaveConfig();
+  // Replaces the config with the one in flash, or the default config if the
+  // file is missing or invalid. Call UpdateConfig() after.
+  static void LoadConfig();
+  // Config of all the devices. Like the config modifier, only modify it from
+  // the input task and call runner::NotifyConfigChange() after.
+  static ConfigObject* GetGlobalConfig();
 
  private:
   DeviceRegistry() : initialized_(false) {}
@@ -186,6 +223,7 @@ class DeviceRegistry {
   void AddConfig(GenericDevice* device);
   void UpdateConfigImpl();
   void CreateDefaultConfigImpl();
+  void LoadConfigImpl();
 
   static DeviceRegistry* GetRegistry();
 
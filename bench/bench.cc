@@ -0,0 +1,164 @@
+#include "bench.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "layout.h"
+
+#if PICO_ON_DEVICE
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "hardware/timer.h"
+#else
+#include <time.h>
+#endif /* PICO_ON_DEVICE */
+
+namespace bench {
+
+namespace {
+
+constexpr size_t kWarmupRuns = 20;
+constexpr size_t kSamples = 1000;
+
+using FixtureMap =
+    std::map<std::pair<std::string, std::string>, FixtureCreator>;
+
+FixtureMap* GetFixtures() {
+  static FixtureMap fixtures;
+  return &fixtures;
+}
+
+#if PICO_ON_DEVICE
+
+constexpr const char* kUnit = "cycles";
+
+// FreeRTOS runs SysTick from the CPU clock, so its down counter counts cycles
+// until it wraps at the next RTOS tick. Anything longer than half a tick is
+// measured with the microsecond timer instead.
+struct Timestamp {
+  uint64_t us;
+  uint32_t systick;
+};
+
+Timestamp Now() {
+  Timestamp now;
+  now.us = time_us_64();
+  now.systick = systick_hw->cvr;
+  return now;
+}
+
+uint32_t Elapsed(const Timestamp& start, const Timestamp& end) {
+  const uint32_t cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+  const uint32_t period = (systick_hw->rvr & 0xffffff) + 1;
+  const uint64_t us = end.us - start.us;
+  if (us * cycles_per_us >= period / 2) {
+    return std::min<uint64_t>(us * cycles_per_us, UINT32_MAX);
+  }
+  return (start.systick + period - end.systick) % period;
+}
+
+void PrintClock() {
+  printf("# unit=%s clk_hz=%lu", kUnit, (unsigned long)clock_get_hz(clk_sys));
+}
+
+#else
+
+constexpr const char* kUnit = "ns";
+
+using Timestamp = uint64_t;
+
+Timestamp Now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint32_t Elapsed(const Timestamp& start, const Timestamp& end) {
+  return std::min<uint64_t>(end - start, UINT32_MAX);
+}
+
+void PrintClock() { printf("# unit=%s", kUnit); }
+
+#endif /* PICO_ON_DEVICE */
+
+// Smallest time of an empty measurement
+uint32_t MeasureOverhead() {
+  uint32_t overhead = UINT32_MAX;
+  for (size_t i = 0; i < kSamples; ++i) {
+    const Timestamp start = Now();
+    const Timestamp end = Now();
+    overhead = std::min(overhead, Elapsed(start, end));
+  }
+  return overhead;
+}
+
+// Nearest rank percentile of sorted values
+uint32_t Percentile(const std::vector<uint32_t>& sorted, uint32_t percent) {
+  const size_t rank = (sorted.size() * percent + 99) / 100;
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void RunFixture(const std::string& name, const std::string& params,
+                const FixtureCreator& creator, uint32_t overhead) {
+  std::unique_ptr<Fixture> fixture = creator();
+  if (fixture == NULL) {
+    LOG_ERROR("Failed to create fixture %s", name.c_str());
+    return;
+  }
+  for (size_t i = 0; i < kWarmupRuns; ++i) {
+    fixture->Run();
+    fixture->AfterRun();
+  }
+
+  std::vector<uint32_t> samples(kSamples);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < kSamples; ++i) {
+    const Timestamp start = Now();
+    fixture->Run();
+    const Timestamp end = Now();
+    fixture->AfterRun();
+    const uint32_t elapsed = Elapsed(start, end);
+    samples[i] = elapsed > overhead ? elapsed - overhead : 0;
+    sum += samples[i];
+  }
+  std::sort(samples.begin(), samples.end());
+
+  printf("%s\t%s\t%zu\t%lu\t%lu\t%lu\t%lu\t%lu\n", name.c_str(),
+         params.empty() ? "-" : params.c_str(), samples.size(),
+         (unsigned long)samples.front(),
+         (unsigned long)Percentile(samples, 50),
+         (unsigned long)Percentile(samples, 99), (unsigned long)samples.back(),
+         (unsigned long)(sum / samples.size()));
+  fflush(stdout);
+}
+
+}  // namespace
+
+Status RegisterFixture(const std::string& name, const std::string& params,
+                       FixtureCreator creator) {
+  return GetFixtures()->emplace(std::make_pair(name, params), creator).second
+             ? OK
+             : ERROR;
+}
+
+void RunAll() {
+  const uint32_t overhead = MeasureOverhead();
+  PrintClock();
+  printf(" overhead=%lu\n", (unsigned long)overhead);
+  printf("# sinks=%zu sources=%zu layers=%zu debounce_algorithm=%d\n",
+         GetNumSinkGPIOs(), GetNumSourceGPIOs(), GetKeyboardNumLayers(),
+         CONFIG_DEBOUNCE_ALGORITHM);
+  printf("name\tparams\tsamples\tmin\tp50\tp99\tmax\tmean\n");
+  for (const auto& [key, creator] : *GetFixtures()) {
+    RunFixture(key.first, key.second, creator, overhead);
+  }
+  printf("# done\n");
+  fflush(stdout);
+}
+
+}  // namespace bench
@@ -0,0 +1,56 @@
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "utils.h"
+
+// Microbenchmarks of the code that runs on every tick. The same fixtures run
+// on the device (firmware_bench) and on the host (host/microbench), see
+// bench/main.cc.
+//
+// Each fixture is created once, run a few times to warm up, then each Run() is
+// timed on its own. Times are CPU cycles from SysTick on the device, and
+// nanoseconds on the host. The cost of reading the clock is measured once and
+// subtracted.
+
+namespace bench {
+
+class Fixture {
+ public:
+  virtual ~Fixture() = default;
+
+  // The timed part
+  virtual void Run() = 0;
+  // Called after every Run() without being timed, e.g. to drain a queue that
+  // Run() fills.
+  virtual void AfterRun() {}
+};
+
+using FixtureCreator = std::function<std::unique_ptr<Fixture>()>;
+
+// Creates a T from a copy of `args` each time
+template <typename T, typename... Args>
+FixtureCreator Creator(Args... args) {
+  return [=]() { return std::make_unique<T>(args...); };
+}
+
+// `params` tells apart the variants of the same fixture, e.g. "keys=1". Only
+// one fixture can be registered per name and params.
+Status RegisterFixture(const std::string& name, const std::string& params,
+                       FixtureCreator creator);
+
+// Runs all the fixtures ordered by name and params, and prints one line per
+// fixture with the header first:
+//
+//   name  params  samples  min  p50  p99  max  mean
+//
+// Columns are separated by tabs. The lines before the header start with "#",
+// and give the unit and the build settings the numbers depend on.
+void RunAll();
+
+}  // namespace bench
+
+#endif /* BENCH_BENCH_H_ */
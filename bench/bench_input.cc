@@ -0,0 +1,180 @@
+// Fixtures of the input task, on the device and on the host
+
+#include <memory>
+#include <vector>
+
+#include "base.h"
+#include "bench.h"
+#include "class/hid/hid.h"
+#include "config.h"
+#include "debounce.h"
+#include "joystick.h"
+#include "keyscan.h"
+#include "layout.h"
+#include "runner.h"
+#include "usb.h"
+
+namespace {
+
+// Scans a synthetic matrix instead of the GPIOs. The first `num_keys` switches
+// of layer 0 with a plain keycode are pressed or released together.
+class SyntheticKeyScan : public KeyScan {
+ public:
+  explicit SyntheticKeyScan(size_t num_keys)
+      : pressed_(false), pattern_(GetNumSinkGPIOs()) {
+    for (size_t sink = 0; sink < GetNumSinkGPIOs() && num_keys > 0; ++sink) {
+      for (size_t source = 0; source < GetNumSourceGPIOs() && num_keys > 0;
+           ++source) {
+        const Keycode keycode = GetKeycodeAtLayer(0, sink, source);
+        if (keycode.is_custom || keycode.keycode == HID_KEY_NONE) {
+          continue;
+        }
+        pattern_[sink] |= 1u << GetSourceGPIO(source);
+        --num_keys;
+      }
+    }
+    // No debounce window, so that every tick changes the state of the keys
+    debouncer_ = CreateDebouncer(debounce_algorithm_, GetNumSinkGPIOs(), 0);
+    SetKeyboardOutputs(&keyboard_outputs_);
+    InputLoopStart();
+  }
+
+  void SetPressed(bool pressed) { pressed_ = pressed; }
+  bool IsPressed() const { return pressed_; }
+
+ protected:
+  uint32_t ScanSink(size_t sink) override {
+    return pressed_ ? pattern_[sink] : 0;
+  }
+
+  bool pressed_;
+  std::vector<uint32_t> pattern_;
+  // The events only go as far as the keyscan, see USBKeyboardFixture
+  std::vector<std::shared_ptr<KeyboardOutputDevice>> keyboard_outputs_;
+};
+
+// KeyScan::InputTick() where the state of `num_keys` keys flips every tick, or
+// nothing changes for 0 keys.
+class KeyScanFixture : public bench::Fixture {
+ public:
+  explicit KeyScanFixture(size_t num_keys) : keyscan_(num_keys) {}
+
+  void Run() override {
+    keyscan_.SetPressed(!keyscan_.IsPressed());
+    keyscan_.InputTick();
+  }
+
+ protected:
+  SyntheticKeyScan keyscan_;
+};
+
+// KeyScan::InputTick() on the real GPIOs with nothing pressed, including the
+// CONFIG_GPIO_SINK_DELAY_US wait of every sink.
+class GPIOKeyScanFixture : public bench::Fixture {
+ public:
+  GPIOKeyScanFixture() {
+    keyscan_.SetKeyboardOutputs(&keyboard_outputs_);
+    keyscan_.InputLoopStart();
+  }
+
+  void Run() override { keyscan_.InputTick(); }
+
+ protected:
+  KeyScan keyscan_;
+  std::vector<std::shared_ptr<KeyboardOutputDevice>> keyboard_outputs_;
+};
+
+class BenchUSBKeyboardOutput : public USBKeyboardOutput {
+ public:
+  // Drops the queued reports, the USB task isn't running
+  void DrainReports() {
+    while (reports_.Front() != NULL) {
+      reports_.Pop();
+    }
+  }
+};
+
+// What the USB keyboard does with the events of one input tick. `num_events`
+// keys are pressed together on one tick and released on the next.
+class USBKeyboardFixture : public bench::Fixture {
+ public:
+  explicit USBKeyboardFixture(size_t num_events) : pressed_(false) {
+    for (size_t i = 0; i < num_events; ++i) {
+      events_.push_back(KeyEvent{.timestamp_us = 0,
+                                 .keycode = (uint8_t)(HID_KEY_A + i),
+                                 .sink_idx = 0,
+                                 .source_idx = (uint8_t)i,
+                                 .pressed = false});
+    }
+  }
+
+  void Run() override {
+    pressed_ = !pressed_;
+    for (KeyEvent& event : events_) {
+      event.pressed = pressed_;
+    }
+    keyboard_.StartOfInputTick();
+    keyboard_.ProcessKeyEvents(events_.data(), events_.size());
+    keyboard_.FinalizeInputTickOutput();
+  }
+
+  void AfterRun() override { keyboard_.DrainReports(); }
+
+ protected:
+  BenchUSBKeyboardOutput keyboard_;
+  std::vector<KeyEvent> events_;
+  bool pressed_;
+};
+
+class BenchJoystick : public JoystickInputDeivce {
+ public:
+  BenchJoystick()
+      : JoystickInputDeivce(26, 27, 5, false, false, false,
+                            runner::kInputTickPeriodUs, 0) {
+    OnUpdateConfig(CreateDefaultConfig().second.get());
+  }
+
+  int16_t GetSpeedX(int16_t reading) { return GetSpeed(profile_x_, reading); }
+};
+
+// JoystickInputDeivce::GetSpeed() of the default profile, over readings spread
+// across the whole ADC range.
+class JoystickSpeedFixture : public bench::Fixture {
+ public:
+  static constexpr int16_t kNumReadings = 64;
+
+  JoystickSpeedFixture() : result_(0) {}
+
+  void Run() override {
+    int32_t sum = 0;
+    for (int16_t i = 0; i < kNumReadings; ++i) {
+      sum += joystick_.GetSpeedX(-2048 + i * (4096 / kNumReadings));
+    }
+    result_ = sum;
+  }
+
+ protected:
+  BenchJoystick joystick_;
+  // Keeps the calls from being optimized out
+  volatile int32_t result_;
+};
+
+}  // namespace
+
+static Status register1 = bench::RegisterFixture(
+    "keyscan_tick", "keys=0", bench::Creator<KeyScanFixture>(0));
+static Status register2 = bench::RegisterFixture(
+    "keyscan_tick", "keys=1", bench::Creator<KeyScanFixture>(1));
+static Status register3 = bench::RegisterFixture(
+    "keyscan_tick", "keys=all", bench::Creator<KeyScanFixture>(256));
+static Status register4 = bench::RegisterFixture(
+    "keyscan_tick", "gpio", bench::Creator<GPIOKeyScanFixture>());
+static Status register5 = bench::RegisterFixture(
+    "usb_keyboard_tick", "events=1", bench::Creator<USBKeyboardFixture>(1));
+static Status register6 = bench::RegisterFixture(
+    "usb_keyboard_tick", "events=6", bench::Creator<USBKeyboardFixture>(6));
+static Status register7 = bench::RegisterFixture(
+    "usb_keyboard_tick", "events=16", bench::Creator<USBKeyboardFixture>(16));
+static Status register8 =
+    bench::RegisterFixture("joystick_get_speed", "readings=64",
+                           bench::Creator<JoystickSpeedFixture>());
@@ -0,0 +1,65 @@
+// Fixtures of the output devices. Only built for the device, the host build
+// has neither PIO nor I2C.
+
+#include <memory>
+#include <string>
+
+#include "base.h"
+#include "bench.h"
+#include "ssd1306.h"
+#include "ws2812.h"
+
+namespace {
+
+class BenchWS2812 : public WS2812 {
+ public:
+  explicit BenchWS2812(uint8_t num_pixels)
+      : WS2812(26, num_pixels, 0.5, pio0, 0) {}
+
+  void Rotate() { RotateAnimation(0.25); }
+};
+
+// WS2812::RotateAnimation() of one frame. Once the PIO FIFO is full, each
+// pixel waits for the previous one to be shifted out.
+class WS2812RotateFixture : public bench::Fixture {
+ public:
+  explicit WS2812RotateFixture(uint8_t num_pixels) : leds_(num_pixels) {}
+
+  void Run() override { leds_.Rotate(); }
+
+ protected:
+  BenchWS2812 leds_;
+};
+
+// SSD1306Display::DrawText() of one full width line into the frame buffer.
+// Nothing is sent to the screen.
+class SSD1306TextFixture : public bench::Fixture {
+ public:
+  SSD1306TextFixture(ScreenOutputDevice::Font font, size_t num_chars)
+      : screen_(i2c0, 20, 21, 0x3c, SSD1306Display::R_64, true),
+        font_(font),
+        text_(num_chars, 'W') {}
+
+  void Run() override {
+    screen_.DrawText(0, 0, text_, font_, ScreenOutputDevice::ADD);
+  }
+
+ protected:
+  SSD1306Display screen_;
+  const ScreenOutputDevice::Font font_;
+  const std::string text_;
+};
+
+}  // namespace
+
+static Status register1 = bench::RegisterFixture(
+    "ws2812_rotate", "pixels=17", bench::Creator<WS2812RotateFixture>(17));
+static Status register2 = bench::RegisterFixture(
+    "ssd1306_draw_text", "font=5x8 chars=21",
+    bench::Creator<SSD1306TextFixture>(ScreenOutputDevice::F5X8, 21));
+static Status register3 = bench::RegisterFixture(
+    "ssd1306_draw_text", "font=8x8 chars=16",
+    bench::Creator<SSD1306TextFixture>(ScreenOutputDevice::F8X8, 16));
+static Status register4 = bench::RegisterFixture(
+    "ssd1306_draw_text", "font=12x16 chars=10",
+    bench::Creator<SSD1306TextFixture>(ScreenOutputDevice::F12X16, 10));
@@ -0,0 +1,43 @@
+// Fixtures of the trace recorder, see trace.h. Only registered if
+// CONFIG_DEBUG_TRACE is enabled.
+
+#include "bench.h"
+#include "config.h"
+#include "trace.h"
+
+#if CONFIG_DEBUG_TRACE
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "utils.h"
+
+namespace {
+
+// One TRACE_EVENT(), which has to stay well under a microsecond
+class TraceEventFixture : public bench::Fixture {
+ public:
+  void Run() override { TRACE_EVENT(INPUT_TICK_BEGIN, 0); }
+};
+
+// LockSemaphore of a free semaphore, with its two trace events
+class LockSemaphoreFixture : public bench::Fixture {
+ public:
+  LockSemaphoreFixture() : semaphore_(xSemaphoreCreateBinary()) {
+    xSemaphoreGive(semaphore_);
+  }
+  ~LockSemaphoreFixture() override { vSemaphoreDelete(semaphore_); }
+
+  void Run() override { LockSemaphore lock(semaphore_); }
+
+ protected:
+  SemaphoreHandle_t semaphore_;
+};
+
+}  // namespace
+
+static Status register1 = bench::RegisterFixture(
+    "trace_event", "events=1", bench::Creator<TraceEventFixture>());
+static Status register2 = bench::RegisterFixture(
+    "lock_semaphore", "traced", bench::Creator<LockSemaphoreFixture>());
+
+#endif /* CONFIG_DEBUG_TRACE */
@@ -0,0 +1,68 @@
+// Runs the microbenchmarks once and prints the table, see bench.h. On the
+// device the table goes to the UART on GPIO28, since the USB stack isn't
+// started and GPIO0-1 are matrix columns.
+//
+//   cmake --build build --target firmware_bench
+//   cmake -S host -B build-host && cmake --build build-host --target microbench
+
+#include <stdio.h>
+
+#include "FreeRTOS.h"
+#include "bench.h"
+#include "config.h"
+#include "task.h"
+#include "utils.h"
+
+#if PICO_ON_DEVICE
+#include "pico/stdlib.h"
+#else
+#include <unistd.h>
+#endif /* PICO_ON_DEVICE */
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+#if PICO_ON_DEVICE
+extern "C" void vApplicationIdleHook(void) {}
+extern "C" void vApplicationStackOverflowHook(TaskHandle_t pxTask,
+                                              char *pcTaskName) {
+  LOG_ERROR("Stack overflow for task %s", pcTaskName);
+}
+extern "C" void vApplicationTickHook(void) {}
+#endif /* PICO_ON_DEVICE */
+
+static void BenchTask(void *parameter) {
+  (void)parameter;
+  bench::RunAll();
+
+#if PICO_ON_DEVICE
+  while (true) {
+    vTaskDelay(portMAX_DELAY);
+  }
+#else
+  // Skips the static destructors, the scheduler is still running
+  _exit(0);
+#endif /* PICO_ON_DEVICE */
+}
+
+int main() {
+#if PICO_ON_DEVICE
+  stdio_init_all();
+#endif /* PICO_ON_DEVICE */
+
+  // On the tick core like the input task. Its SysTick is the one FreeRTOS
+  // runs, which bench.cc counts the cycles with.
+  TaskHandle_t bench_task_handle = NULL;
+  const BaseType_t status = xTaskCreateAffinitySet(
+      &BenchTask, "bench_task", CONFIG_TASK_STACK_SIZE, NULL,
+      CONFIG_TASK_PRIORITY, (1 << (configTICK_CORE)), &bench_task_handle);
+  if (status == pdPASS && bench_task_handle != NULL) {
+    vTaskStartScheduler();
+  }
+
+  while (true)
+    ;
+
+  return 0;
+}
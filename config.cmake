@@ -9,3 +9,19 @@ else()
         message("BOARD_CONFIG is ${BOARD_CONFIG}.")
     endif()
 endif()
+
+set(PICOMK_CONFIG_H "${CMAKE_CURRENT_LIST_DIR}/configs/${BOARD_CONFIG}/config.h")
+# Configure again when it changes, read_board_config() picks build steps
+set_property(DIRECTORY APPEND PROPERTY
+        CMAKE_CONFIGURE_DEPENDS ${PICOMK_CONFIG_H})
+
+# Sets `var` to the value of `#define <name> <value>` in the config.h of
+# BOARD_CONFIG, or to an empty string, for the build steps that depend on it
+function(read_board_config name var)
+    file(STRINGS ${PICOMK_CONFIG_H} lines REGEX "^#define ${name} ")
+    set(value "")
+    foreach(line IN LISTS lines)
+        string(REGEX REPLACE "^#define ${name} +([^ ]*).*$" "\\1" value "${line}")
+    endforeach()
+    set(${var} "${value}" PARENT_SCOPE)
+endfunction()
@@ -1,11 +1,14 @@
 #include "config_modifier.h"
 
+#include <stdio.h>
+
 #include <algorithm>
 #include <string>
 #include <vector>
 
 #include "base.h"
 #include "runner.h"
+#include "telemetry.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -69,6 +72,11 @@ void HomeScreen::OnSelect() {
     DeviceRegistry::CreateDefaultConfig();
   }
   if (current_highlight_ == 3) {
+    config_modifier_->PushUI(std::make_shared<TaskStatsScreen>(
+        config_modifier_, screen_, screen_top_margin_));
+    redraw_ = true;
+  }
+  if (current_highlight_ == 4) {
     config_modifier_->EndConfig();
   }
 }
@@ -77,6 +85,73 @@ uint32_t HomeScreen::GetListLength() { return menu_items_.size(); }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Formats a permille value as a percentage, or "-" if it is unknown
+static std::string FormatPermille(uint32_t permille) {
+  if (permille == UINT32_MAX) {
+    return "-";
+  }
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%lu.%lu%%", (unsigned long)permille / 10,
+           (unsigned long)permille % 10);
+  return buffer;
+}
+
+void TaskStatsScreen::UpdateLines() {
+  // 15 characters fit next to the cursor
+  char buffer[32];
+  lines_.clear();
+  lines_.push_back("^ Back");
+  lines_.push_back("cpu " + FormatPermille(telemetry::GetCPULoadPermille()));
+  for (size_t i = 0; i < telemetry::NUM_TASKS; ++i) {
+    const telemetry::TaskId id = (telemetry::TaskId)i;
+    const telemetry::TaskStats stats = telemetry::GetTaskStats(id);
+    lines_.push_back(std::string(telemetry::GetTaskName(id)) + " " +
+                     FormatPermille(stats.run_time_permille));
+    if (stats.period_us > 0 && stats.num_iterations > 0) {
+      snprintf(buffer, sizeof(buffer), " us %lu/%lu",
+               (unsigned long)(stats.total_duration_us / stats.num_iterations),
+               (unsigned long)stats.max_duration_us);
+      lines_.push_back(buffer);
+      snprintf(buffer, sizeof(buffer), " jit max %lu",
+               (unsigned long)stats.max_jitter_us);
+      lines_.push_back(buffer);
+      snprintf(buffer, sizeof(buffer), " missed %lu",
+               (unsigned long)stats.missed_deadlines);
+      lines_.push_back(buffer);
+    }
+    if (stats.stack_high_water != UINT32_MAX) {
+      snprintf(buffer, sizeof(buffer), " stack %lu",
+               (unsigned long)stats.stack_high_water);
+      lines_.push_back(buffer);
+    }
+  }
+  if (current_highlight_ >= lines_.size()) {
+    current_highlight_ = 0;
+    draw_start_ = 0;
+  }
+}
+
+void TaskStatsScreen::Draw() {
+  const uint32_t window_count = telemetry::GetWindowCount();
+  if (window_count != window_count_) {
+    window_count_ = window_count;
+    UpdateLines();
+    redraw_ = true;
+  }
+  if (!redraw_) {
+    return;
+  }
+  ListDrawImpl(lines_);
+  redraw_ = false;
+}
+
+// Any line goes back
+void TaskStatsScreen::OnSelect() { config_modifier_->PopUI(); }
+
+uint32_t TaskStatsScreen::GetListLength() { return lines_.size(); }
+
+////////////////////////////////////////////////////////////////////////////////
+
 static void DispatchChild(Config* child, ConfigModifiersImpl* config_modifier,
                           ScreenOutputDevice* screen,
                           uint8_t screen_top_margin) {
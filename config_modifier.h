@@ -62,7 +62,8 @@ class HomeScreen : public ListUI {
              ConfigObject* global_config_object, uint8_t screen_top_margin)
       : ListUI(config_modifier, screen, screen_top_margin),
         global_config_object_(global_config_object),
-        menu_items_({"Edit Config", "Save Config", "Load Default", "Exit"}) {}
+        menu_items_({"Edit Config", "Save Config", "Load Default",
+                     "Task Stats", "Exit"}) {}
 
   void Draw() override;
   void OnSelect() override;
@@ -74,6 +75,27 @@ class HomeScreen : public ListUI {
   std::vector<std::string> menu_items_;
 };
 
+// Telemetry of the tasks, see telemetry.h. Refreshed when a new window was
+// sampled.
+class TaskStatsScreen : public ListUI {
+ public:
+  TaskStatsScreen(ConfigModifiersImpl* config_modifier,
+                  ScreenOutputDevice* screen, uint8_t screen_top_margin)
+      : ListUI(config_modifier, screen, screen_top_margin),
+        window_count_(UINT32_MAX) {}
+
+  void Draw() override;
+  void OnSelect() override;
+
+ protected:
+  uint32_t GetListLength() override;
+
+  void UpdateLines();
+
+  std::vector<std::string> lines_;
+  uint32_t window_count_;
+};
+
 class ConfigObjectScreen : public ListUI {
  public:
   ConfigObjectScreen(ConfigModifiersImpl* config_modifier,
@@ -5,9 +5,23 @@
 
 #define CONFIG_KEYBOARD_NAME "Pico Keyboard V0.4"
 
+// The host build can override the scan and debounce ticks, see
+// host/CMakeLists.txt
+#ifndef CONFIG_SCAN_TICKS
 #define CONFIG_SCAN_TICKS 5
+#endif
 #define CONFIG_SLOW_TICKS 50
+// When non zero, the input task is woken up by a hardware alarm every
+// CONFIG_SCAN_PERIOD_US instead of by a FreeRTOS timer every CONFIG_SCAN_TICKS.
+// Input devices that do something every tick (e.g. joystick and mouse keys)
+// run faster as well.
+#define CONFIG_SCAN_PERIOD_US 0
+#ifndef CONFIG_DEBOUNCE_TICKS
 #define CONFIG_DEBOUNCE_TICKS 15
+#endif
+// Default debounce algorithm, see DebounceAlgorithm in debounce.h. Can be
+// changed in the config.
+#define CONFIG_DEBOUNCE_ALGORITHM 0
 
 #define CONFIG_GPIO_SINK_DELAY_US 1
 
@@ -17,6 +31,24 @@
 #define CONFIG_USB_VID 0xeceb
 #define CONFIG_USB_PID 0x3026
 #define CONFIG_USB_POLL_MS 1
+// Send the HID reports from the USB start of frame callback as soon as the
+// input task produced them, instead of from the output task. Needs a TinyUSB
+// with tud_sof_cb_enable(), which older pico-sdk releases don't have. Nothing
+// references it while this is 0.
+#define CONFIG_USB_SOF_SYNC 0
+// Number of keyboard reports that can wait for the endpoint. Power of two.
+#define CONFIG_USB_REPORT_QUEUE_SIZE 16
+// Wheel counts per detent for hosts that enable the HID resolution multiplier
+#define CONFIG_USB_WHEEL_RESOLUTION_MULTIPLIER 16
+// Expose the config file as a small FAT drive to the host. Off by default, as
+// it changes the USB descriptor. Always on in the host build, which checks it
+// in tests/msc_test.cc.
+#ifndef CONFIG_USB_MASS_STORAGE
+#define CONFIG_USB_MASS_STORAGE 0
+#endif
+// Largest config file shown on the drive or accepted from the host. Sizes the
+// static buffers of usb_msc.cc, about three times this much RAM.
+#define CONFIG_USB_MASS_STORAGE_MAX_FILE_SIZE (8 * 1024)
 #define CONFIG_USB_VENDER_NAME "PicoMK"
 #define CONFIG_USB_PRODUCT_NAME CONFIG_KEYBOARD_NAME
 #define CONFIG_USB_SERIAL_NUM "1234"
@@ -28,17 +60,43 @@
 
 #define CONFIG_DEBUG_ENABLE_USB_SERIAL 0
 
+// Count the heap allocations made by the input task and warn when a tick
+// allocates. The steady state input loop should not allocate at all. Always
+// on in the host build, which checks it in tests/allocation_test.cc.
+#ifndef CONFIG_DEBUG_ALLOCATION_COUNTER
+#define CONFIG_DEBUG_ALLOCATION_COUNTER 0
+#endif
+
+// Measure the idle time of core configTICK_CORE with a busy loop task at idle
+// priority. See runner::GetTickCoreIdlePermille().
+#define CONFIG_DEBUG_IDLE_MONITOR 0
+
+// Record task switches, device ticks, semaphore waits and flash operations in
+// RAM, see trace.h. Dump them with tools/trace_tool.py.
+#ifndef CONFIG_DEBUG_TRACE
+#define CONFIG_DEBUG_TRACE 0
+#endif
+// Records per core, 8 bytes each. Has to be a power of two.
+#ifndef CONFIG_DEBUG_TRACE_BUFFER_SIZE
+#define CONFIG_DEBUG_TRACE_BUFFER_SIZE 1024
+#endif
+
+// Logs up to this LogLevel are written, 0 disables all of them. They go to
+// the debug CDC port with CONFIG_DEBUG_ENABLE_USB_SERIAL, and to stdio
+// otherwise, e.g. the UART of the benchmark build.
+#define CONFIG_DEBUG_LOG_LEVEL 0
+
+// Send the logs as binary records instead of text, see deferred_log.h. Decode
+// them with tools/log_tool.py.
+#define CONFIG_DEBUG_LOG_DEFERRED 0
+
 #if CONFIG_DEBUG_ENABLE_USB_SERIAL
 
 #define CONFIG_DEBUG_USB_SERIAL_CDC_CMD_MAX_SIZE 8
 #define CONFIG_DEBUG_USB_BUFFER_SIZE 64
-#define CONFIG_DEBUG_USB_TIMEOUT_US 500000
-
-#define CONFIG_DEBUG_LOG_LEVEL 2
-
-#else
-
-#define CONFIG_DEBUG_LOG_LEVEL 0  // Disable all logs
+// Log output is queued here and sent by the USB task. Logs that don't fit are
+// dropped instead of waiting for the host. Has to be a power of two.
+#define CONFIG_DEBUG_USB_LOG_BUFFER_SIZE 4096
 
 #endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
 
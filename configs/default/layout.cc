@@ -89,6 +89,7 @@ enum {
   USB_MOUSE,
   TEMPERATURE,
   LED,
+  RAW_HID,
 };
 
 static Status register1 = RegisterConfigModifier(SSD1306_SCREEN);
@@ -103,3 +104,4 @@ static Status register6 = RegisterUSBKeyboardOutput(USB_KEYBOARD);
 static Status register7 = RegisterUSBMouseOutput(USB_MOUSE);
 static Status register8 = RegisterTemperatureInput(TEMPERATURE);
 static Status register9 = RegisterWS2812(LED, 26, 17);
+static Status register10 = RegisterRawHIDConfig(RAW_HID);
@@ -27,7 +27,7 @@ cJSON* ConfigObject::ToCJSON() const {
   for (const auto& [k, v] : members_) {
     cJSON* json = v->ToCJSON();
     if (json == NULL) {
-      LOG_WARNING("%s returned NULL json ptr", k);
+      LOG_WARNING("%s returned NULL json ptr", k.c_str());
     }
     cJSON_AddItemToObject(root, k.c_str(), json);
   }
@@ -0,0 +1,96 @@
+#include "debounce.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+SymmetricDeferredDebouncer::SymmetricDeferredDebouncer(size_t num_sinks,
+                                                       uint32_t debounce_us)
+    : Debouncer(num_sinks, debounce_us),
+      counters_us_(num_sinks * 32, 0),
+      pending_bits_(num_sinks, 0) {}
+
+uint32_t SymmetricDeferredDebouncer::Debounce(size_t sink, uint32_t raw_bits,
+                                              uint32_t debounced_bits,
+                                              uint32_t elapsed_us) {
+  uint32_t* counters = &counters_us_[sink * 32];
+  const uint32_t changed_bits = raw_bits ^ debounced_bits;
+
+  // Keys that bounced back to their debounced state restart the window
+  uint32_t stale_bits = pending_bits_[sink] & ~changed_bits;
+  while (stale_bits != 0) {
+    counters[__builtin_ctz(stale_bits)] = 0;
+    stale_bits &= stale_bits - 1;
+  }
+
+  uint32_t flipped_bits = 0;
+  uint32_t pending_bits = changed_bits;
+  uint32_t bits = changed_bits;
+  while (bits != 0) {
+    const uint8_t pin = __builtin_ctz(bits);
+    bits &= bits - 1;
+
+    const uint32_t count = counters[pin] + elapsed_us;
+    if (count >= debounce_us_) {
+      counters[pin] = 0;
+      flipped_bits |= (1u << pin);
+      pending_bits &= ~(1u << pin);
+    } else {
+      counters[pin] = count;
+    }
+  }
+  pending_bits_[sink] = pending_bits;
+  return flipped_bits;
+}
+
+uint32_t EagerPressDebouncer::Debounce(size_t sink, uint32_t raw_bits,
+                                       uint32_t debounced_bits,
+                                       uint32_t elapsed_us) {
+  // Presses go through right away. Treating them as already debounced leaves
+  // only the releases to the deferred logic, so bouncing after a press can't
+  // release the key.
+  const uint32_t press_bits = raw_bits & ~debounced_bits;
+  return press_bits |
+         SymmetricDeferredDebouncer::Debounce(
+             sink, raw_bits, debounced_bits | press_bits, elapsed_us);
+}
+
+PerRowEagerDebouncer::PerRowEagerDebouncer(size_t num_sinks,
+                                           uint32_t debounce_us)
+    : Debouncer(num_sinks, debounce_us), lockout_us_(num_sinks, 0) {}
+
+uint32_t PerRowEagerDebouncer::Debounce(size_t sink, uint32_t raw_bits,
+                                        uint32_t debounced_bits,
+                                        uint32_t elapsed_us) {
+  uint32_t& lockout = lockout_us_[sink];
+  if (lockout > 0) {
+    lockout -= std::min(lockout, elapsed_us);
+    if (lockout > 0) {
+      return 0;
+    }
+  }
+  const uint32_t changed_bits = raw_bits ^ debounced_bits;
+  if (changed_bits != 0) {
+    lockout = debounce_us_;
+  }
+  return changed_bits;
+}
+
+std::unique_ptr<Debouncer> CreateDebouncer(DebounceAlgorithm algorithm,
+                                           size_t num_sinks,
+                                           uint32_t debounce_us) {
+  switch (algorithm) {
+    case EAGER_PRESS_DEFERRED_RELEASE:
+      return std::unique_ptr<Debouncer>(
+          new EagerPressDebouncer(num_sinks, debounce_us));
+    case PER_ROW_EAGER:
+      return std::unique_ptr<Debouncer>(
+          new PerRowEagerDebouncer(num_sinks, debounce_us));
+    case SYMMETRIC_DEFERRED:
+    default:
+      return std::unique_ptr<Debouncer>(
+          new SymmetricDeferredDebouncer(num_sinks, debounce_us));
+  }
+}
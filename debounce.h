@@ -0,0 +1,80 @@
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+// Values are stored in the config, so don't reorder them.
+enum DebounceAlgorithm {
+  // A key flips after its raw state has been stable for the whole debounce
+  // window. Both press and release are delayed by the window.
+  SYMMETRIC_DEFERRED = 0,
+  // A press is reported on the first sample, and the key can't be released
+  // until it has been released for the whole debounce window.
+  EAGER_PRESS_DEFERRED_RELEASE,
+  // Any change is reported on the first sample, after which the whole sink
+  // ignores changes for the debounce window.
+  PER_ROW_EAGER,
+  NUM_DEBOUNCE_ALGORITHMS,
+};
+
+// Debounces the raw samples of the key matrix, one sink at a time. All the
+// state is allocated in the constructor so that Debounce() is allocation free.
+class Debouncer {
+ public:
+  Debouncer(size_t num_sinks, uint32_t debounce_us)
+      : debounce_us_(debounce_us) {}
+  virtual ~Debouncer() = default;
+
+  // `raw_bits` and `debounced_bits` are indexed by source GPIO pin number.
+  // `elapsed_us` is the time since the previous scan of the sink. Returns the
+  // bits whose debounced state flips in this tick.
+  virtual uint32_t Debounce(size_t sink, uint32_t raw_bits,
+                            uint32_t debounced_bits, uint32_t elapsed_us) = 0;
+
+ protected:
+  const uint32_t debounce_us_;
+};
+
+class SymmetricDeferredDebouncer : public Debouncer {
+ public:
+  SymmetricDeferredDebouncer(size_t num_sinks, uint32_t debounce_us);
+
+  uint32_t Debounce(size_t sink, uint32_t raw_bits, uint32_t debounced_bits,
+                    uint32_t elapsed_us) override;
+
+ protected:
+  // Time since the raw state started to differ, 32 per sink indexed by pin
+  std::vector<uint32_t> counters_us_;
+  // Pins of each sink with a counter running
+  std::vector<uint32_t> pending_bits_;
+};
+
+class EagerPressDebouncer : public SymmetricDeferredDebouncer {
+ public:
+  EagerPressDebouncer(size_t num_sinks, uint32_t debounce_us)
+      : SymmetricDeferredDebouncer(num_sinks, debounce_us) {}
+
+  uint32_t Debounce(size_t sink, uint32_t raw_bits, uint32_t debounced_bits,
+                    uint32_t elapsed_us) override;
+};
+
+class PerRowEagerDebouncer : public Debouncer {
+ public:
+  PerRowEagerDebouncer(size_t num_sinks, uint32_t debounce_us);
+
+  uint32_t Debounce(size_t sink, uint32_t raw_bits, uint32_t debounced_bits,
+                    uint32_t elapsed_us) override;
+
+ protected:
+  // Remaining time each sink ignores changes for
+  std::vector<uint32_t> lockout_us_;
+};
+
+std::unique_ptr<Debouncer> CreateDebouncer(DebounceAlgorithm algorithm,
+                                           size_t num_sinks,
+                                           uint32_t debounce_us);
+
+#endif /* DEBOUNCE_H_ */
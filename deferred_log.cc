@@ -0,0 +1,46 @@
+#include "deferred_log.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "config.h"
+#include "hardware/timer.h"
+#include "usb.h"
+
+#if CONFIG_DEBUG_LOG_DEFERRED
+
+namespace deferred_log {
+
+RecordWriter::RecordWriter(uint32_t id) : size_(2) {
+  buffer_[0] = kRecordMagic;
+  const uint32_t time_us = time_us_32();
+  memcpy(&buffer_[size_], &id, sizeof(id));
+  size_ += sizeof(id);
+  memcpy(&buffer_[size_], &time_us, sizeof(time_us));
+  size_ += sizeof(time_us);
+}
+
+void RecordWriter::AddString(const char* value) {
+  if (size_ + 2 > kMaxRecordSize) {
+    return;
+  }
+  const size_t length = std::min(strlen(value), kMaxRecordSize - size_ - 2);
+  buffer_[size_++] = ARG_STRING;
+  buffer_[size_++] = length;
+  memcpy(&buffer_[size_], value, length);
+  size_ += length;
+}
+
+void RecordWriter::Commit() {
+  buffer_[1] = size_ - 2;
+#if CONFIG_DEBUG_ENABLE_USB_SERIAL
+  USBLogWrite((const char*)buffer_, size_);
+#else
+  fwrite(buffer_, 1, size_, stdout);
+#endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
+}
+
+}  // namespace deferred_log
+
+#endif /* CONFIG_DEBUG_LOG_DEFERRED */
@@ -0,0 +1,114 @@
+#ifndef DEFERRED_LOG_H_
+#define DEFERRED_LOG_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+// Binary log records written by the LOG macros when CONFIG_DEBUG_LOG_DEFERRED
+// is enabled. Instead of formatting on the device, each call site is
+// identified by a hash of its level prefix and format string computed at
+// compile time, so neither the format nor the file name ends up in flash. Only
+// the arguments are sent. tools/log_tool.py builds the table of call sites
+// from the sources and turns the records back into text.
+//
+// Record layout, multi-byte values are little endian:
+//
+//   | kRecordMagic | u8 size of the rest | u32 id | u32 time_us_32() | args
+//
+// Each argument is an ArgType byte followed by its value. Strings are a u8
+// length and the bytes, truncated to fit in kMaxRecordSize.
+
+namespace deferred_log {
+
+constexpr uint8_t kRecordMagic = 0xFE;
+constexpr size_t kMaxRecordSize = 128;
+
+enum ArgType : uint8_t {
+  ARG_INT32 = 'i',
+  ARG_UINT32 = 'u',
+  ARG_INT64 = 'q',
+  ARG_UINT64 = 'Q',
+  ARG_FLOAT = 'f',
+  ARG_STRING = 's',
+  ARG_POINTER = 'p',
+};
+
+// FNV-1a, tools/log_tool.py has to compute the same
+constexpr uint32_t LogId(const char* text) {
+  uint32_t hash = 2166136261u;
+  for (; *text != '\0'; ++text) {
+    hash = (hash ^ (uint8_t)*text) * 16777619u;
+  }
+  return hash;
+}
+
+template <typename T>
+struct AlwaysFalse : std::false_type {};
+
+// Serializes one record on the stack. Arguments that don't fit are dropped.
+class RecordWriter {
+ public:
+  explicit RecordWriter(uint32_t id);
+
+  template <typename T>
+  void Add(T value) {
+    if constexpr (std::is_same_v<T, bool>) {
+      Put(ARG_UINT32, (uint32_t)value);
+    } else if constexpr (std::is_enum_v<T>) {
+      Add((std::underlying_type_t<T>)value);
+    } else if constexpr (std::is_integral_v<T> && sizeof(T) <= 4) {
+      if constexpr (std::is_signed_v<T>) {
+        Put(ARG_INT32, (int32_t)value);
+      } else {
+        Put(ARG_UINT32, (uint32_t)value);
+      }
+    } else if constexpr (std::is_integral_v<T>) {
+      if constexpr (std::is_signed_v<T>) {
+        Put(ARG_INT64, (int64_t)value);
+      } else {
+        Put(ARG_UINT64, (uint64_t)value);
+      }
+    } else if constexpr (std::is_floating_point_v<T>) {
+      Put(ARG_FLOAT, (float)value);
+    } else if constexpr (std::is_same_v<std::decay_t<T>, const char*> ||
+                         std::is_same_v<std::decay_t<T>, char*>) {
+      AddString(value);
+    } else if constexpr (std::is_pointer_v<T>) {
+      Put(ARG_POINTER, (uint32_t)(uintptr_t)value);
+    } else {
+      static_assert(AlwaysFalse<T>::value, "Unsupported log argument type");
+    }
+  }
+
+  // Sends the record to the log transport
+  void Commit();
+
+ protected:
+  template <typename T>
+  void Put(ArgType type, T value) {
+    if (size_ + 1 + sizeof(T) > kMaxRecordSize) {
+      return;
+    }
+    buffer_[size_++] = type;
+    memcpy(&buffer_[size_], &value, sizeof(T));
+    size_ += sizeof(T);
+  }
+
+  void AddString(const char* value);
+
+  uint8_t buffer_[kMaxRecordSize];
+  size_t size_;
+};
+
+template <typename... Args>
+void Write(uint32_t id, Args... args) {
+  RecordWriter writer(id);
+  (writer.Add(args), ...);
+  writer.Commit();
+}
+
+}  // namespace deferred_log
+
+#endif /* DEFERRED_LOG_H_ */
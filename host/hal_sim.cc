@@ -0,0 +1,384 @@
+#include "hal_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "FreeRTOS.h"
+#include "hardware/adc.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "hardware/watchdog.h"
+#include "pico/bootrom.h"
+#include "pico/stdio.h"
+#include "task.h"
+
+namespace hal_sim {
+
+// GPIO bank, one bit per pin
+static std::atomic<uint32_t> output_enable{0};
+static std::atomic<uint32_t> output_level{0};
+static std::atomic<uint32_t> pull_up{0};
+// Symmetric, bit b of switches[a] is set when a and b are connected
+static std::array<std::atomic<uint32_t>, kNumGPIO> switches;
+
+void SetSwitch(uint8_t gpio_a, uint8_t gpio_b, bool closed) {
+  if (gpio_a >= kNumGPIO || gpio_b >= kNumGPIO || gpio_a == gpio_b) {
+    return;
+  }
+  if (closed) {
+    switches[gpio_a] |= 1u << gpio_b;
+    switches[gpio_b] |= 1u << gpio_a;
+  } else {
+    switches[gpio_a] &= ~(1u << gpio_b);
+    switches[gpio_b] &= ~(1u << gpio_a);
+  }
+}
+
+static std::vector<SwitchTransition> timeline;
+// Only modified by the task reading the GPIOs
+static size_t timeline_next = 0;
+
+void SetSwitchTimeline(std::vector<SwitchTransition> transitions) {
+  timeline = std::move(transitions);
+  timeline_next = 0;
+}
+
+static void ApplySwitchTimeline() {
+  if (timeline_next == timeline.size()) {
+    return;
+  }
+  const uint64_t now_us = time_us_64();
+  for (; timeline_next < timeline.size() &&
+         timeline[timeline_next].time_us <= now_us;
+       ++timeline_next) {
+    const SwitchTransition& transition = timeline[timeline_next];
+    SetSwitch(transition.gpio_a, transition.gpio_b, transition.closed);
+  }
+}
+
+static constexpr size_t kNumADCInputs = 5;
+static std::array<std::atomic<uint16_t>, kNumADCInputs> adc_values = {
+    2048, 2048, 2048, 2048, 2048};
+
+void SetADC(uint8_t input, uint16_t value) {
+  if (input < kNumADCInputs) {
+    adc_values[input] = value & 0xfff;
+  }
+}
+
+Status LoadFlashImage(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return ERROR;
+  }
+  const size_t size = fread(hal_sim_flash, 1, sizeof(hal_sim_flash), file);
+  fclose(file);
+  return size == sizeof(hal_sim_flash) ? OK : ERROR;
+}
+
+Status SaveFlashImage(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    return ERROR;
+  }
+  const size_t size = fwrite(hal_sim_flash, 1, sizeof(hal_sim_flash), file);
+  return fclose(file) == 0 && size == sizeof(hal_sim_flash) ? OK : ERROR;
+}
+
+}  // namespace hal_sim
+
+using hal_sim::kNumGPIO;
+
+void gpio_init(uint gpio) {
+  gpio_set_dir(gpio, false);
+  gpio_put(gpio, false);
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+  if (out) {
+    hal_sim::output_enable |= 1u << gpio;
+  } else {
+    hal_sim::output_enable &= ~(1u << gpio);
+  }
+}
+
+void gpio_put(uint gpio, bool value) {
+  if (value) {
+    hal_sim::output_level |= 1u << gpio;
+  } else {
+    hal_sim::output_level &= ~(1u << gpio);
+  }
+}
+
+void gpio_pull_up(uint gpio) { hal_sim::pull_up |= 1u << gpio; }
+
+bool gpio_get(uint gpio) { return (gpio_get_all() >> gpio) & 1; }
+
+uint32_t gpio_get_all() {
+  hal_sim::ApplySwitchTimeline();
+  const uint32_t enabled = hal_sim::output_enable;
+  const uint32_t level = hal_sim::output_level;
+  const uint32_t driven_low = enabled & ~level;
+  uint32_t value = (enabled & level) | (~enabled & hal_sim::pull_up);
+  for (uint gpio = 0; gpio < kNumGPIO; ++gpio) {
+    if (!(enabled & (1u << gpio)) && (hal_sim::switches[gpio] & driven_low)) {
+      value &= ~(1u << gpio);
+    }
+  }
+  return value;
+}
+
+static uint adc_input = 0;
+
+void adc_init() {}
+
+void adc_gpio_init(uint gpio) {}
+
+void adc_select_input(uint input) { adc_input = input; }
+
+uint16_t adc_read() {
+  return adc_input < hal_sim::kNumADCInputs
+             ? hal_sim::adc_values[adc_input].load()
+             : 0;
+}
+
+#if HAL_SIM_VIRTUAL_TIME
+
+static constexpr uint64_t kTickUs = 1000000 / configTICK_RATE_HZ;
+
+// Time spent in busy waits since the start of tick_start_us. Capped below a
+// tick, so that time never runs ahead of the scheduler.
+static uint64_t tick_start_us = 0;
+static uint64_t busy_us = 0;
+
+static uint64_t VirtualTimeUs() {
+  const uint64_t tick_us = (uint64_t)xTaskGetTickCount() * kTickUs;
+  if (tick_us != tick_start_us) {
+    tick_start_us = tick_us;
+    busy_us = 0;
+  }
+  return tick_us + busy_us;
+}
+
+uint64_t time_us_64() {
+  const uint32_t irq = save_and_disable_interrupts();
+  const uint64_t now_us = VirtualTimeUs();
+  restore_interrupts(irq);
+  return now_us;
+}
+
+void busy_wait_us(uint64_t delay_us) {
+  const uint32_t irq = save_and_disable_interrupts();
+  VirtualTimeUs();
+  busy_us = std::min(busy_us + delay_us, kTickUs - 1);
+  restore_interrupts(irq);
+}
+
+#else
+
+uint64_t time_us_64() {
+  // Function local so that it's initialized before the static initializers
+  // using it, like the joystick calibration
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void busy_wait_us(uint64_t delay_us) {
+  const uint64_t end = time_us_64() + delay_us;
+  while (time_us_64() < end) {
+  }
+}
+
+#endif /* HAL_SIM_VIRTUAL_TIME */
+
+uint32_t time_us_32() { return (uint32_t)time_us_64(); }
+
+void busy_wait_us_32(uint32_t delay_us) { busy_wait_us(delay_us); }
+
+void busy_wait_ms(uint32_t delay_ms) { busy_wait_us(delay_ms * 1000ull); }
+
+// Alarms
+
+static constexpr uint kNumAlarms = 4;
+
+struct Alarm {
+  std::atomic<bool> claimed{false};
+  std::atomic<bool> armed{false};
+  std::atomic<uint64_t> target{0};
+  std::atomic<hardware_alarm_callback_t> callback{nullptr};
+};
+
+static std::array<Alarm, kNumAlarms> alarms;
+static TaskHandle_t alarm_task_handle = NULL;
+
+static void AlarmTask(void* parameter) {
+  (void)parameter;
+  while (true) {
+    uint64_t next = UINT64_MAX;
+    for (uint i = 0; i < kNumAlarms; ++i) {
+      if (!alarms[i].armed) {
+        continue;
+      }
+      const uint64_t target = alarms[i].target;
+      if (target <= time_us_64()) {
+        alarms[i].armed = false;
+        hardware_alarm_callback_t callback = alarms[i].callback;
+        if (callback != nullptr) {
+          callback(i);
+        }
+        // The callback may have armed it again
+        next = 0;
+      } else {
+        next = std::min(next, target);
+      }
+    }
+    if (next == 0) {
+      continue;
+    }
+    TickType_t ticks = portMAX_DELAY;
+    if (next != UINT64_MAX) {
+      const uint64_t delay_us = next - std::min(next, time_us_64());
+      ticks = (delay_us * configTICK_RATE_HZ + 999999) / 1000000;
+    }
+    ulTaskNotifyTake(pdTRUE, ticks);
+  }
+}
+
+int hardware_alarm_claim_unused(bool required) {
+  for (uint i = 0; i < kNumAlarms; ++i) {
+    if (!alarms[i].claimed.exchange(true)) {
+      return i;
+    }
+  }
+  if (required) {
+    fprintf(stderr, "No unused hardware alarm\n");
+    abort();
+  }
+  return -1;
+}
+
+void hardware_alarm_set_callback(uint alarm_num,
+                                 hardware_alarm_callback_t callback) {
+  alarms[alarm_num].callback = callback;
+  if (alarm_task_handle == NULL) {
+    // Above all the firmware tasks, like an interrupt
+    xTaskCreate(&AlarmTask, "alarm_task", configMINIMAL_STACK_SIZE, NULL,
+                configMAX_PRIORITIES - 1, &alarm_task_handle);
+  }
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t target) {
+  if (target <= time_us_64()) {
+    return true;
+  }
+  alarms[alarm_num].target = target;
+  alarms[alarm_num].armed = true;
+  if (alarm_task_handle != NULL &&
+      xTaskGetCurrentTaskHandle() != alarm_task_handle) {
+    xTaskNotifyGive(alarm_task_handle);
+  }
+  return false;
+}
+
+// Spin locks and interrupts. A critical section keeps the tick from switching
+// tasks, which is all the exclusion the POSIX port needs.
+
+struct spin_lock {
+  uint8_t unused;
+};
+
+static constexpr uint kNumSpinLocks = 32;
+static std::array<spin_lock_t, kNumSpinLocks> spin_locks;
+static std::atomic<uint> next_spin_lock{0};
+
+int spin_lock_claim_unused(bool required) {
+  const uint lock_num = next_spin_lock++;
+  if (lock_num < kNumSpinLocks) {
+    return lock_num;
+  }
+  if (required) {
+    fprintf(stderr, "No unused spin lock\n");
+    abort();
+  }
+  return -1;
+}
+
+spin_lock_t* spin_lock_instance(uint lock_num) { return &spin_locks[lock_num]; }
+
+uint32_t spin_lock_blocking(spin_lock_t* lock) {
+  (void)lock;
+  return save_and_disable_interrupts();
+}
+
+void spin_unlock(spin_lock_t* lock, uint32_t saved_irq) {
+  (void)lock;
+  restore_interrupts(saved_irq);
+}
+
+// Nothing else runs before the scheduler starts, e.g. during the static
+// initializers and InitializeStorage(). Returns whether it entered a critical
+// section.
+uint32_t save_and_disable_interrupts() {
+  if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) {
+    return 0;
+  }
+  taskENTER_CRITICAL();
+  return 1;
+}
+
+void restore_interrupts(uint32_t status) {
+  if (status) {
+    taskEXIT_CRITICAL();
+  }
+}
+
+// Flash
+
+uint8_t hal_sim_flash[PICO_FLASH_SIZE_BYTES];
+
+// Erased, like a new chip
+static const bool flash_erased =
+    (memset(hal_sim_flash, 0xff, sizeof(hal_sim_flash)), true);
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+  memset(&hal_sim_flash[flash_offs], 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data,
+                         size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    hal_sim_flash[flash_offs + i] &= data[i];
+  }
+}
+
+// Reboots end the simulation
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {}
+
+void watchdog_update() {}
+
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms) {
+  printf("Reboot requested, exiting\n");
+  fflush(NULL);
+  _exit(0);
+}
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask,
+                    uint32_t disable_interface_mask) {
+  printf("BOOTSEL requested, exiting\n");
+  fflush(NULL);
+  _exit(0);
+}
+
+void stdio_set_driver_enabled(stdio_driver_t* driver, bool enabled) {}
@@ -0,0 +1,78 @@
+#ifndef HOST_HAL_SIM_H_
+#define HOST_HAL_SIM_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+// Drives the simulated hardware of the host build. Unless noted otherwise
+// these can be called from any thread, including ones that aren't FreeRTOS
+// tasks, as they only touch atomics.
+//
+// Built with HAL_SIM_VIRTUAL_TIME, time_us_64() follows the FreeRTOS tick
+// instead of the host clock, and busy waits advance it within the tick without
+// spinning. Results then only depend on the order the tasks run in, not on
+// how fast the host runs them. Time has microseconds, but tasks only wake up
+// on a tick, 1 ms with the host configTICK_RATE_HZ, so anything timed by the
+// scheduler is only resolved to a tick.
+
+namespace hal_sim {
+
+// Number of GPIOs of the RP2040
+constexpr uint8_t kNumGPIO = 30;
+
+// Closes or opens a switch between two GPIOs, like a key of the matrix. An
+// input reads low while a closed switch connects it to an output driven low.
+// Diodes aren't simulated.
+void SetSwitch(uint8_t gpio_a, uint8_t gpio_b, bool closed);
+
+struct SwitchTransition {
+  uint64_t time_us;
+  uint8_t gpio_a;
+  uint8_t gpio_b;
+  bool closed;
+};
+
+// Transitions sorted by time, applied by the first GPIO read at or after
+// their time. Set it before the scheduler starts. Only one task may read the
+// GPIOs, like the keyscan.
+void SetSwitchTimeline(std::vector<SwitchTransition> timeline);
+
+// 12 bit reading of the ADC input. All inputs start at mid scale.
+void SetADC(uint8_t input, uint16_t value);
+
+// Replaces the flash with the content of `path`, which has to be
+// PICO_FLASH_SIZE_BYTES long. Call before InitializeStorage().
+Status LoadFlashImage(const std::string& path);
+Status SaveFlashImage(const std::string& path);
+
+// A HID report as the host received it
+struct HIDReport {
+  // When the firmware called tud_hid_n_report()
+  uint64_t queued_us;
+  // Start of the frame the host polled it in
+  uint64_t delivered_us;
+  uint8_t instance;
+  std::vector<uint8_t> data;
+};
+
+// Called from the USB task for each report the host polled. Set it before the
+// scheduler starts.
+void SetHIDReportObserver(std::function<void(const HIDReport&)> observer);
+
+// Requests from the host, handled by the USB task on its next frame. They go
+// through a single producer queue, so only one thread may call them.
+
+// The device mounts on its first frame. These simulate replugging it.
+void MountUSB();
+void UnmountUSB();
+// Output report, like the lock key LEDs of the keyboard
+void SendHostOutputReport(uint8_t instance, const std::vector<uint8_t>& data);
+
+}  // namespace hal_sim
+
+#endif /* HOST_HAL_SIM_H_ */
@@ -0,0 +1,13 @@
+#ifndef HOST_HARDWARE_ADC_H_
+#define HOST_HARDWARE_ADC_H_
+
+#include "pico/types.h"
+
+// Simulated ADC, the channels read what hal_sim::SetADC() set
+
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+uint16_t adc_read();
+
+#endif /* HOST_HARDWARE_ADC_H_ */
@@ -0,0 +1,23 @@
+#ifndef HOST_HARDWARE_FLASH_H_
+#define HOST_HARDWARE_FLASH_H_
+
+#include <stddef.h>
+
+#include "pico/types.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+// Simulated flash, see hal_sim::LoadFlashImage()
+extern uint8_t hal_sim_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_NOCACHE_NOALLOC_BASE (hal_sim_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+// Clears bits only, like programming real flash
+void flash_range_program(uint32_t flash_offs, const uint8_t* data,
+                         size_t count);
+
+#endif /* HOST_HARDWARE_FLASH_H_ */
@@ -0,0 +1,19 @@
+#ifndef HOST_HARDWARE_GPIO_H_
+#define HOST_HARDWARE_GPIO_H_
+
+#include "pico/types.h"
+
+// Simulated GPIO bank. Switches closed with hal_sim::SetSwitch() connect two
+// pins, so that an input reads low while the other pin is driven low.
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+void gpio_pull_up(uint gpio);
+bool gpio_get(uint gpio);
+uint32_t gpio_get_all();
+
+#endif /* HOST_HARDWARE_GPIO_H_ */
@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_I2C_H_
+#define HOST_HARDWARE_I2C_H_
+
+// Only the types, so that the layout headers compile. The I2C devices aren't
+// part of the host build.
+
+typedef struct i2c_inst i2c_inst_t;
+
+#define i2c0 ((i2c_inst_t*)0)
+#define i2c1 ((i2c_inst_t*)1)
+
+#endif /* HOST_HARDWARE_I2C_H_ */
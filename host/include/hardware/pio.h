@@ -0,0 +1,13 @@
+#ifndef HOST_HARDWARE_PIO_H_
+#define HOST_HARDWARE_PIO_H_
+
+// Only the types, so that the layout headers compile. The PIO devices aren't
+// part of the host build.
+
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t* PIO;
+
+#define pio0 ((PIO)0)
+#define pio1 ((PIO)1)
+
+#endif /* HOST_HARDWARE_PIO_H_ */
@@ -0,0 +1,19 @@
+#ifndef HOST_HARDWARE_SYNC_H_
+#define HOST_HARDWARE_SYNC_H_
+
+#include "pico/types.h"
+
+// Both map to a FreeRTOS critical section, as the POSIX port runs one task at
+// a time
+
+typedef struct spin_lock spin_lock_t;
+
+int spin_lock_claim_unused(bool required);
+spin_lock_t* spin_lock_instance(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t* lock);
+void spin_unlock(spin_lock_t* lock, uint32_t saved_irq);
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+#endif /* HOST_HARDWARE_SYNC_H_ */
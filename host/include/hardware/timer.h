@@ -0,0 +1,26 @@
+#ifndef HOST_HARDWARE_TIMER_H_
+#define HOST_HARDWARE_TIMER_H_
+
+#include "pico/types.h"
+
+// Monotonic time since the simulation started
+uint64_t time_us_64();
+uint32_t time_us_32();
+
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+
+// Spin like on the device, so that the measured tick times include them
+void busy_wait_us_32(uint32_t delay_us);
+void busy_wait_us(uint64_t delay_us);
+void busy_wait_ms(uint32_t delay_ms);
+
+// Alarms fire from a FreeRTOS task at the highest priority, with the
+// resolution of the FreeRTOS tick
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_set_callback(uint alarm_num,
+                                 hardware_alarm_callback_t callback);
+// Returns true if `target` has already passed, like pico-sdk
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t target);
+
+#endif /* HOST_HARDWARE_TIMER_H_ */
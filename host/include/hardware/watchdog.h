@@ -0,0 +1,11 @@
+#ifndef HOST_HARDWARE_WATCHDOG_H_
+#define HOST_HARDWARE_WATCHDOG_H_
+
+#include "pico/types.h"
+
+// The watchdog never fires on the host. A reboot exits the simulation.
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+void watchdog_update();
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms);
+
+#endif /* HOST_HARDWARE_WATCHDOG_H_ */
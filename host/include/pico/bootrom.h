@@ -0,0 +1,10 @@
+#ifndef HOST_PICO_BOOTROM_H_
+#define HOST_PICO_BOOTROM_H_
+
+#include "pico/types.h"
+
+// Exits the simulation
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask,
+                    uint32_t disable_interface_mask);
+
+#endif /* HOST_PICO_BOOTROM_H_ */
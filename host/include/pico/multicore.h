@@ -0,0 +1,6 @@
+#ifndef HOST_PICO_MULTICORE_H_
+#define HOST_PICO_MULTICORE_H_
+
+// The host build has a single core, see sync_host.cc
+
+#endif /* HOST_PICO_MULTICORE_H_ */
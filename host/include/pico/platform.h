@@ -0,0 +1,11 @@
+#ifndef HOST_PICO_PLATFORM_H_
+#define HOST_PICO_PLATFORM_H_
+
+#include "pico/types.h"
+
+// Everything runs from RAM on the host
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __no_inline_not_in_flash_func(func_name) __attribute__((noinline)) func_name
+
+#endif /* HOST_PICO_PLATFORM_H_ */
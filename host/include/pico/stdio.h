@@ -0,0 +1,13 @@
+#ifndef HOST_PICO_STDIO_H_
+#define HOST_PICO_STDIO_H_
+
+#include <stdio.h>
+
+#include "pico/types.h"
+
+typedef struct stdio_driver stdio_driver_t;
+
+// printf already goes to stdout on the host, so drivers are never called
+void stdio_set_driver_enabled(stdio_driver_t* driver, bool enabled);
+
+#endif /* HOST_PICO_STDIO_H_ */
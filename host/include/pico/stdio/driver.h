@@ -0,0 +1,15 @@
+#ifndef HOST_PICO_STDIO_DRIVER_H_
+#define HOST_PICO_STDIO_DRIVER_H_
+
+#include "pico/stdio.h"
+
+// Same member order as pico-sdk, so designated initializers work
+struct stdio_driver {
+  void (*out_chars)(const char* buf, int len);
+  void (*out_flush)(void);
+  int (*in_chars)(char* buf, int len);
+  stdio_driver_t* next;
+  bool crlf_enabled;
+};
+
+#endif /* HOST_PICO_STDIO_DRIVER_H_ */
@@ -0,0 +1,9 @@
+#ifndef HOST_PICO_STDLIB_H_
+#define HOST_PICO_STDLIB_H_
+
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+#include "pico/platform.h"
+#include "pico/types.h"
+
+#endif /* HOST_PICO_STDLIB_H_ */
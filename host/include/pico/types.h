@@ -0,0 +1,12 @@
+#ifndef HOST_PICO_TYPES_H_
+#define HOST_PICO_TYPES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+// Microseconds since boot, like pico-sdk with PICO_OPAQUE_ABSOLUTE_TIME_T off
+typedef uint64_t absolute_time_t;
+
+#endif /* HOST_PICO_TYPES_H_ */
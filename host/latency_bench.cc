@@ -0,0 +1,346 @@
+// Measures the latency from a switch closing or opening to the host receiving
+// the HID report with the change. A seeded timeline of presses and releases
+// with contact bounce is played on the keys of layer 0, through the real
+// keyscan, runner and USB tasks on virtual time (see hal_sim.h), which is
+// meant to make runs with the same arguments repeatable. It hasn't been run
+// yet, so neither that nor any latency figure has been checked.
+//
+//   latency_bench [--presses N] [--seed S] [--bounce-us US] [--bounces N]
+//                 [--hold-ms MS] [--gap-ms MS] [--csv FILE]
+//                 [--max-p99-us US]
+//
+// Latency is counted from the first contact of a transition to the start of
+// the frame the host polled the report in. A change the host sees that no
+// transition explains, like a bounce getting through the debounce, is counted
+// as spurious. Exits with 1 if a transition never reached the host, or if the
+// press or release p99 is above --max-p99-us.
+//
+// The tasks only wake up on the FreeRTOS tick, 1 ms on the host, so latencies
+// come in steps of the tick printed as resolution_us. Differences smaller
+// than that, like a faster scan within a tick, don't show.
+//
+// The scan and debounce ticks are build settings, e.g.
+//   cmake -S host -B build-host -DHOST_SCAN_TICKS=1 -DHOST_DEBOUNCE_TICKS=5
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "class/hid/hid.h"
+#include "config.h"
+#include "hal_sim.h"
+#include "layout.h"
+#include "runner.h"
+#include "semphr.h"
+#include "storage.h"
+#include "task.h"
+#include "usb.h"
+#include "utils.h"
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+namespace {
+
+struct Options {
+  uint32_t presses = 200;
+  uint32_t seed = 1;
+  // Bounces happen within this long after the first contact
+  uint32_t bounce_us = 5000;
+  // Up to this many extra open and close pairs per transition
+  uint32_t max_bounces = 4;
+  uint32_t hold_ms = 60;
+  uint32_t gap_ms = 60;
+  std::string csv_path;
+  uint32_t max_p99_us = 0;
+};
+
+struct Key {
+  uint8_t sink_gpio;
+  uint8_t source_gpio;
+  uint8_t keycode;
+};
+
+struct Transition {
+  uint8_t keycode;
+  bool pressed;
+  uint64_t time_us;
+};
+
+struct Result {
+  Transition transition;
+  uint64_t latency_us;
+};
+
+// Give the USB device time to mount before the first press
+constexpr uint64_t kStartUs = 500000;
+// How long to wait for the last report after the last transition
+constexpr uint64_t kSettleUs = 500000;
+
+Options options;
+uint64_t end_us = 0;
+
+SemaphoreHandle_t semaphore;
+// All below are protected by semaphore
+std::map<uint8_t, std::deque<Transition>> expected;
+std::map<uint8_t, bool> host_pressed;
+std::vector<Result> results;
+uint32_t spurious = 0;
+
+}  // namespace
+
+// Keys of layer 0 that send a plain keycode. Modifiers and custom keycodes are
+// left out, so that a press never changes the layer.
+static std::vector<Key> FindKeys() {
+  std::vector<Key> keys;
+  for (size_t sink = 0; sink < GetNumSinkGPIOs(); ++sink) {
+    for (size_t source = 0; source < GetNumSourceGPIOs(); ++source) {
+      const Keycode keycode = GetKeycodeAtLayer(0, sink, source);
+      if (keycode.is_custom || keycode.keycode == HID_KEY_NONE ||
+          keycode.keycode >= HID_KEY_CONTROL_LEFT) {
+        continue;
+      }
+      keys.push_back(Key{.sink_gpio = GetSinkGPIO(sink),
+                         .source_gpio = GetSourceGPIO(source),
+                         .keycode = keycode.keycode});
+    }
+  }
+  return keys;
+}
+
+// Adds a transition at `time_us` followed by its bounces, ending in `closed`
+static void AddTransition(const Key& key, uint64_t time_us, bool closed,
+                          std::mt19937* rng,
+                          std::vector<hal_sim::SwitchTransition>* timeline) {
+  timeline->push_back(hal_sim::SwitchTransition{.time_us = time_us,
+                                                .gpio_a = key.sink_gpio,
+                                                .gpio_b = key.source_gpio,
+                                                .closed = closed});
+  const uint32_t bounces =
+      options.bounce_us > 1 ? (*rng)() % (options.max_bounces + 1) : 0;
+  std::vector<uint64_t> times;
+  for (uint32_t i = 0; i < 2 * bounces; ++i) {
+    times.push_back(time_us + 1 + (*rng)() % (options.bounce_us - 1));
+  }
+  std::sort(times.begin(), times.end());
+  for (size_t i = 0; i < times.size(); ++i) {
+    timeline->push_back(hal_sim::SwitchTransition{
+        .time_us = times[i],
+        .gpio_a = key.sink_gpio,
+        .gpio_b = key.source_gpio,
+        .closed = (i % 2 == 0) ? !closed : closed});
+  }
+  expected[key.keycode].push_back(Transition{
+      .keycode = key.keycode, .pressed = closed, .time_us = time_us});
+}
+
+static Status BuildTimeline() {
+  const std::vector<Key> keys = FindKeys();
+  if (keys.empty()) {
+    fprintf(stderr, "No plain key on layer 0\n");
+    return ERROR;
+  }
+  if (options.bounce_us >= options.hold_ms * 1000 ||
+      options.bounce_us >= options.gap_ms * 1000) {
+    fprintf(stderr, "Bounces have to end before the next transition\n");
+    return ERROR;
+  }
+
+  std::mt19937 rng(options.seed);
+  std::vector<hal_sim::SwitchTransition> timeline;
+  uint64_t time_us = kStartUs;
+  for (uint32_t i = 0; i < options.presses; ++i) {
+    const Key& key = keys[i % keys.size()];
+    AddTransition(key, time_us, /*closed=*/true, &rng, &timeline);
+    time_us += options.hold_ms * 1000;
+    AddTransition(key, time_us, /*closed=*/false, &rng, &timeline);
+    time_us += options.gap_ms * 1000;
+  }
+  for (const Key& key : keys) {
+    host_pressed[key.keycode] = false;
+  }
+  end_us = time_us + kSettleUs;
+  hal_sim::SetSwitchTimeline(std::move(timeline));
+  return OK;
+}
+
+static bool IsPressed(const std::vector<uint8_t>& report, uint8_t keycode) {
+  // 8 bytes of boot protocol report followed by the bitmap of all keycodes,
+  // see USBKeyboardOutput
+  if (std::find(report.begin() + 2, report.begin() + 8, keycode) !=
+      report.begin() + 8) {
+    return true;
+  }
+  const size_t byte = 8 + keycode / 8;
+  return byte < report.size() && (report[byte] >> (keycode % 8)) & 1;
+}
+
+// Runs in the USB task
+static void OnReport(const hal_sim::HIDReport& report) {
+  if (report.instance != ITF_KEYBOARD || report.data.size() < 8) {
+    return;
+  }
+  LockSemaphore lock(semaphore);
+  for (auto& [keycode, pressed] : host_pressed) {
+    const bool now_pressed = IsPressed(report.data, keycode);
+    if (now_pressed == pressed) {
+      continue;
+    }
+    pressed = now_pressed;
+    std::deque<Transition>& pending = expected[keycode];
+    if (pending.empty() || pending.front().pressed != now_pressed ||
+        pending.front().time_us > report.delivered_us) {
+      ++spurious;
+      continue;
+    }
+    results.push_back(
+        Result{.transition = pending.front(),
+               .latency_us = report.delivered_us - pending.front().time_us});
+    pending.pop_front();
+  }
+}
+
+// Nearest rank percentile of sorted values
+static uint64_t Percentile(const std::vector<uint64_t>& sorted,
+                           uint32_t percent) {
+  const size_t rank = (sorted.size() * percent + 99) / 100;
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// Prints the stats of one direction, returns its p99
+static uint64_t PrintStats(const char* name, bool pressed) {
+  std::vector<uint64_t> latencies;
+  for (const Result& result : results) {
+    if (result.transition.pressed == pressed) {
+      latencies.push_back(result.latency_us);
+    }
+  }
+  if (latencies.empty()) {
+    printf("%-8s n=0\n", name);
+    return 0;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const uint64_t p99 = Percentile(latencies, 99);
+  printf("%-8s n=%zu p50=%llu p99=%llu max=%llu us\n", name, latencies.size(),
+         (unsigned long long)Percentile(latencies, 50),
+         (unsigned long long)p99, (unsigned long long)latencies.back());
+  return p99;
+}
+
+static void WriteCSV() {
+  FILE* file = fopen(options.csv_path.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Can't write %s\n", options.csv_path.c_str());
+    return;
+  }
+  fprintf(file, "time_us,keycode,pressed,latency_us\n");
+  for (const Result& result : results) {
+    fprintf(file, "%llu,%u,%d,%llu\n",
+            (unsigned long long)result.transition.time_us,
+            result.transition.keycode, result.transition.pressed,
+            (unsigned long long)result.latency_us);
+  }
+  fclose(file);
+}
+
+static void ReportTask(void* parameter) {
+  (void)parameter;
+  const TickType_t end_tick = end_us / (1000000 / configTICK_RATE_HZ) + 1;
+  while (xTaskGetTickCount() < end_tick) {
+    vTaskDelay(end_tick - xTaskGetTickCount());
+  }
+
+  int exit_code = 0;
+  {
+    LockSemaphore lock(semaphore);
+    uint32_t missed = 0;
+    for (const auto& [keycode, pending] : expected) {
+      missed += pending.size();
+    }
+    printf(
+        "scan_ticks=%d debounce_ticks=%d usb_poll_ms=%d seed=%u "
+        "resolution_us=%u\n",
+        CONFIG_SCAN_TICKS, CONFIG_DEBOUNCE_TICKS, CONFIG_USB_POLL_MS,
+        options.seed, (unsigned)(1000000 / configTICK_RATE_HZ));
+    const uint64_t press_p99 = PrintStats("press", /*pressed=*/true);
+    const uint64_t release_p99 = PrintStats("release", /*pressed=*/false);
+    printf("missed=%u spurious=%u\n", missed, spurious);
+    if (!options.csv_path.empty()) {
+      WriteCSV();
+    }
+    if (missed > 0 ||
+        (options.max_p99_us > 0 && (press_p99 > options.max_p99_us ||
+                                    release_p99 > options.max_p99_us))) {
+      exit_code = 1;
+    }
+  }
+  fflush(NULL);
+  // Skips the static destructors, the tasks are still running
+  _exit(exit_code);
+}
+
+static bool ParseOptions(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--presses") {
+      options.presses = strtoul(value, NULL, 0);
+    } else if (arg == "--seed") {
+      options.seed = strtoul(value, NULL, 0);
+    } else if (arg == "--bounce-us") {
+      options.bounce_us = strtoul(value, NULL, 0);
+    } else if (arg == "--bounces") {
+      options.max_bounces = strtoul(value, NULL, 0);
+    } else if (arg == "--hold-ms") {
+      options.hold_ms = strtoul(value, NULL, 0);
+    } else if (arg == "--gap-ms") {
+      options.gap_ms = strtoul(value, NULL, 0);
+    } else if (arg == "--csv") {
+      options.csv_path = value;
+    } else if (arg == "--max-p99-us") {
+      options.max_p99_us = strtoul(value, NULL, 0);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (!ParseOptions(argc, argv)) {
+    fprintf(stderr,
+            "Usage: %s [--presses N] [--seed S] [--bounce-us US] "
+            "[--bounces N] [--hold-ms MS] [--gap-ms MS] [--csv FILE] "
+            "[--max-p99-us US]\n",
+            argv[0]);
+    return 2;
+  }
+  semaphore = xSemaphoreCreateBinary();
+  if (semaphore == NULL || BuildTimeline() != OK) {
+    return 2;
+  }
+  xSemaphoreGive(semaphore);
+  hal_sim::SetHIDReportObserver(&OnReport);
+
+  if (InitializeStorage() == OK &&   //
+      runner::RunnerInit() == OK &&  //
+      runner::RunnerStart() == OK &&
+      xTaskCreate(&ReportTask, "report_task", configMINIMAL_STACK_SIZE, NULL,
+                  tskIDLE_PRIORITY + 1, NULL) == pdPASS) {
+    vTaskStartScheduler();
+  }
+
+  return 2;
+}
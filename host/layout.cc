@@ -0,0 +1,64 @@
+// Small matrix for the host build. hal_sim::SetSwitch(row, col, true) presses
+// a key, e.g. GPIO 0 and 2 for A.
+
+#include "layout_helper.h"
+
+#define C0 2
+#define C1 3
+#define C2 4
+#define R0 0
+#define R1 1
+
+#define CONFIG_NUM_PHY_ROWS 2
+#define CONFIG_NUM_PHY_COLS 3
+
+#define ALT_LY 2
+
+static constexpr uint8_t kRowGPIO[] = {R0, R1};
+static constexpr uint8_t kColGPIO[] = {C0, C1, C2};
+static constexpr bool kDiodeColToRow = true;
+
+// clang-format off
+
+static constexpr GPIO kGPIOMatrix[CONFIG_NUM_PHY_ROWS][CONFIG_NUM_PHY_COLS] = {
+  {G(R0, C0),  G(R0, C1),  G(R0, C2)},
+  {G(R1, C0),  G(R1, C1),  G(R1, C2)},
+};
+
+static constexpr Keycode kKeyCodes[][CONFIG_NUM_PHY_ROWS][CONFIG_NUM_PHY_COLS] = {
+  [0]={
+    {K(K_A),     K(K_B),      K(K_C)},
+    {MO(1),      K(K_SFT_L),  CK(MSE_L)},
+  },
+  [1]={
+    {K(K_1),     K(K_2),      K(K_3)},
+    {______,     ______,      ______},
+  },
+  [ALT_LY]={},
+};
+
+// clang-format on
+
+// Compile time validation and conversion for the key matrix
+#include "layout_internal.inc"
+
+// Register all the devices
+
+enum {
+  JOYSTICK = 0,
+  JOYSTICK_2,
+  KEYSCAN,
+  SCREEN,
+  USB_KEYBOARD,
+  USB_MOUSE,
+  RAW_HID,
+};
+
+// No screen, so the config mode has no UI
+static Status register1 = RegisterConfigModifier(SCREEN);
+static Status register2 = RegisterJoystick(JOYSTICK, JOYSTICK_2, 26, 27, 5,
+                                           false, false, true, ALT_LY);
+static Status register3 = RegisterKeyscan(KEYSCAN);
+static Status register4 = RegisterUSBKeyboardOutput(USB_KEYBOARD);
+static Status register5 = RegisterUSBMouseOutput(USB_MOUSE);
+static Status register6 = RegisterRawHIDConfig(RAW_HID);
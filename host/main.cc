@@ -0,0 +1,123 @@
+// Runs the firmware on the host. Commands on stdin drive the simulated
+// hardware, and the reports the host receives are printed to stdout:
+//
+//   press <gpio> <gpio>    Closes the switch between two GPIOs
+//   release <gpio> <gpio>  Opens it
+//   adc <input> <value>    Sets the 12 bit reading of an ADC input
+//   led <mask>             Sends the keyboard LED output report, see HostLED
+//   mount, unmount         Replugs the USB device
+//   wait <ms>              Waits before the next command, e.g. in scripts
+//   quit
+//
+// Each report is printed as "report <queued us> <delivered us> <instance>
+// <bytes in hex>". With --flash <file>, the flash starts from and is saved to
+// the file, so that the config persists across runs.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "FreeRTOS.h"
+#include "hal_sim.h"
+#include "runner.h"
+#include "storage.h"
+#include "task.h"
+#include "usb.h"
+#include "utils.h"
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+static std::string flash_path;
+
+static void PrintReport(const hal_sim::HIDReport& report) {
+  printf("report %llu %llu %u ", (unsigned long long)report.queued_us,
+         (unsigned long long)report.delivered_us, report.instance);
+  for (uint8_t byte : report.data) {
+    printf("%02x", byte);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+static void Quit() {
+  if (!flash_path.empty() && hal_sim::SaveFlashImage(flash_path) != OK) {
+    fprintf(stderr, "Failed to save the flash to %s\n", flash_path.c_str());
+  }
+  // Skips the static destructors, the tasks are still running
+  fflush(NULL);
+  _exit(0);
+}
+
+// Not a FreeRTOS task, so it may only use the hal_sim functions
+static void CommandThread() {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream args(line);
+    std::string command;
+    unsigned a = 0;
+    unsigned b = 0;
+    if (!(args >> command)) {
+      continue;
+    }
+    if ((command == "press" || command == "release") && (args >> a >> b)) {
+      hal_sim::SetSwitch(a, b, command == "press");
+    } else if (command == "adc" && (args >> a >> b)) {
+      hal_sim::SetADC(a, b);
+    } else if (command == "led" && (args >> std::hex >> a)) {
+      hal_sim::SendHostOutputReport(ITF_KEYBOARD, {(uint8_t)a});
+    } else if (command == "mount") {
+      hal_sim::MountUSB();
+    } else if (command == "unmount") {
+      hal_sim::UnmountUSB();
+    } else if (command == "wait" && (args >> a)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(a));
+    } else if (command == "quit") {
+      break;
+    } else {
+      fprintf(stderr, "Unknown command: %s\n", line.c_str());
+    }
+  }
+  Quit();
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--flash" && i + 1 < argc) {
+      flash_path = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--flash <file>]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (!flash_path.empty() && hal_sim::LoadFlashImage(flash_path) != OK) {
+    fprintf(stderr, "Starting from erased flash, couldn't read %s\n",
+            flash_path.c_str());
+  }
+  hal_sim::SetHIDReportObserver(&PrintReport);
+
+  // The POSIX port drives the scheduler with signals, which must only reach
+  // the task threads. The command thread inherits the blocked mask.
+  sigset_t all_signals;
+  sigset_t previous;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+  std::thread(&CommandThread).detach();
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (InitializeStorage() == OK &&   //
+      runner::RunnerInit() == OK &&  //
+      runner::RunnerStart() == OK) {
+    vTaskStartScheduler();
+  }
+
+  return 1;
+}
@@ -0,0 +1,46 @@
+// Counts the heap operations for CONFIG_DEBUG_ALLOCATION_COUNTER. Defining
+// the allocator functions in the executable replaces glibc's for the whole
+// process, including operator new, and they forward to glibc's own entry
+// points, which keep its locking.
+//
+// Unlike on the device, a thread that isn't a FreeRTOS task is counted as well
+// if it allocates while the tracked task is the current task.
+
+#include <stddef.h>
+
+#include "utils.h"
+
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+  CountHeapOperation();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  CountHeapOperation();
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  CountHeapOperation();
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  if (ptr != NULL) {
+    CountHeapOperation();
+  }
+  __libc_free(ptr);
+}
+
+}  // extern "C"
+
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
@@ -0,0 +1,14 @@
+// Stand-in for sync.cc. The POSIX port runs one task at a time, so there is no
+// other core to stop during flash operations.
+
+#include "sync.h"
+
+Status StartSyncTasks() { return OK; }
+
+CoreBlockerSection::CoreBlockerSection() {}
+
+CoreBlockerSection::~CoreBlockerSection() {}
+
+void DisableTheOtherCore() {}
+
+void ReenableTheOtherCore() {}
@@ -0,0 +1,68 @@
+// Plays presses of every key of layer 0 and moves the joystick, on virtual
+// time, and fails if any input tick outside config mode touched the heap. See
+// CONFIG_DEBUG_ALLOCATION_COUNTER.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "check.h"
+#include "hal_sim.h"
+#include "layout.h"
+#include "runner.h"
+#include "storage.h"
+#include "task.h"
+#include "utils.h"
+
+static_assert(CONFIG_DEBUG_ALLOCATION_COUNTER,
+              "The host build enables the allocation counter");
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+// Give the USB device time to mount before the first press
+constexpr uint32_t kStartMs = 500;
+constexpr uint32_t kHoldMs = 60;
+
+static void TestTask(void* parameter) {
+  (void)parameter;
+  vTaskDelay(pdMS_TO_TICKS(kStartMs));
+
+  const uint32_t start_ticks = runner::GetScanJitterStats().num_ticks;
+  for (size_t sink = 0; sink < GetNumSinkGPIOs(); ++sink) {
+    for (size_t source = 0; source < GetNumSourceGPIOs(); ++source) {
+      hal_sim::SetSwitch(GetSinkGPIO(sink), GetSourceGPIO(source), true);
+      vTaskDelay(pdMS_TO_TICKS(kHoldMs));
+      hal_sim::SetSwitch(GetSinkGPIO(sink), GetSourceGPIO(source), false);
+      vTaskDelay(pdMS_TO_TICKS(kHoldMs));
+    }
+  }
+  // Joystick of layout.cc, to the corners and back to the center
+  for (uint16_t value : {0, 4095, 2048}) {
+    hal_sim::SetADC(0, value);
+    hal_sim::SetADC(1, value);
+    vTaskDelay(pdMS_TO_TICKS(kHoldMs));
+  }
+
+  const uint32_t num_ticks =
+      runner::GetScanJitterStats().num_ticks - start_ticks;
+  const uint32_t allocating_ticks = runner::GetAllocatingTickCount();
+  printf("%u input ticks, %u allocated\n", num_ticks, allocating_ticks);
+  CHECK(num_ticks > 0);
+  CHECK(allocating_ticks == 0);
+  fflush(NULL);
+  // Skips the static destructors, the tasks are still running
+  _exit(0);
+}
+
+int main() {
+  if (InitializeStorage() == OK &&   //
+      runner::RunnerInit() == OK &&  //
+      runner::RunnerStart() == OK &&
+      xTaskCreate(&TestTask, "test_task", configMINIMAL_STACK_SIZE, NULL,
+                  tskIDLE_PRIORITY + 1, NULL) == pdPASS) {
+    vTaskStartScheduler();
+  }
+  return 1;
+}
@@ -0,0 +1,19 @@
+#ifndef HOST_TESTS_CHECK_H_
+#define HOST_TESTS_CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The host tests are plain executables run by CTest, which fail on the first
+// CHECK that doesn't hold
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                            \
+      fflush(NULL);                                                   \
+      _Exit(1);                                                       \
+    }                                                                 \
+  } while (0)
+
+#endif /* HOST_TESTS_CHECK_H_ */
@@ -0,0 +1,311 @@
+// Mounts the mass storage volume of usb_msc.cc the way a host does, by calling
+// the SCSI callbacks of TinyUSB, on virtual time. Checks that the config file
+// shows up, that replacing it is only written to flash once the host flushes
+// or its writes settle, and that the volume isn't reset under the host by its
+// own commit.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "base.h"
+#include "check.h"
+#include "config.h"
+#include "hal_sim.h"
+#include "runner.h"
+#include "storage.h"
+#include "task.h"
+#include "tusb.h"
+#include "utils.h"
+
+static_assert(CONFIG_USB_MASS_STORAGE, "Needs CONFIG_USB_MASS_STORAGE");
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+namespace {
+
+constexpr uint32_t kSectorSize = 512;
+// Give the USB device time to mount first
+constexpr uint32_t kStartMs = 500;
+// A few input ticks, for the input task to pick up a commit
+constexpr uint32_t kCommitMs = 100;
+// Longer than usb_msc.cc waits for the writes to settle
+constexpr uint32_t kSettleMs = 1000;
+
+using Sector = std::array<uint8_t, kSectorSize>;
+
+// Layout read from the boot sector
+uint32_t fat_start;
+uint32_t num_fats;
+uint32_t root_dir_start;
+uint32_t data_start;
+uint32_t total_sectors;
+
+uint16_t Read16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+uint32_t Read32(const uint8_t* p) { return Read16(p) | (Read16(p + 2) << 16); }
+
+void Write16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+void Write32(uint8_t* p, uint32_t v) {
+  Write16(p, v & 0xffff);
+  Write16(p + 2, v >> 16);
+}
+
+uint16_t GetFatEntry(const uint8_t* fat, uint16_t cluster) {
+  const uint16_t v = Read16(fat + cluster * 3 / 2);
+  return (cluster & 1) ? v >> 4 : v & 0xfff;
+}
+
+void SetFatEntry(uint8_t* fat, uint16_t cluster, uint16_t value) {
+  uint8_t* p = fat + cluster * 3 / 2;
+  if (cluster & 1) {
+    p[0] = (p[0] & 0x0f) | (value << 4);
+    p[1] = value >> 4;
+  } else {
+    p[0] = value;
+    p[1] = (p[1] & 0xf0) | ((value >> 8) & 0x0f);
+  }
+}
+
+Sector ReadSector(uint32_t lba) {
+  Sector sector;
+  CHECK(tud_msc_read10_cb(0, lba, 0, sector.data(), sector.size()) ==
+        (int32_t)sector.size());
+  return sector;
+}
+
+void WriteSector(uint32_t lba, Sector sector) {
+  CHECK(tud_msc_write10_cb(0, lba, 0, sector.data(), sector.size()) ==
+        (int32_t)sector.size());
+}
+
+std::string FlashContent() {
+  std::string content;
+  CHECK(ReadFileContent(CONFIG_FLASH_JSON_FILE_NAME, &content) == OK);
+  return content;
+}
+
+// Offset of the short directory entry of the file in the first root
+// directory sector
+size_t FindEntry(const Sector& dir) {
+  for (size_t offset = 0; offset < kSectorSize; offset += 32) {
+    const uint8_t* entry = dir.data() + offset;
+    CHECK(entry[0] != 0x00);
+    if (entry[0] != 0xe5 && entry[11] == 0x20) {
+      return offset;
+    }
+  }
+  CHECK(false);
+  return 0;
+}
+
+// Reads the file through the directory entry and the FAT, like a host
+std::string ReadFile(uint16_t* first_cluster) {
+  const Sector dir = ReadSector(root_dir_start);
+  const uint8_t* entry = dir.data() + FindEntry(dir);
+  uint16_t cluster = Read16(entry + 26);
+  const uint32_t size = Read32(entry + 28);
+  *first_cluster = cluster;
+  const Sector fat = ReadSector(fat_start);
+  std::string content;
+  while (content.size() < size) {
+    CHECK(cluster >= 2 && data_start + cluster - 2 < total_sectors);
+    const Sector sector = ReadSector(data_start + cluster - 2);
+    content.append((const char*)sector.data(),
+                   std::min<size_t>(kSectorSize, size - content.size()));
+    cluster = GetFatEntry(fat.data(), cluster);
+  }
+  return content;
+}
+
+// Writes `content` from `first_cluster` on like a host does: the data, then
+// the FATs, then the directory entry. `between` runs after the data, before
+// the FAT and directory make it visible.
+void WriteFile(const std::string& content, uint16_t first_cluster,
+               void (*between)()) {
+  const uint32_t num_clusters =
+      (content.size() + kSectorSize - 1) / kSectorSize;
+  for (uint32_t i = 0; i < num_clusters; ++i) {
+    Sector sector = {0};
+    memcpy(sector.data(), content.data() + i * kSectorSize,
+           std::min<size_t>(kSectorSize, content.size() - i * kSectorSize));
+    WriteSector(data_start + first_cluster - 2 + i, sector);
+  }
+  if (between != NULL) {
+    between();
+  }
+
+  Sector fat = ReadSector(fat_start);
+  // Frees the clusters of the previous version
+  for (uint16_t cluster = 2; cluster < 2 + (total_sectors - data_start);
+       ++cluster) {
+    SetFatEntry(fat.data(), cluster, 0);
+  }
+  for (uint32_t i = 0; i < num_clusters; ++i) {
+    SetFatEntry(fat.data(), first_cluster + i,
+                i + 1 == num_clusters ? 0xfff : first_cluster + i + 1);
+  }
+  for (uint32_t i = 0; i < num_fats; ++i) {
+    WriteSector(fat_start + i, fat);
+  }
+
+  Sector dir = ReadSector(root_dir_start);
+  uint8_t* entry = dir.data() + FindEntry(dir);
+  Write16(entry + 26, first_cluster);
+  Write32(entry + 28, content.size());
+  WriteSector(root_dir_start, dir);
+}
+
+void Flush() {
+  uint8_t command[16] = {0x35};
+  CHECK(tud_msc_scsi_cb(0, command, NULL, 0) == 0);
+}
+
+std::string original;
+// What TestFlushCommits writes, and where
+std::string new_content;
+uint16_t new_first_cluster;
+
+// The data of the new file is written, but nothing points at it yet
+void CheckMidWrite() {
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  vTaskDelay(pdMS_TO_TICKS(kCommitMs));
+  CHECK(FlashContent() == original);
+
+  // A change from elsewhere doesn't reset the volume under the host
+  CHECK(WriteStringToFile(original, CONFIG_FLASH_JSON_FILE_NAME) == OK);
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  const Sector sector = ReadSector(data_start + new_first_cluster - 2);
+  CHECK(memcmp(sector.data(), new_content.data(),
+               std::min<size_t>(kSectorSize, new_content.size())) == 0);
+}
+
+void TestMount() {
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  uint32_t block_count;
+  uint16_t block_size;
+  tud_msc_capacity_cb(0, &block_count, &block_size);
+  CHECK(block_size == kSectorSize);
+
+  const Sector boot = ReadSector(0);
+  CHECK(boot[510] == 0x55 && boot[511] == 0xaa);
+  CHECK(memcmp(boot.data() + 54, "FAT12   ", 8) == 0);
+  CHECK(Read16(boot.data() + 11) == kSectorSize);
+  CHECK(boot[13] == 1);
+  fat_start = Read16(boot.data() + 14);
+  num_fats = boot[16];
+  root_dir_start = fat_start + num_fats * Read16(boot.data() + 22);
+  data_start = root_dir_start + Read16(boot.data() + 17) * 32 / kSectorSize;
+  total_sectors = Read16(boot.data() + 19);
+  CHECK(block_count == total_sectors);
+
+  original = FlashContent();
+  CHECK(!original.empty());
+  uint16_t first_cluster;
+  CHECK(ReadFile(&first_cluster) == original);
+  CHECK(first_cluster == 2);
+}
+
+void TestFlushCommits() {
+  // Trailing whitespace keeps it valid JSON
+  new_content = original + "\n";
+  new_first_cluster = 2 + (original.size() + kSectorSize - 1) / kSectorSize;
+  const std::string& content = new_content;
+  const uint16_t first_cluster = new_first_cluster;
+  WriteFile(content, first_cluster, &CheckMidWrite);
+
+  // Not before the host is done
+  vTaskDelay(pdMS_TO_TICKS(kCommitMs));
+  CHECK(FlashContent() == original);
+
+  Flush();
+  vTaskDelay(pdMS_TO_TICKS(kCommitMs));
+  CHECK(FlashContent() == content);
+
+  // The volume stays the way the host wrote it
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  uint16_t read_cluster;
+  CHECK(ReadFile(&read_cluster) == content);
+  CHECK(read_cluster == first_cluster);
+}
+
+void TestSettledWritesCommit() {
+  const std::string content = original + "\n\n";
+  WriteFile(content, 2, NULL);
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  vTaskDelay(pdMS_TO_TICKS(kCommitMs));
+  CHECK(FlashContent() == original + "\n");
+
+  // The next poll after the writes settled
+  vTaskDelay(pdMS_TO_TICKS(kSettleMs));
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  vTaskDelay(pdMS_TO_TICKS(kCommitMs));
+  CHECK(FlashContent() == content);
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  uint16_t read_cluster;
+  CHECK(ReadFile(&read_cluster) == content);
+}
+
+void TestInvalidIsIgnored() {
+  const std::string content = FlashContent();
+  WriteFile("{\"truncated\": ", 2, NULL);
+  Flush();
+  vTaskDelay(pdMS_TO_TICKS(kCommitMs));
+  CHECK(FlashContent() == content);
+}
+
+void TestChangeFromElsewhere() {
+  // Like a config save over raw HID
+  CHECK(WriteStringToFile(original, CONFIG_FLASH_JSON_FILE_NAME) == OK);
+  // Told once that the medium changed, then the new volume
+  CHECK(!tud_msc_test_unit_ready_cb(0));
+  CHECK(tud_msc_test_unit_ready_cb(0));
+  uint16_t first_cluster;
+  CHECK(ReadFile(&first_cluster) == original);
+  CHECK(first_cluster == 2);
+}
+
+void TestTask(void* parameter) {
+  (void)parameter;
+  vTaskDelay(pdMS_TO_TICKS(kStartMs));
+
+  TestMount();
+  TestFlushCommits();
+  TestSettledWritesCommit();
+  TestInvalidIsIgnored();
+  vTaskDelay(pdMS_TO_TICKS(kSettleMs));
+  TestChangeFromElsewhere();
+
+  printf("Mass storage checks passed\n");
+  fflush(NULL);
+  // Skips the static destructors, the tasks are still running
+  _exit(0);
+}
+
+}  // namespace
+
+int main() {
+  if (InitializeStorage() != OK || runner::RunnerInit() != OK) {
+    return 1;
+  }
+  // The flash starts erased, the volume needs a config file to show
+  DeviceRegistry::SaveConfig();
+
+  if (runner::RunnerStart() == OK &&
+      xTaskCreate(&TestTask, "test_task", configMINIMAL_STACK_SIZE * 4, NULL,
+                  tskIDLE_PRIORITY + 1, NULL) == pdPASS) {
+    vTaskStartScheduler();
+  }
+  return 1;
+}
@@ -0,0 +1,264 @@
+// Loops raw HID requests through the simulated USB host into
+// RawHIDConfigDevice and checks the responses, on virtual time. Covers the
+// config, save and telemetry commands and requests of the wrong length.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "check.h"
+#include "configuration.h"
+#include "hal_sim.h"
+#include "queue.h"
+#include "raw_hid.h"
+#include "runner.h"
+#include "storage.h"
+#include "task.h"
+#include "usb.h"
+#include "utils.h"
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+namespace {
+
+using Packet = std::array<uint8_t, kRawHIDPacketSize>;
+
+struct Response {
+  uint8_t command;
+  uint8_t sequence;
+  RawHIDStatus status;
+  std::vector<uint8_t> payload;
+};
+
+// Give the USB device time to mount before the first request
+constexpr uint32_t kStartMs = 500;
+// Far more than a response takes, one packet per input tick
+constexpr uint32_t kTimeoutMs = 1000;
+
+// Raw HID packets the host received, from the USB task to the test task
+QueueHandle_t packets;
+uint8_t next_sequence = 0;
+
+}  // namespace
+
+// Runs in the USB task
+static void OnReport(const hal_sim::HIDReport& report) {
+  if (report.instance != ITF_RAW_HID) {
+    return;
+  }
+  CHECK(report.data.size() == kRawHIDPacketSize);
+  Packet packet;
+  memcpy(packet.data(), report.data.data(), packet.size());
+  CHECK(xQueueSend(packets, &packet, 0) == pdTRUE);
+}
+
+// Sends `report` as is and collects the packets of the response
+static Response SendRaw(const std::vector<uint8_t>& report) {
+  hal_sim::SendHostOutputReport(ITF_RAW_HID, report);
+  Response response = {};
+  while (true) {
+    Packet packet;
+    CHECK(xQueueReceive(packets, &packet, pdMS_TO_TICKS(kTimeoutMs)) ==
+          pdTRUE);
+    response.command = packet[0];
+    response.sequence = packet[1];
+    response.status = (RawHIDStatus)packet[2];
+    const size_t length = packet[3] & ~kRawHIDMoreFlag;
+    CHECK(length <= kRawHIDPacketSize - kRawHIDResponseHeaderSize);
+    response.payload.insert(
+        response.payload.end(), packet.begin() + kRawHIDResponseHeaderSize,
+        packet.begin() + kRawHIDResponseHeaderSize + length);
+    if (!(packet[3] & kRawHIDMoreFlag)) {
+      return response;
+    }
+  }
+}
+
+static Response Request(RawHIDCommand command,
+                        const std::vector<uint8_t>& payload = {}) {
+  const uint8_t sequence = next_sequence++;
+  std::vector<uint8_t> report = {command, sequence};
+  report.insert(report.end(), payload.begin(), payload.end());
+  report.resize(kRawHIDPacketSize);
+  const Response response = SendRaw(report);
+  CHECK(response.command == command);
+  CHECK(response.sequence == sequence);
+  return response;
+}
+
+static std::vector<uint8_t> Path(const std::string& path) {
+  std::vector<uint8_t> bytes(path.begin(), path.end());
+  bytes.push_back('\0');
+  return bytes;
+}
+
+static std::vector<uint8_t> SetIntPayload(const std::string& path,
+                                          uint8_t type, int32_t value) {
+  std::vector<uint8_t> payload = Path(path);
+  payload.push_back(type);
+  const uint8_t* bytes = (const uint8_t*)&value;
+  payload.insert(payload.end(), bytes, bytes + sizeof(value));
+  return payload;
+}
+
+template <typename T>
+static T Read(const std::vector<uint8_t>& payload, size_t offset) {
+  CHECK(offset + sizeof(T) <= payload.size());
+  T value;
+  memcpy(&value, payload.data() + offset, sizeof(T));
+  return value;
+}
+
+static void TestVersion() {
+  const Response response = Request(RAW_HID_GET_VERSION);
+  CHECK(response.status == RAW_HID_OK);
+  CHECK(response.payload == std::vector<uint8_t>{kRawHIDProtocolVersion});
+}
+
+static void TestGetConfig() {
+  // The whole tree takes several packets
+  const Response root = Request(RAW_HID_GET_CONFIG, Path(""));
+  CHECK(root.status == RAW_HID_OK);
+  CHECK(root.payload.size() > kRawHIDPacketSize);
+  CHECK(root.payload[0] == Config::OBJECT);
+
+  const Response resolution =
+      Request(RAW_HID_GET_CONFIG, Path("joystick/mouse_resolution"));
+  CHECK(resolution.status == RAW_HID_OK);
+  CHECK(resolution.payload.size() == 1 + 3 * sizeof(int32_t));
+  CHECK(resolution.payload[0] == Config::INTEGER);
+  CHECK(Read<int32_t>(resolution.payload, 5) == 1);
+  CHECK(Read<int32_t>(resolution.payload, 9) == 100);
+
+  CHECK(Request(RAW_HID_GET_CONFIG, Path("joystick/nope")).status ==
+        RAW_HID_INVALID_PATH);
+  CHECK(Request(RAW_HID_GET_CONFIG, Path("joystick/x_profile/99")).status ==
+        RAW_HID_INVALID_PATH);
+}
+
+static void TestSetConfig() {
+  const char* path = "joystick/mouse_resolution";
+  CHECK(Request(RAW_HID_SET_CONFIG, SetIntPayload(path, Config::INTEGER, 7))
+            .status == RAW_HID_OK);
+  const Response response = Request(RAW_HID_GET_CONFIG, Path(path));
+  CHECK(response.status == RAW_HID_OK);
+  CHECK(Read<int32_t>(response.payload, 1) == 7);
+
+  // Out of range, and the wrong type
+  CHECK(Request(RAW_HID_SET_CONFIG, SetIntPayload(path, Config::INTEGER, 101))
+            .status == RAW_HID_INVALID_VALUE);
+  CHECK(Request(RAW_HID_SET_CONFIG, SetIntPayload(path, Config::FLOAT, 7))
+            .status == RAW_HID_INVALID_VALUE);
+  // Objects can't be set
+  CHECK(Request(RAW_HID_SET_CONFIG,
+                SetIntPayload("joystick", Config::OBJECT, 7))
+            .status == RAW_HID_INVALID_VALUE);
+  CHECK(Request(RAW_HID_SET_CONFIG, SetIntPayload("nope", Config::INTEGER, 7))
+            .status == RAW_HID_INVALID_PATH);
+  CHECK(Read<int32_t>(Request(RAW_HID_GET_CONFIG, Path(path)).payload, 1) ==
+        7);
+}
+
+static void TestSaveConfig() {
+  CHECK(Request(RAW_HID_SAVE_CONFIG).status == RAW_HID_OK);
+  CHECK(Request(RAW_HID_GET_VERSION).status == RAW_HID_OK);
+}
+
+static void TestTelemetry() {
+  const Response response = Request(RAW_HID_GET_TELEMETRY);
+  CHECK(response.status == RAW_HID_OK);
+  CHECK(response.payload.size() == sizeof(RawHIDTelemetry));
+  RawHIDTelemetry telemetry;
+  memcpy(&telemetry, response.payload.data(), sizeof(telemetry));
+  CHECK(telemetry.num_ticks > 0);
+  CHECK(telemetry.min_interval_us <= telemetry.max_interval_us);
+#if !CONFIG_DEBUG_IDLE_MONITOR
+  CHECK(telemetry.tick_core_idle_permille == UINT32_MAX);
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
+  CHECK(telemetry.requests_dropped == 0);
+}
+
+static void TestMalformed() {
+  // An empty report reads as command 0
+  Response response = SendRaw({});
+  CHECK(response.command == 0);
+  CHECK(response.status == RAW_HID_UNKNOWN_COMMAND);
+
+  CHECK(Request((RawHIDCommand)0x7f).status == RAW_HID_UNKNOWN_COMMAND);
+
+  // Short reports are zero filled
+  response = SendRaw({RAW_HID_GET_VERSION});
+  CHECK(response.command == RAW_HID_GET_VERSION);
+  CHECK(response.sequence == 0);
+  CHECK(response.status == RAW_HID_OK);
+  response = SendRaw({RAW_HID_SET_CONFIG, 1});
+  CHECK(response.status == RAW_HID_INVALID_VALUE);
+
+  // Long reports are cut to a packet
+  std::vector<uint8_t> report(3 * kRawHIDPacketSize, 0xff);
+  report[0] = RAW_HID_GET_VERSION;
+  report[1] = 2;
+  response = SendRaw(report);
+  CHECK(response.command == RAW_HID_GET_VERSION);
+  CHECK(response.sequence == 2);
+  CHECK(response.status == RAW_HID_OK);
+
+  // A path without its NUL in the packet
+  CHECK(Request(RAW_HID_GET_CONFIG,
+                std::vector<uint8_t>(kRawHIDPacketSize - 2, 'a'))
+            .status == RAW_HID_INVALID_PATH);
+
+  // A valid path, padded with leading zeros in the list index, that leaves
+  // no room for the value
+  const std::string prefix = "joystick/x_profile/";
+  const std::string suffix = "/0";
+  const std::string long_path =
+      prefix +
+      std::string(kRawHIDPacketSize - 2 - 4 - prefix.size() - suffix.size(),
+                  '0') +
+      suffix;
+  CHECK(Request(RAW_HID_GET_CONFIG, Path(long_path)).status == RAW_HID_OK);
+  CHECK(Request(RAW_HID_SET_CONFIG, Path(long_path)).status ==
+        RAW_HID_INVALID_VALUE);
+}
+
+static void TestTask(void* parameter) {
+  (void)parameter;
+  vTaskDelay(pdMS_TO_TICKS(kStartMs));
+
+  TestVersion();
+  TestGetConfig();
+  TestSetConfig();
+  TestSaveConfig();
+  TestTelemetry();
+  TestMalformed();
+
+  printf("%u requests passed\n", next_sequence);
+  fflush(NULL);
+  // Skips the static destructors, the tasks are still running
+  _exit(0);
+}
+
+int main() {
+  packets = xQueueCreate(64, sizeof(Packet));
+  if (packets == NULL) {
+    return 1;
+  }
+  hal_sim::SetHIDReportObserver(&OnReport);
+
+  if (InitializeStorage() == OK &&   //
+      runner::RunnerInit() == OK &&  //
+      runner::RunnerStart() == OK &&
+      xTaskCreate(&TestTask, "test_task", configMINIMAL_STACK_SIZE * 4, NULL,
+                  tskIDLE_PRIORITY + 1, NULL) == pdPASS) {
+    vTaskStartScheduler();
+  }
+  return 1;
+}
@@ -0,0 +1,72 @@
+// Pushes a sequence through a small queue from one thread while another pops
+// it. Every element must arrive whole, once and in order, and the queue must
+// never hold more than its capacity.
+
+#include "spsc_queue.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <thread>
+
+#include "check.h"
+
+namespace {
+
+constexpr uint64_t kNumElements = 2000000;
+constexpr size_t kCapacity = 8;
+
+struct Element {
+  uint64_t fields[8];
+};
+
+SPSCQueue<Element, kCapacity> queue;
+
+void Produce() {
+  for (uint64_t i = 0; i < kNumElements;) {
+    Element* element = queue.Back();
+    if (element == NULL) {
+      CHECK(queue.Size() <= kCapacity);
+      std::this_thread::yield();
+      continue;
+    }
+    for (uint64_t& field : element->fields) {
+      field = i;
+    }
+    queue.Push();
+    ++i;
+  }
+}
+
+}  // namespace
+
+int main() {
+  CHECK(queue.Front() == NULL);
+  CHECK(queue.Size() == 0);
+
+  std::thread producer(&Produce);
+
+  uint64_t num_empty = 0;
+  for (uint64_t expected = 0; expected < kNumElements;) {
+    const size_t size = queue.Size();
+    CHECK(size <= kCapacity);
+    const Element* element = queue.Front();
+    if (element == NULL) {
+      ++num_empty;
+      std::this_thread::yield();
+      continue;
+    }
+    for (uint64_t field : element->fields) {
+      CHECK(field == expected);
+    }
+    queue.Pop();
+    ++expected;
+  }
+  producer.join();
+
+  CHECK(queue.Front() == NULL);
+  CHECK(queue.Size() == 0);
+  printf("%llu elements, queue empty %llu times\n",
+         (unsigned long long)kNumElements, (unsigned long long)num_empty);
+  return 0;
+}
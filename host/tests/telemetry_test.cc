@@ -0,0 +1,90 @@
+// Feeds RecordIteration() of telemetry.h hand picked iteration times and
+// checks the durations, jitter and missed deadlines. Only the arithmetic, so
+// it runs before the scheduler starts.
+
+#include <stdio.h>
+
+#include "FreeRTOS.h"
+#include "check.h"
+#include "telemetry.h"
+#include "utils.h"
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+namespace {
+
+constexpr uint32_t kPeriodUs = 1000;
+
+void TestPeriodicTask() {
+  using telemetry::INPUT_TASK;
+  telemetry::RegisterTask(INPUT_TASK, NULL, kPeriodUs);
+
+  // The first iteration has no previous one to measure the jitter from
+  telemetry::RecordIteration(INPUT_TASK, 1000, 1200);
+  // 50 us late
+  telemetry::RecordIteration(INPUT_TASK, 2050, 2100);
+  // 70 us early
+  telemetry::RecordIteration(INPUT_TASK, 2980, 3000);
+  // 20 us late and runs longer than the period, one missed deadline
+  telemetry::RecordIteration(INPUT_TASK, 4000, 5100);
+  // A whole period late, another missed deadline
+  telemetry::RecordIteration(INPUT_TASK, 6000, 6010);
+
+  const telemetry::TaskStats stats = telemetry::GetTaskStats(INPUT_TASK);
+  CHECK(stats.period_us == kPeriodUs);
+  CHECK(stats.num_iterations == 5);
+  CHECK(stats.min_duration_us == 10);
+  CHECK(stats.max_duration_us == 1100);
+  CHECK(stats.total_duration_us == 200 + 50 + 20 + 1100 + 10);
+  CHECK(stats.max_jitter_us == 1000);
+  CHECK(stats.total_jitter_us == 50 + 70 + 20 + 1000);
+  CHECK(stats.missed_deadlines == 2);
+
+  // Late by just under a whole period is only jitter
+  telemetry::RecordIteration(INPUT_TASK, 7999, 8000);
+  CHECK(telemetry::GetTaskStats(INPUT_TASK).missed_deadlines == 2);
+  CHECK(telemetry::GetTaskStats(INPUT_TASK).max_jitter_us == 1000);
+
+  // The reset keeps the period, and the next iteration starts over without
+  // jitter
+  telemetry::ResetTaskStats();
+  telemetry::RecordIteration(INPUT_TASK, 20000, 20100);
+  const telemetry::TaskStats reset = telemetry::GetTaskStats(INPUT_TASK);
+  CHECK(reset.period_us == kPeriodUs);
+  CHECK(reset.num_iterations == 1);
+  CHECK(reset.min_duration_us == 100);
+  CHECK(reset.max_jitter_us == 0);
+  CHECK(reset.total_jitter_us == 0);
+  CHECK(reset.missed_deadlines == 0);
+}
+
+void TestEventTask() {
+  using telemetry::USB_TASK;
+  telemetry::RegisterTask(USB_TASK, NULL, 0);
+
+  // Tasks without a period have no jitter or deadlines, however long and
+  // irregular their iterations are
+  telemetry::RecordIteration(USB_TASK, 1000, 1500);
+  telemetry::RecordIteration(USB_TASK, 90000, 150000);
+
+  const telemetry::TaskStats stats = telemetry::GetTaskStats(USB_TASK);
+  CHECK(stats.num_iterations == 2);
+  CHECK(stats.min_duration_us == 500);
+  CHECK(stats.max_duration_us == 60000);
+  CHECK(stats.max_jitter_us == 0);
+  CHECK(stats.total_jitter_us == 0);
+  CHECK(stats.missed_deadlines == 0);
+}
+
+}  // namespace
+
+int main() {
+  CHECK(telemetry::TelemetryInit() == OK);
+  TestPeriodicTask();
+  TestEventTask();
+
+  printf("telemetry iteration stats passed\n");
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Records more events than the ring holds and checks the dump of trace.h: the
+// header, the task names, the ring wrap and the single dump owner. Built with
+// CONFIG_DEBUG_TRACE, on the host clock.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "check.h"
+#include "task.h"
+#include "trace.h"
+#include "utils.h"
+
+static_assert(CONFIG_DEBUG_TRACE, "Needs CONFIG_DEBUG_TRACE");
+
+extern "C" void vApplicationMallocFailedHook(void) {
+  LOG_ERROR("Failed malloc. OOM");
+}
+
+namespace {
+
+constexpr uint32_t kRingSize = CONFIG_DEBUG_TRACE_BUFFER_SIZE;
+// Wraps the ring once and a bit
+constexpr uint32_t kNumEvents = kRingSize + kRingSize / 4 + 3;
+
+std::vector<uint8_t> ReadDump(size_t size) {
+  std::vector<uint8_t> dump;
+  const uint8_t* data;
+  size_t length;
+  while ((length = trace::GetDumpData(dump.size(), &data)) > 0) {
+    dump.insert(dump.end(), data, data + length);
+  }
+  CHECK(dump.size() == size);
+  return dump;
+}
+
+template <typename T>
+T Read(const std::vector<uint8_t>& dump, size_t* offset) {
+  T value;
+  CHECK(*offset + sizeof(T) <= dump.size());
+  memcpy(&value, dump.data() + *offset, sizeof(T));
+  *offset += sizeof(T);
+  return value;
+}
+
+void TestDump() {
+  trace::UpdateTaskNames();
+  for (uint32_t i = 0; i < kNumEvents; ++i) {
+    TRACE_EVENT(INPUT_TICK_BEGIN, i);
+  }
+
+  const size_t size = trace::PrepareDump(trace::CDC_READER);
+  CHECK(size > 0);
+  const std::vector<uint8_t> dump = ReadDump(size);
+
+  size_t offset = 0;
+  CHECK(Read<uint32_t>(dump, &offset) == trace::kDumpMagic);
+  CHECK(Read<uint8_t>(dump, &offset) == trace::kDumpVersion);
+  CHECK(Read<uint8_t>(dump, &offset) == configNUM_CORES);
+  const uint8_t num_tasks = Read<uint8_t>(dump, &offset);
+  const uint8_t name_size = Read<uint8_t>(dump, &offset);
+  CHECK(name_size == configMAX_TASK_NAME_LEN);
+  CHECK(Read<uint32_t>(dump, &offset) == kRingSize);
+  Read<uint32_t>(dump, &offset);  // Time of the dump
+
+  // The test task and the idle and timer tasks of FreeRTOS
+  CHECK(num_tasks >= 3);
+  bool has_test_task = false;
+  for (uint8_t i = 0; i < num_tasks; ++i) {
+    const uint32_t id = Read<uint32_t>(dump, &offset);
+    CHECK(offset + name_size <= dump.size());
+    const std::string name((const char*)dump.data() + offset,
+                           strnlen((const char*)dump.data() + offset,
+                                   name_size));
+    offset += name_size;
+    if (name == "trace_test") {
+      CHECK(id == trace::HandleId(xTaskGetCurrentTaskHandle()));
+      has_test_task = true;
+    }
+  }
+  CHECK(has_test_task);
+
+  // The host hooks no task switches, so the test's events are all there is
+  std::vector<uint32_t> num_written;
+  for (uint8_t core = 0; core < configNUM_CORES; ++core) {
+    num_written.push_back(Read<uint32_t>(dump, &offset));
+  }
+  CHECK(num_written[0] == kNumEvents);
+  CHECK(dump.size() - offset ==
+        configNUM_CORES * kRingSize * sizeof(trace::Record));
+
+  // The oldest record is at the number written modulo the ring size
+  const uint32_t oldest = kNumEvents % kRingSize;
+  for (uint32_t i = 0; i < kRingSize; ++i) {
+    size_t record_offset =
+        offset + ((oldest + i) % kRingSize) * sizeof(trace::Record);
+    const trace::Record record = Read<trace::Record>(dump, &record_offset);
+    CHECK((record.info & 0x7f) == trace::INPUT_TICK_BEGIN);
+    CHECK((record.info >> 7 & 1) == 0);
+    CHECK(record.info >> 8 == kNumEvents - kRingSize + i);
+  }
+}
+
+void TestOwner() {
+  // The CDC reader of TestDump() still owns the dump, and nothing is recorded
+  CHECK(trace::PrepareDump(trace::RAW_HID_READER) == 0);
+  TRACE_EVENT(INPUT_TICK_END, 0);
+  trace::FinishDump(trace::RAW_HID_READER);
+
+  // The owner can start over, and sees the recording stopped
+  const size_t size = trace::PrepareDump(trace::CDC_READER);
+  CHECK(size > 0);
+  const std::vector<uint8_t> dump = ReadDump(size);
+  uint32_t num_written;
+  memcpy(&num_written,
+         dump.data() + size -
+             configNUM_CORES * kRingSize * sizeof(trace::Record) -
+             configNUM_CORES * sizeof(uint32_t),
+         sizeof(num_written));
+  CHECK(num_written == kNumEvents);
+
+  trace::FinishDump(trace::CDC_READER);
+  CHECK(trace::PrepareDump(trace::RAW_HID_READER) > 0);
+  trace::FinishDump(trace::RAW_HID_READER);
+}
+
+void TestTask(void* parameter) {
+  (void)parameter;
+  TestDump();
+  TestOwner();
+
+  printf("trace dump of %u events passed\n", kNumEvents);
+  fflush(NULL);
+  // Skips the static destructors, the tasks are still running
+  _exit(0);
+}
+
+}  // namespace
+
+int main() {
+  if (xTaskCreate(&TestTask, "trace_test", configMINIMAL_STACK_SIZE * 4, NULL,
+                  tskIDLE_PRIORITY + 1, NULL) == pdPASS) {
+    vTaskStartScheduler();
+  }
+  return 1;
+}
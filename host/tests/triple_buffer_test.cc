@@ -0,0 +1,95 @@
+// Publishes a counter from one thread while another reads it. Every read must
+// see a whole value, never an older one than before, and `is_new` exactly
+// when the value changed. The first publishes wait for the reader to see
+// them, so that the reads overlap the publishes and every one of those values
+// must be observed. The rest run free, where the reader may skip values.
+
+#include "triple_buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "check.h"
+
+namespace {
+
+// Publishes that wait for the reader, then the free running ones
+constexpr uint64_t kNumPacedPublishes = 200000;
+constexpr uint64_t kNumPublishes = 2000000;
+
+// Large enough that a torn read shows up as fields that differ
+struct Value {
+  uint64_t fields[8];
+};
+
+TripleBuffer<Value> buffer;
+std::atomic<bool> done(false);
+// Latest paced value the reader saw. Blocking rather than spinning, so that
+// the handoff doesn't wait for a time slice on a single core.
+std::mutex ack_mutex;
+std::condition_variable ack_cv;
+uint64_t acked = 0;
+
+void Produce() {
+  for (uint64_t i = 1; i <= kNumPublishes; ++i) {
+    Value& value = buffer.WriteBuffer();
+    for (uint64_t& field : value.fields) {
+      field = i;
+    }
+    buffer.Publish();
+    CHECK(buffer.Published().fields[0] == i);
+    if (i <= kNumPacedPublishes) {
+      std::unique_lock<std::mutex> lock(ack_mutex);
+      ack_cv.wait(lock, [i] { return acked >= i; });
+    }
+  }
+  done = true;
+}
+
+}  // namespace
+
+int main() {
+  std::thread producer(&Produce);
+
+  uint64_t previous = 0;
+  uint64_t num_reads = 0;
+  uint64_t num_new = 0;
+  while (true) {
+    const bool finished = done.load();
+    bool is_new = false;
+    const Value& value = buffer.Read(&is_new);
+    const uint64_t current = value.fields[0];
+    for (uint64_t field : value.fields) {
+      CHECK(field == current);
+    }
+    CHECK(current >= previous);
+    CHECK(is_new == (current != previous));
+    previous = current;
+    ++num_reads;
+    num_new += is_new;
+    if (is_new && current <= kNumPacedPublishes) {
+      {
+        std::lock_guard<std::mutex> lock(ack_mutex);
+        acked = current;
+      }
+      ack_cv.notify_one();
+    }
+    if (finished) {
+      break;
+    }
+  }
+  producer.join();
+
+  // The producer was done before the last read
+  CHECK(previous == kNumPublishes);
+  printf("%llu reads, %llu new values\n", (unsigned long long)num_reads,
+         (unsigned long long)num_new);
+  // Each paced value was seen, plus at least the last one
+  CHECK(num_new >= kNumPacedPublishes + 1);
+  return 0;
+}
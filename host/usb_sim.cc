@@ -0,0 +1,267 @@
+// In-memory TinyUSB device stack. The host polls the HID endpoints at the
+// start of each 1 ms frame, like a full speed host with bInterval
+// CONFIG_USB_POLL_MS, and records what it received. The CDC interface prints
+// to stdout.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "config.h"
+#include "device/usbd_pvt.h"
+#include "hal_sim.h"
+#include "hardware/timer.h"
+#include "queue.h"
+#include "spsc_queue.h"
+#include "tusb.h"
+#include "usb.h"
+
+// The firmware only implements some of the callbacks. Weak whichever way the
+// TinyUSB version declares them, since usbd.c isn't built.
+extern "C" {
+__attribute__((weak)) void tud_hid_report_complete_cb(
+    uint8_t instance, uint8_t const* report, HIDReportCompleteLength len);
+__attribute__((weak)) void tud_mount_cb(void);
+__attribute__((weak)) void tud_umount_cb(void);
+__attribute__((weak)) void tud_sof_cb(uint32_t frame_count);
+__attribute__((weak)) void tud_cdc_line_state_cb(uint8_t itf, bool dtr,
+                                                 bool rts);
+}
+
+namespace {
+
+enum HostEventType { MOUNT, UNMOUNT, OUTPUT_REPORT };
+
+struct HostEvent {
+  HostEventType type;
+  uint8_t instance;
+  std::vector<uint8_t> data;
+};
+
+struct DeferredFunc {
+  osal_task_func_t func;
+  void* param;
+};
+
+// An IN report waiting for the host to poll the endpoint
+struct PendingReport {
+  // Set by the task that queued the report, cleared by the USB task once the
+  // host polled it
+  std::atomic<bool> busy{false};
+  hal_sim::HIDReport report;
+};
+
+}  // namespace
+
+static std::function<void(const hal_sim::HIDReport&)> report_observer;
+static SPSCQueue<HostEvent, 16> host_events;
+static QueueHandle_t defer_queue = NULL;
+
+static std::atomic<bool> mounted(false);
+static bool mounted_once = false;
+static bool sof_enabled = false;
+static uint32_t frame_count = 0;
+static uint64_t next_frame_us = 0;
+static std::array<PendingReport, CFG_TUD_HID> pending_reports;
+
+namespace hal_sim {
+
+void SetHIDReportObserver(std::function<void(const HIDReport&)> observer) {
+  report_observer = observer;
+}
+
+static void PushHostEvent(HostEventType type, uint8_t instance,
+                          const std::vector<uint8_t>& data) {
+  HostEvent* event = host_events.Back();
+  if (event == NULL) {
+    fprintf(stderr, "Host event dropped, the USB task isn't running\n");
+    return;
+  }
+  event->type = type;
+  event->instance = instance;
+  event->data = data;
+  host_events.Push();
+}
+
+void MountUSB() { PushHostEvent(MOUNT, 0, {}); }
+
+void UnmountUSB() { PushHostEvent(UNMOUNT, 0, {}); }
+
+void SendHostOutputReport(uint8_t instance, const std::vector<uint8_t>& data) {
+  PushHostEvent(OUTPUT_REPORT, instance, data);
+}
+
+}  // namespace hal_sim
+
+static void Mount() {
+  if (mounted) {
+    return;
+  }
+  mounted = true;
+  mounted_once = true;
+  if (tud_mount_cb != NULL) {
+    tud_mount_cb();
+  }
+  // A terminal is always open
+  if (tud_cdc_line_state_cb != NULL) {
+    tud_cdc_line_state_cb(0, /*dtr=*/true, /*rts=*/true);
+  }
+}
+
+static void Unmount() {
+  if (!mounted) {
+    return;
+  }
+  mounted = false;
+  for (auto& pending : pending_reports) {
+    pending.busy = false;
+  }
+  if (tud_umount_cb != NULL) {
+    tud_umount_cb();
+  }
+}
+
+static void HandleHostEvents() {
+  while (const HostEvent* event = host_events.Front()) {
+    switch (event->type) {
+      case MOUNT:
+        Mount();
+        break;
+      case UNMOUNT:
+        Unmount();
+        break;
+      case OUTPUT_REPORT:
+        if (mounted && event->instance < CFG_TUD_HID) {
+          tud_hid_set_report_cb(event->instance, /*report_id=*/0,
+                                HID_REPORT_TYPE_OUTPUT, event->data.data(),
+                                event->data.size());
+        }
+        break;
+    }
+    host_events.Pop();
+  }
+}
+
+static void StartOfFrame(uint64_t frame_us) {
+  ++frame_count;
+  HandleHostEvents();
+  if (!mounted_once) {
+    Mount();
+  }
+  if (!mounted) {
+    return;
+  }
+
+  if (frame_count % CONFIG_USB_POLL_MS == 0) {
+    for (uint8_t instance = 0; instance < CFG_TUD_HID; ++instance) {
+      PendingReport& pending = pending_reports[instance];
+      if (!pending.busy.load(std::memory_order_acquire)) {
+        continue;
+      }
+      pending.report.delivered_us = frame_us;
+      if (report_observer) {
+        report_observer(pending.report);
+      }
+      const std::vector<uint8_t> data = pending.report.data;
+      pending.busy.store(false, std::memory_order_release);
+      if (tud_hid_report_complete_cb != NULL) {
+        tud_hid_report_complete_cb(instance, data.data(), data.size());
+      }
+    }
+  }
+
+  if (sof_enabled && tud_sof_cb != NULL) {
+    tud_sof_cb(frame_count & 0x7ff);
+  }
+}
+
+bool tusb_init(void) {
+  defer_queue = xQueueCreate(16, sizeof(DeferredFunc));
+  next_frame_us = time_us_64() + 1000;
+  return defer_queue != NULL;
+}
+
+void tud_task_ext(uint32_t timeout_ms, bool in_isr) {
+  (void)timeout_ms;
+  (void)in_isr;
+  const uint64_t now_us = time_us_64();
+  if (now_us >= next_frame_us) {
+    // Frames missed while the task didn't run are skipped, like the host
+    // would see them without a poll
+    next_frame_us = now_us - (now_us - next_frame_us) % 1000 + 1000;
+    StartOfFrame(now_us);
+    return;
+  }
+  DeferredFunc deferred;
+  if (xQueueReceive(defer_queue, &deferred, pdMS_TO_TICKS(1)) == pdTRUE) {
+    deferred.func(deferred.param);
+  }
+}
+
+bool tud_mounted(void) { return mounted; }
+
+bool tud_suspended(void) { return false; }
+
+bool tud_remote_wakeup(void) { return false; }
+
+void tud_sof_cb_enable(bool en) { sof_enabled = en; }
+
+void usbd_defer_func(osal_task_func_t func, void* param, bool in_isr) {
+  const DeferredFunc deferred = {.func = func, .param = param};
+  if (in_isr) {
+    xQueueSendFromISR(defer_queue, &deferred, NULL);
+  } else {
+    xQueueSend(defer_queue, &deferred, portMAX_DELAY);
+  }
+}
+
+bool tud_hid_n_ready(uint8_t instance) {
+  return mounted && instance < CFG_TUD_HID &&
+         !pending_reports[instance].busy.load(std::memory_order_acquire);
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const* report,
+                      uint16_t len) {
+  if (!tud_hid_n_ready(instance) || len > CFG_TUD_HID_EP_BUFSIZE) {
+    return false;
+  }
+  hal_sim::HIDReport& pending = pending_reports[instance].report;
+  pending.queued_us = time_us_64();
+  pending.delivered_us = 0;
+  pending.instance = instance;
+  pending.data.clear();
+  if (report_id != 0) {
+    pending.data.push_back(report_id);
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(report);
+  pending.data.insert(pending.data.end(), bytes, bytes + len);
+  pending_reports[instance].busy.store(true, std::memory_order_release);
+  return true;
+}
+
+bool tud_cdc_n_connected(uint8_t itf) { return mounted; }
+
+uint32_t tud_cdc_n_write_available(uint8_t itf) { return 1024; }
+
+uint32_t tud_cdc_n_write(uint8_t itf, void const* buffer, uint32_t bufsize) {
+  return fwrite(buffer, 1, bufsize, stdout);
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf) {
+  fflush(stdout);
+  return 0;
+}
+
+// Nothing is ever received, stdin is for the simulation commands
+uint32_t tud_cdc_n_read(uint8_t itf, void* buffer, uint32_t bufsize) {
+  return 0;
+}
+
+bool tud_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code,
+                       uint8_t add_sense_qualifier) {
+  return true;
+}
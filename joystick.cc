@@ -7,6 +7,7 @@
 #include "config.h"
 #include "hardware/adc.h"
 #include "hardware/timer.h"
+#include "runner.h"
 #include "semphr.h"
 #include "utils.h"
 
@@ -98,7 +99,7 @@ JoystickInputDeivce::JoystickInputDeivce(uint8_t x_adc_pin, uint8_t y_adc_pin,
                                          size_t buffer_size, bool flip_x_dir,
                                          bool flip_y_dir,
                                          bool flip_vertical_scroll,
-                                         uint8_t scan_num_ticks,
+                                         uint32_t tick_period_us,
                                          uint8_t alt_layer)
     : x_(x_adc_pin, buffer_size, flip_x_dir),
       y_(y_adc_pin, buffer_size, flip_y_dir),
@@ -108,7 +109,7 @@ JoystickInputDeivce::JoystickInputDeivce(uint8_t x_adc_pin, uint8_t y_adc_pin,
       x_move_(0),
       y_move_(0),
       is_config_mode_(false),
-      scan_num_ticks_(scan_num_ticks),
+      tick_period_us_(tick_period_us),
       alt_layer_(alt_layer),
       is_pan_mode_(false),
       flip_vertical_scroll_(flip_vertical_scroll) {
@@ -136,43 +137,40 @@ void JoystickInputDeivce::InputTick() {
   LOG_DEBUG("x: %d, y: %d", x_speed, y_speed);
 
   if (is_pan_mode_) {
-    if (counter_ == 0) {
-      int8_t x = 0;
-      int8_t y = 0;
-      if (x_speed < 0) {
-        x = -1;
-      } else if (x_speed > 0) {
-        x = 1;
-      }
-      if (y_speed < 0) {
-        y = -1;
-      } else if (y_speed > 0) {
-        y = 1;
-      }
-      LOG_DEBUG("Pan: %d, %d", x, y);
-      for (auto mouse_output : *mouse_output_) {
-        mouse_output->Pan(x, y * (flip_vertical_scroll_ ? -1 : 1));
-      }
+    // Scroll speed in detents per second is the profile speed divided by
+    // pan_resolution_. Hosts with high resolution scrolling get the fractions
+    // of a detent, others a detent whenever a whole one added up.
+    const int64_t scale = (int64_t)tick_period_us_ * kMouseUnit;
+    const int64_t divider = (int64_t)1000000 * pan_resolution_;
+    const int32_t x = x_speed * scale / divider;
+    const int32_t y = y_speed * scale / divider;
+    LOG_DEBUG("Pan: %d, %d", x, y);
+    for (auto mouse_output : *mouse_output_) {
+      mouse_output->Pan(x, y * (flip_vertical_scroll_ ? -1 : 1));
     }
+    // Start a new movement period when switching back to mouse mode
+    counter_ = 0;
   } else {
     if (counter_ == 0) {
-      const int16_t tick_hz = configTICK_RATE_HZ;
-      x_move_ = x_speed * mouse_resolution_ * scan_num_ticks_ / tick_hz;
-      y_move_ = y_speed * mouse_resolution_ * scan_num_ticks_ / tick_hz;
+      const int64_t scale =
+          (int64_t)mouse_resolution_ * tick_period_us_ * kMouseUnit;
+      x_move_ = x_speed * scale / 1000000;
+      y_move_ = y_speed * scale / 1000000;
     }
 
-    const int8_t x_report_speed = x_move_ / (scan_num_ticks_ - counter_);
-    const int8_t y_report_speed = y_move_ / (scan_num_ticks_ - counter_);
+    // Spread the movement evenly over the rest of the period. The mouse
+    // outputs keep the fractions, so nothing is lost to rounding.
+    const int32_t x_report_speed = x_move_ / (mouse_resolution_ - counter_);
+    const int32_t y_report_speed = y_move_ / (mouse_resolution_ - counter_);
     x_move_ -= x_report_speed;
     y_move_ -= y_report_speed;
 
     for (auto mouse_output : *mouse_output_) {
       mouse_output->MouseMovement(x_report_speed, y_report_speed);
     }
-  }
 
-  counter_ =
-      (counter_ + 1) % (is_pan_mode_ ? pan_resolution_ : mouse_resolution_);
+    counter_ = (counter_ + 1) % mouse_resolution_;
+  }
 }
 
 std::pair<std::string, std::shared_ptr<Config>>
@@ -380,7 +378,7 @@ Status RegisterJoystick(uint8_t input_tag, uint8_t keyboard_tag,
   std::shared_ptr<JoystickInputDeivce> instance =
       std::make_shared<JoystickInputDeivce>(
           x_adc_pin, y_adc_pin, buffer_size, flip_x_dir, flip_y_dir,
-          flip_vertical_scroll, CONFIG_SCAN_TICKS, alt_layer);
+          flip_vertical_scroll, runner::kInputTickPeriodUs, alt_layer);
   if (DeviceRegistry::RegisterInputDevice(input_tag,
                                           [=]() { return instance; }) != OK ||
       DeviceRegistry::RegisterKeyboardOutputDevice(
@@ -48,7 +48,7 @@ class JoystickInputDeivce : virtual public GenericInputDevice,
  public:
   JoystickInputDeivce(uint8_t x_adc_pin, uint8_t y_adc_pin, size_t buffer_size,
                       bool flip_x_dir, bool flip_y_dir,
-                      bool flip_vertical_scroll, uint8_t scan_num_ticks,
+                      bool flip_vertical_scroll, uint32_t tick_period_us,
                       uint8_t alt_layer);
 
   void InputLoopStart() override;
@@ -62,8 +62,7 @@ class JoystickInputDeivce : virtual public GenericInputDevice,
   void StartOfInputTick() override {}
   void FinalizeInputTickOutput() override {}
 
-  void SendKeycode(uint8_t keycode) override {}
-  void SendKeycode(const std::vector<uint8_t>& keycode) override {}
+  void ProcessKeyEvents(const KeyEvent* events, size_t num) override {}
   void SendConsumerKeycode(uint16_t keycode) override {}
   void ChangeActiveLayers(const std::vector<bool>& layers) override;
 
@@ -81,11 +80,13 @@ class JoystickInputDeivce : virtual public GenericInputDevice,
   int16_t mouse_resolution_;
   int16_t pan_resolution_;
   uint8_t counter_;
-  int16_t x_move_;
-  int16_t y_move_;
+  // Movement left for the current mouse_resolution_ period, in 1/kMouseUnit
+  int32_t x_move_;
+  int32_t y_move_;
   bool enable_joystick_;
   bool is_config_mode_;
-  const int16_t scan_num_ticks_;
+  // Period of InputTick(), which the speeds per second are scaled by
+  const uint32_t tick_period_us_;
   const uint8_t alt_layer_;
   bool is_pan_mode_;
   bool flip_vertical_scroll_;
@@ -2,12 +2,14 @@
 
 #include <stdio.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <map>
 #include <vector>
 
 #include "FreeRTOS.h"
+#include "debounce.h"
 #include "hardware/gpio.h"
 #include "hardware/timer.h"
 #include "layout.h"
@@ -17,6 +19,10 @@
 #include "tusb.h"
 #include "utils.h"
 
+static uint32_t TicksToUs(uint32_t ticks) {
+  return ticks * (1000000 / configTICK_RATE_HZ);
+}
+
 void KeyScan::SetMouseButtonState(uint8_t mouse_key, bool is_pressed) {
   for (auto output : *mouse_output_) {
     if (is_pressed) {
@@ -31,65 +37,91 @@ void KeyScan::ConfigDown() { config_modifier_->Down(); }
 
 void KeyScan::ConfigSelect() { config_modifier_->Select(); }
 
-void KeyScan::InputLoopStart() { LayerChanged(); }
+void KeyScan::InputLoopStart() {
+  HandlerRegistry::FillHandlerTable(this, &custom_handlers_);
+  last_scan_us_ = time_us_64();
+  LayerChanged();
+}
 
 void KeyScan::InputTick() {
-  const std::vector<uint8_t> active_layers = GetActiveLayers();
-
-  // Set all sink GPIOs to HIGH
-  for (size_t sink = 0; sink < GetNumSinkGPIOs(); ++sink) {
-    gpio_put(GetSinkGPIO(sink), true);
-  }
-
-  std::vector<uint8_t> pressed_keycode;
+  const uint64_t timestamp_us = time_us_64();
+  // Debounce on the measured time rather than the nominal scan period, so that
+  // it doesn't depend on how the input task is scheduled.
+  const uint32_t elapsed_us =
+      std::min<uint64_t>(timestamp_us - last_scan_us_, UINT32_MAX / 2);
+  last_scan_us_ = timestamp_us;
+  size_t num_events = 0;
 
   for (size_t sink = 0; sink < GetNumSinkGPIOs(); ++sink) {
-    // Set one sink pin to LOW
-    gpio_put(GetSinkGPIO(sink), false);
-    SinkGPIODelay();
-
-    for (size_t source = 0; source < GetNumSourceGPIOs(); ++source) {
-      DebounceTimer& d_timer =
-          debounce_timer_[sink * GetNumSourceGPIOs() + source];
-
-      // gpio_get returns true when no button is pressed (because of pull up)
-      // and false when a button is pressed.
-      const bool pressed = !gpio_get(GetSourceGPIO(source));
-      if (pressed != d_timer.pressed) {
-        d_timer.tick_count += CONFIG_SCAN_TICKS;
-        if (d_timer.tick_count >= CONFIG_DEBOUNCE_TICKS) {
-          d_timer.pressed = !d_timer.pressed;
-          d_timer.tick_count = 0;
-        }
+    const uint32_t pressed_bits = ScanSink(sink);
+
+    uint32_t flipped_bits = debouncer_->Debounce(
+        sink, pressed_bits, debounced_bits_[sink], elapsed_us);
+    debounced_bits_[sink] ^= flipped_bits;
+
+    // Custom keys that were already held before this tick
+    uint32_t held_custom_bits =
+        debounced_bits_[sink] & custom_bits_[sink] & ~flipped_bits;
+
+    // Keys that changed state this tick. The keycode is resolved on press and
+    // kept until release, so that changing layers while a key is held doesn't
+    // leave the old keycode pressed.
+    while (flipped_bits != 0) {
+      const uint8_t pin = __builtin_ctz(flipped_bits);
+      flipped_bits &= flipped_bits - 1;
+
+      const size_t source = pin_to_source_[pin];
+      const size_t idx = sink * GetNumSourceGPIOs() + source;
+      const bool pressed = (debounced_bits_[sink] >> pin) & 1;
+      if (pressed) {
+        held_keycodes_[idx] = keymap_[idx];
       }
-
-      Keycode kc = {0};
-      for (uint8_t l : active_layers) {
-        Keycode layer_kc = GetKeycodeAtLayer(l, sink, source);
-        if (layer_kc.is_custom || layer_kc.keycode != HID_KEY_NONE) {
-          kc = layer_kc;
-          break;
-        }
+      const Keycode kc = held_keycodes_[idx];
+      if (pressed && kc.is_custom) {
+        custom_bits_[sink] |= (1u << pin);
+      } else {
+        custom_bits_[sink] &= ~(1u << pin);
       }
 
       if (kc.is_custom) {
-        auto* handler =
-            HandlerRegistry::RegisteredHandlerFactory(kc.keycode, this);
-        if (handler != NULL) {
-          handler->ProcessKeyState(kc, d_timer.pressed, sink, source);
-        } else {
-          LOG_WARNING("Custom Keycode (%d) missing handler", kc.keycode);
-        }
-      } else if (d_timer.pressed) {
-        pressed_keycode.push_back(kc.keycode);
+        ProcessCustomKeycode(kc, pressed, sink, source);
+        continue;
+      }
+      if (kc.keycode == HID_KEY_NONE) {
+        continue;
       }
+      events_[num_events++] = {.timestamp_us = timestamp_us,
+                               .keycode = kc.keycode,
+                               .sink_idx = (uint8_t)sink,
+                               .source_idx = (uint8_t)source,
+                               .pressed = pressed};
     }
 
-    // Set the sink back to high
-    gpio_put(GetSinkGPIO(sink), true);
+    // Custom keycode handlers are called on every tick while the key is held,
+    // e.g. mouse buttons have to be reported every tick.
+    while (held_custom_bits != 0) {
+      const uint8_t pin = __builtin_ctz(held_custom_bits);
+      held_custom_bits &= held_custom_bits - 1;
+
+      const size_t source = pin_to_source_[pin];
+      ProcessCustomKeycode(held_keycodes_[sink * GetNumSourceGPIOs() + source],
+                           true, sink, source);
+    }
   }
 
-  NotifyOutput(pressed_keycode);
+  if (num_events > 0) {
+    NotifyKeyEvents(events_.data(), num_events);
+  }
+}
+
+void KeyScan::ProcessCustomKeycode(Keycode kc, bool is_pressed, size_t sink,
+                                   size_t source) {
+  auto* handler = custom_handlers_[kc.keycode];
+  if (handler != NULL) {
+    handler->ProcessKeyState(kc, is_pressed, sink, source);
+  } else {
+    LOG_WARNING("Custom Keycode (%d) missing handler", kc.keycode);
+  }
 }
 
 void KeyScan::SetConfigMode(bool is_config_mode) {
@@ -101,11 +133,14 @@ status KeyScan::RegisterCustomKeycodeHandler(
   return HandlerRegistry::RegisterHandler(keycode, overridable, creator);
 }
 
-KeyScan::KeyScan() : is_config_mode_(false) {
+KeyScan::KeyScan() : last_scan_us_(0), is_config_mode_(false) {
+  custom_handlers_.fill(NULL);
+
   for (size_t i = 0; i < GetNumSinkGPIOs(); ++i) {
     const uint8_t pin = GetSinkGPIO(i);
     gpio_init(pin);
     gpio_set_dir(pin, true);
+    gpio_put(pin, true);
   }
   for (size_t i = 0; i < GetNumSourceGPIOs(); ++i) {
     const uint8_t pin = GetSourceGPIO(i);
@@ -116,10 +151,73 @@ KeyScan::KeyScan() : is_config_mode_(false) {
     gpio_pull_up(pin);
   }
 
-  debounce_timer_.resize(GetNumSinkGPIOs() * GetNumSourceGPIOs());
+  debounce_algorithm_ = (DebounceAlgorithm)CONFIG_DEBOUNCE_ALGORITHM;
+  debounce_ticks_ = CONFIG_DEBOUNCE_TICKS;
+  debouncer_ = CreateDebouncer(debounce_algorithm_, GetNumSinkGPIOs(),
+                               TicksToUs(debounce_ticks_));
+  debounced_bits_.resize(GetNumSinkGPIOs());
+  pin_to_source_.fill(0);
+  for (size_t i = 0; i < GetNumSourceGPIOs(); ++i) {
+    pin_to_source_[GetSourceGPIO(i)] = i;
+  }
 
   active_layers_.resize(GetKeyboardNumLayers());
   active_layers_[0] = true;
+
+  keymap_.resize(GetNumSinkGPIOs() * GetNumSourceGPIOs());
+  held_keycodes_.resize(GetNumSinkGPIOs() * GetNumSourceGPIOs());
+  custom_bits_.resize(GetNumSinkGPIOs());
+  events_.resize(GetNumSinkGPIOs() * GetNumSourceGPIOs());
+  UpdateKeymap();
+}
+
+std::pair<std::string, std::shared_ptr<Config>> KeyScan::CreateDefaultConfig() {
+  auto config = CONFIG_OBJECT(
+      CONFIG_OBJECT_ELEM("debounce_algorithm",
+                         CONFIG_INT(CONFIG_DEBOUNCE_ALGORITHM, 0,
+                                    NUM_DEBOUNCE_ALGORITHMS - 1)),
+      CONFIG_OBJECT_ELEM("debounce_ticks",
+                         CONFIG_INT(CONFIG_DEBOUNCE_TICKS, 0, 100)));
+  return {"keyscan", config};
+}
+
+void KeyScan::OnUpdateConfig(const Config* config) {
+  if (config->GetType() != Config::OBJECT) {
+    LOG_ERROR("Root config has to be an object.");
+    return;
+  }
+  const auto& root_map = *((ConfigObject*)config)->GetMembers();
+  auto it = root_map.find("debounce_algorithm");
+  if (it == root_map.end()) {
+    LOG_ERROR("Can't find `debounce_algorithm` in config");
+    return;
+  }
+  if (it->second->GetType() != Config::INTEGER) {
+    LOG_ERROR("`debounce_algorithm` invalid type");
+    return;
+  }
+  const auto algorithm =
+      (DebounceAlgorithm)((ConfigInt*)it->second.get())->GetValue();
+
+  it = root_map.find("debounce_ticks");
+  if (it == root_map.end()) {
+    LOG_ERROR("Can't find `debounce_ticks` in config");
+    return;
+  }
+  if (it->second->GetType() != Config::INTEGER) {
+    LOG_ERROR("`debounce_ticks` invalid type");
+    return;
+  }
+  const uint8_t debounce_ticks = ((ConfigInt*)it->second.get())->GetValue();
+
+  if (algorithm == debounce_algorithm_ && debounce_ticks == debounce_ticks_) {
+    return;
+  }
+  // Keys mid way through debouncing simply restart their window
+  debounce_algorithm_ = algorithm;
+  debounce_ticks_ = debounce_ticks;
+  debouncer_ = CreateDebouncer(algorithm, GetNumSinkGPIOs(),
+                               TicksToUs(debounce_ticks));
 }
 
 Status KeyScan::SetLayerStatus(uint8_t layer, bool active) {
@@ -151,6 +249,21 @@ std::vector<uint8_t> KeyScan::GetActiveLayers() {
   return output;
 }
 
+uint32_t KeyScan::ScanSink(size_t sink) {
+  // Set one sink pin to LOW
+  gpio_put(GetSinkGPIO(sink), false);
+  SinkGPIODelay();
+
+  // Sample all the source pins at once. gpio_get_all returns 1 when no button
+  // is pressed (because of pull up) and 0 when a button is pressed.
+  const uint32_t pressed_bits = ~gpio_get_all() & GetSourceGPIOMask();
+
+  // Set the sink back to high
+  gpio_put(GetSinkGPIO(sink), true);
+
+  return pressed_bits;
+}
+
 void KeyScan::SinkGPIODelay() { busy_wait_us_32(CONFIG_GPIO_SINK_DELAY_US); }
 
 KeyScan::HandlerRegistry* KeyScan::HandlerRegistry::GetRegistry() {
@@ -173,31 +286,42 @@ status KeyScan::HandlerRegistry::RegisterHandler(
   return OK;
 }
 
-CustomKeycodeHandler* KeyScan::HandlerRegistry::RegisteredHandlerFactory(
-    uint8_t keycode, KeyScan* outer) {
+void KeyScan::HandlerRegistry::FillHandlerTable(
+    KeyScan* outer, std::array<CustomKeycodeHandler*, 256>* table) {
   HandlerRegistry* instance = GetRegistry();
-  auto it = instance->handler_singletons_.find(keycode);
-  if (it != instance->handler_singletons_.end()) {
-    return it->second;
-  } else {
-    auto creator_it = instance->custom_handlers_.find(keycode);
-    if (creator_it == instance->custom_handlers_.end()) {
-      return NULL;
+  for (const auto& [keycode, creator] : instance->custom_handlers_) {
+    auto it = instance->handler_singletons_.find(keycode);
+    if (it == instance->handler_singletons_.end()) {
+      auto* handler = creator.second();
+      handler->SetOuterClass(outer);
+      it = instance->handler_singletons_.insert({keycode, handler}).first;
     }
-    auto* handler = creator_it->second.second();
-    handler->SetOuterClass(outer);
-    instance->handler_singletons_[keycode] = handler;
-    return handler;
+    (*table)[keycode] = it->second;
   }
 }
 
-void KeyScan::NotifyOutput(const std::vector<uint8_t>& pressed_keycode) {
-  for (auto output : *keyboard_output_) {
-    output->SendKeycode(pressed_keycode);
+void KeyScan::UpdateKeymap() {
+  for (size_t sink = 0; sink < GetNumSinkGPIOs(); ++sink) {
+    for (size_t source = 0; source < GetNumSourceGPIOs(); ++source) {
+      // The topmost active layer with a non transparent keycode wins
+      Keycode kc = {0};
+      for (int16_t l = active_layers_.size() - 1; l >= 0; --l) {
+        if (!active_layers_[l]) {
+          continue;
+        }
+        Keycode layer_kc = GetKeycodeAtLayer(l, sink, source);
+        if (layer_kc.is_custom || layer_kc.keycode != HID_KEY_NONE) {
+          kc = layer_kc;
+          break;
+        }
+      }
+      keymap_[sink * GetNumSourceGPIOs() + source] = kc;
+    }
   }
 }
 
 void KeyScan::LayerChanged() {
+  UpdateKeymap();
   for (auto output : *keyboard_output_) {
     output->ChangeActiveLayers(active_layers_);
   }
@@ -1,6 +1,7 @@
 #ifndef KEYSCAN_H_
 #define KEYSCAN_H_
 
+#include <array>
 #include <functional>
 #include <map>
 #include <memory>
@@ -10,6 +11,7 @@
 
 #include "FreeRTOS.h"
 #include "base.h"
+#include "debounce.h"
 #include "layout.h"
 #include "semphr.h"
 #include "utils.h"
@@ -42,6 +44,9 @@ class KeyScan : public GenericInputDevice {
   void InputLoopStart() override;
   void InputTick() override;
   void SetConfigMode(bool is_config_mode) override;
+  void OnUpdateConfig(const Config* config) override;
+  std::pair<std::string, std::shared_ptr<Config>> CreateDefaultConfig()
+      override;
 
   static status RegisterCustomKeycodeHandler(
       uint8_t keycode, bool overridable, CustomKeycodeHandlerCreator creator);
@@ -56,19 +61,14 @@ class KeyScan : public GenericInputDevice {
   void ConfigSelect();
 
  protected:
-  struct DebounceTimer {
-    uint8_t tick_count : 7;
-    uint8_t pressed : 1;
-
-    DebounceTimer() : tick_count(0), pressed(0) {}
-  };
-
   class HandlerRegistry {
    public:
     static status RegisterHandler(uint8_t keycode, bool overridable,
                                   CustomKeycodeHandlerCreator creator);
-    static CustomKeycodeHandler* RegisteredHandlerFactory(uint8_t keycode,
-                                                          KeyScan* outer);
+    // Creates the handlers that haven't been created yet and puts all of them
+    // in the table indexed by custom keycode.
+    static void FillHandlerTable(
+        KeyScan* outer, std::array<CustomKeycodeHandler*, 256>* table);
 
    private:
     static HandlerRegistry* GetRegistry();
@@ -78,13 +78,40 @@ class KeyScan : public GenericInputDevice {
     std::map<uint8_t, CustomKeycodeHandler*> handler_singletons_;
   };
 
+  // Returns the pressed state of all the source pins when the sink is pulled
+  // low. Bit i is set if the switch on source GPIO i is pressed.
+  virtual uint32_t ScanSink(size_t sink);
   virtual void SinkGPIODelay();
 
-  virtual void NotifyOutput(const std::vector<uint8_t>& pressed_keycode);
+  // Resolves the keycode of every switch against the active layers
+  void UpdateKeymap();
+
+  void ProcessCustomKeycode(Keycode kc, bool is_pressed, size_t sink,
+                            size_t source);
+
   virtual void LayerChanged();
 
-  std::vector<DebounceTimer> debounce_timer_;
+  std::unique_ptr<Debouncer> debouncer_;
+  DebounceAlgorithm debounce_algorithm_;
+  uint8_t debounce_ticks_;
+  uint64_t last_scan_us_;
+  // Debounced pressed state of each sink, indexed by source GPIO pin number
+  std::vector<uint32_t> debounced_bits_;
+  std::array<uint8_t, 32> pin_to_source_;
   std::vector<bool> active_layers_;
+  // Effective keycode of each (sink, source) under the active layers. Only
+  // rebuilt when the active layers change.
+  std::vector<Keycode> keymap_;
+  // Keycode each switch resolved to when it was pressed
+  std::vector<Keycode> held_keycodes_;
+  // Pins of each sink that are held and have a custom keycode
+  std::vector<uint32_t> custom_bits_;
+  // At most one event per switch per tick. Sized in the constructor so that
+  // the input tick doesn't allocate.
+  std::vector<KeyEvent> events_;
+  // Custom keycode handlers indexed by keycode. Filled in InputLoopStart so
+  // that no handler gets created in the middle of a scan.
+  std::array<CustomKeycodeHandler*, 256> custom_handlers_;
   // SemaphoreHandle_t semaphore_;
   bool is_config_mode_;
 };
@@ -22,6 +22,8 @@ size_t GetNumSourceGPIOs();
 
 uint8_t GetSinkGPIO(size_t idx);
 uint8_t GetSourceGPIO(size_t idx);
+// Bit i is set if GPIO i is a source pin
+uint32_t GetSourceGPIOMask();
 Keycode GetKeycodeAtLayer(uint8_t layer, size_t sink_gpio_idx,
                           size_t source_gpio_idx);
 
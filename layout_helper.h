@@ -9,6 +9,8 @@
 #include "joystick.h"
 #include "keyscan.h"
 #include "layout.h"
+#include "pio_keyscan.h"
+#include "raw_hid.h"
 #include "rotary_encoder.h"
 #include "ssd1306.h"
 #include "temperature.h"
@@ -0,0 +1,96 @@
+#include "pio_keyscan.h"
+
+#include <algorithm>
+
+#include "config.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "keyscan.pio.h"
+#include "layout.h"
+#include "utils.h"
+
+static uint8_t GetSinkBase() {
+  uint8_t base = GetSinkGPIO(0);
+  for (size_t i = 1; i < GetNumSinkGPIOs(); ++i) {
+    base = std::min(base, GetSinkGPIO(i));
+  }
+  return base;
+}
+
+// Smallest power of two that is no less than the number of sinks
+static uint8_t GetNumSlots() {
+  uint8_t slots = 1;
+  while (slots < GetNumSinkGPIOs()) {
+    slots <<= 1;
+  }
+  return slots;
+}
+
+PioKeyScan::PioKeyScan(PIO pio)
+    : KeyScan(),
+      pio_(pio),
+      sm_(pio_claim_unused_sm(pio, /*required=*/true)),
+      sink_base_(GetSinkBase()) {
+  const uint8_t num_slots = GetNumSlots();
+
+  // Idle state is all keys released, in case a slot is read before the first
+  // scan finishes.
+  for (size_t i = 0; i < kMaxSlots; ++i) {
+    samples_[i] = 0xffffffff;
+  }
+
+  // Start the DMA before the state machine so that slot 0 of the ring lines
+  // up with the first sample.
+  dma_channel_ = dma_claim_unused_channel(/*required=*/true);
+  dma_channel_config c = dma_channel_get_default_config(dma_channel_);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, false);
+  channel_config_set_write_increment(&c, true);
+  channel_config_set_ring(&c, /*write=*/true,
+                          __builtin_ctz(num_slots * sizeof(uint32_t)));
+  channel_config_set_dreq(&c, pio_get_dreq(pio_, sm_, /*is_tx=*/false));
+  dma_channel_configure(dma_channel_, &c, samples_, &pio_->rxf[sm_],
+                        /*transfer_count=*/0xffffffff, /*trigger=*/true);
+
+  const uint32_t offset = pio_add_program(pio_, &keyscan_program);
+  keyscan_program_init(pio_, sm_, offset, sink_base_, GetNumSinkGPIOs(),
+                       num_slots, CONFIG_GPIO_SINK_DELAY_US);
+}
+
+void PioKeyScan::InputTick() {
+  // The transfer count runs out after a bit more than an hour of scanning.
+  // The write address keeps wrapping in the ring so restarting the channel
+  // keeps the slots aligned.
+  if (!dma_channel_is_busy(dma_channel_)) {
+    dma_channel_set_trans_count(dma_channel_, 0xffffffff, /*trigger=*/true);
+  }
+  KeyScan::InputTick();
+}
+
+uint32_t PioKeyScan::ScanSink(size_t sink) {
+  // Source pins read 0 when the button is pressed because of pull up.
+  return ~samples_[GetSinkGPIO(sink) - sink_base_] & GetSourceGPIOMask();
+}
+
+bool PioKeyScan::IsLayoutSupported() {
+  if (GetNumSinkGPIOs() == 0 || GetNumSinkGPIOs() > kMaxSlots) {
+    return false;
+  }
+  // Sink pins are unique so they are consecutive if they span exactly the
+  // number of sink pins.
+  uint8_t max_pin = GetSinkGPIO(0);
+  for (size_t i = 1; i < GetNumSinkGPIOs(); ++i) {
+    max_pin = std::max(max_pin, GetSinkGPIO(i));
+  }
+  return (size_t)(max_pin - GetSinkBase() + 1) == GetNumSinkGPIOs();
+}
+
+Status RegisterPioKeyscan(uint8_t tag, PIO pio) {
+  if (!PioKeyScan::IsLayoutSupported()) {
+    LOG_ERROR("Sink GPIOs have to be consecutive for PIO key scan");
+    return ERROR;
+  }
+  return DeviceRegistry::RegisterInputDevice(tag, [=]() {
+    return std::shared_ptr<PioKeyScan>(new PioKeyScan(pio));
+  });
+}
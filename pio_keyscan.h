@@ -0,0 +1,44 @@
+#ifndef PIO_KEYSCAN_H_
+#define PIO_KEYSCAN_H_
+
+#include <stdint.h>
+
+#include "hardware/pio.h"
+#include "keyscan.h"
+#include "utils.h"
+
+// Key scanner that offloads driving the sink pins and sampling the source
+// pins to a PIO state machine. The state machine scans the matrix
+// continuously, and a DMA channel copies the samples into a ring buffer with
+// one slot per sink. The input task only needs to debounce and map keys.
+//
+// All the sink pins have to be consecutive GPIOs, in any order. Claims an
+// unused state machine of `pio`, and panics if there is none.
+class PioKeyScan : public KeyScan {
+ public:
+  explicit PioKeyScan(PIO pio);
+
+  void InputTick() override;
+
+  // Checks whether the sink pins of the current layout can be driven by PIO.
+  static bool IsLayoutSupported();
+
+ protected:
+  static constexpr size_t kMaxSlots = 32;
+
+  uint32_t ScanSink(size_t sink) override;
+  void SinkGPIODelay() override {}
+
+  const PIO pio_;
+  const uint8_t sm_;
+  uint8_t sink_base_;
+  uint8_t dma_channel_;
+
+  // The DMA write ring has to be aligned to its size
+  alignas(kMaxSlots * sizeof(uint32_t)) volatile uint32_t samples_[kMaxSlots];
+};
+
+// pio1 by default, as WS2812 uses state machine 0 of pio0 without claiming it
+Status RegisterPioKeyscan(uint8_t tag, PIO pio = pio1);
+
+#endif /* PIO_KEYSCAN_H_ */
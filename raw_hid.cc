@@ -0,0 +1,315 @@
+#include "raw_hid.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "config.h"
+#include "runner.h"
+
+RawHIDConfigDevice::RawHIDConfigDevice()
+    : USBOutputAddIn(ITF_RAW_HID),
+      requests_dropped_(0),
+      keyboard_(USBKeyboardOutput::GetUSBKeyboardOutput()),
+      response_offset_(0),
+      response_pending_(false),
+      response_header_{0} {
+#if CONFIG_DEBUG_TRACE
+  trace_dump_size_ = 0;
+#endif /* CONFIG_DEBUG_TRACE */
+  // Enough for the whole config tree, so handling requests rarely allocates
+  response_.reserve(2048);
+}
+
+void RawHIDConfigDevice::SetReport(hid_report_type_t report_type,
+                                   const uint8_t* buffer, uint16_t bufsize) {
+  // Reports from the OUT endpoint come without a report type
+  if (report_type != HID_REPORT_TYPE_INVALID &&
+      report_type != HID_REPORT_TYPE_OUTPUT) {
+    return;
+  }
+  Packet* request = requests_.Back();
+  if (request == NULL) {
+    requests_dropped_ = requests_dropped_ + 1;
+    return;
+  }
+  request->fill(0);
+  memcpy(request->data(), buffer, std::min<size_t>(bufsize, request->size()));
+  requests_.Push();
+}
+
+void RawHIDConfigDevice::InputTick() {
+  if (!response_pending_) {
+    const Packet* request = requests_.Front();
+    if (request == NULL) {
+      return;
+    }
+    response_.clear();
+    response_offset_ = 0;
+    response_header_[0] = (*request)[0];
+    response_header_[1] = (*request)[1];
+    response_header_[2] = HandleRequest(*request);
+    response_pending_ = true;
+    requests_.Pop();
+  }
+  SendResponse();
+}
+
+RawHIDStatus RawHIDConfigDevice::HandleRequest(const Packet& request) {
+  const uint8_t* payload = request.data() + 2;
+  const size_t size = request.size() - 2;
+  switch (request[0]) {
+    case RAW_HID_GET_VERSION:
+      Append(kRawHIDProtocolVersion);
+      return RAW_HID_OK;
+    case RAW_HID_GET_CONFIG:
+      return GetConfig(payload, size);
+    case RAW_HID_SET_CONFIG:
+      return SetConfig(payload, size);
+    case RAW_HID_SAVE_CONFIG:
+      DeviceRegistry::SaveConfig();
+      return RAW_HID_OK;
+    case RAW_HID_GET_TELEMETRY:
+      return GetTelemetry();
+#if CONFIG_DEBUG_TRACE
+    case RAW_HID_GET_TRACE:
+      return GetTrace(payload, size);
+#endif /* CONFIG_DEBUG_TRACE */
+    default:
+      LOG_WARNING("Unknown raw HID command %d", request[0]);
+      return RAW_HID_UNKNOWN_COMMAND;
+  }
+}
+
+RawHIDStatus RawHIDConfigDevice::GetConfig(const uint8_t* payload,
+                                           size_t size) {
+  size_t path_size;
+  const Config* config = FindConfig(payload, size, &path_size);
+  if (config == NULL) {
+    return RAW_HID_INVALID_PATH;
+  }
+  EncodeConfig(config);
+  return RAW_HID_OK;
+}
+
+RawHIDStatus RawHIDConfigDevice::SetConfig(const uint8_t* payload,
+                                           size_t size) {
+  size_t path_size;
+  Config* config = FindConfig(payload, size, &path_size);
+  if (config == NULL) {
+    return RAW_HID_INVALID_PATH;
+  }
+  if (size - path_size < 1 + sizeof(int32_t) ||
+      payload[path_size] != config->GetType()) {
+    return RAW_HID_INVALID_VALUE;
+  }
+  const uint8_t* value = payload + path_size + 1;
+
+  switch (config->GetType()) {
+    case Config::INTEGER: {
+      ConfigInt* config_int = (ConfigInt*)config;
+      int32_t v;
+      memcpy(&v, value, sizeof(v));
+      const auto [min, max] = config_int->GetMinMax();
+      if (v < min || v > max) {
+        return RAW_HID_INVALID_VALUE;
+      }
+      config_int->SetValue(v);
+      break;
+    }
+    case Config::FLOAT: {
+      ConfigFloat* config_float = (ConfigFloat*)config;
+      float v;
+      memcpy(&v, value, sizeof(v));
+      const auto [min, max] = config_float->GetMinMax();
+      // Also rejects NaN
+      if (!(v >= min && v <= max)) {
+        return RAW_HID_INVALID_VALUE;
+      }
+      config_float->SetValue(v);
+      break;
+    }
+    default:
+      return RAW_HID_INVALID_VALUE;
+  }
+
+  runner::NotifyConfigChange();
+  return RAW_HID_OK;
+}
+
+RawHIDStatus RawHIDConfigDevice::GetTelemetry() {
+  const runner::ScanJitterStats jitter = runner::GetScanJitterStats();
+  const USBKeyboardOutput::ReportQueueStats queue =
+      keyboard_->GetReportQueueStats();
+  RawHIDTelemetry telemetry = {
+      .num_ticks = jitter.num_ticks,
+      .min_interval_us = jitter.min_interval_us,
+      .max_interval_us = jitter.max_interval_us,
+      .max_jitter_us = jitter.max_jitter_us,
+      .total_jitter_us = jitter.total_jitter_us,
+      .missed_ticks = jitter.missed_ticks,
+      .reports_queued = queue.queued,
+      .reports_coalesced = queue.coalesced,
+      .reports_overflowed = queue.overflowed,
+#if CONFIG_DEBUG_IDLE_MONITOR
+      .tick_core_idle_permille = runner::GetTickCoreIdlePermille(),
+#else
+      .tick_core_idle_permille = UINT32_MAX,
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
+      .requests_dropped = requests_dropped_,
+  };
+  Append(telemetry);
+  return RAW_HID_OK;
+}
+
+#if CONFIG_DEBUG_TRACE
+RawHIDStatus RawHIDConfigDevice::GetTrace(const uint8_t* payload,
+                                          size_t size) {
+  uint32_t offset;
+  if (size < sizeof(offset)) {
+    return RAW_HID_INVALID_VALUE;
+  }
+  memcpy(&offset, payload, sizeof(offset));
+  if (offset == 0) {
+    // Also starts over if the previous read was given up
+    trace_dump_size_ = trace::PrepareDump(trace::RAW_HID_READER);
+    if (trace_dump_size_ == 0) {
+      return RAW_HID_BUSY;
+    }
+  } else if (trace_dump_size_ == 0 || offset > trace_dump_size_) {
+    return RAW_HID_INVALID_VALUE;
+  }
+  Append((uint32_t)trace_dump_size_);
+  const size_t end =
+      std::min(trace_dump_size_, offset + kRawHIDTraceChunkSize);
+  while (offset < end) {
+    const uint8_t* data;
+    const size_t length =
+        std::min(trace::GetDumpData(offset, &data), end - offset);
+    response_.insert(response_.end(), data, data + length);
+    offset += length;
+  }
+  if (end == trace_dump_size_) {
+    trace::FinishDump(trace::RAW_HID_READER);
+    trace_dump_size_ = 0;
+  }
+  return RAW_HID_OK;
+}
+#endif /* CONFIG_DEBUG_TRACE */
+
+Config* RawHIDConfigDevice::FindConfig(const uint8_t* payload, size_t size,
+                                       size_t* path_size) {
+  const char* path = (const char*)payload;
+  const char* path_end = (const char*)memchr(payload, '\0', size);
+  if (path_end == NULL) {
+    return NULL;
+  }
+  *path_size = path_end - path + 1;
+
+  Config* config = DeviceRegistry::GetGlobalConfig();
+  while (path < path_end) {
+    const char* separator = (const char*)memchr(path, '/', path_end - path);
+    if (separator == NULL) {
+      separator = path_end;
+    }
+    const std::string name(path, separator - path);
+    path = separator + 1;
+
+    if (config->GetType() == Config::OBJECT) {
+      auto& members = *((ConfigObject*)config)->GetMembers();
+      auto it = members.find(name);
+      if (it == members.end()) {
+        return NULL;
+      }
+      config = it->second.get();
+    } else if (config->GetType() == Config::LIST) {
+      auto& list = *((ConfigList*)config)->GetList();
+      char* index_end;
+      const unsigned long index = strtoul(name.c_str(), &index_end, 10);
+      if (name.empty() || *index_end != '\0' || index >= list.size()) {
+        return NULL;
+      }
+      config = list[index].get();
+    } else {
+      return NULL;
+    }
+  }
+  return config;
+}
+
+void RawHIDConfigDevice::EncodeConfig(const Config* config) {
+  Append<uint8_t>(config->GetType());
+  switch (config->GetType()) {
+    case Config::OBJECT: {
+      const auto& members = *((const ConfigObject*)config)->GetMembers();
+      Append<uint16_t>(members.size());
+      for (const auto& [name, member] : members) {
+        const uint8_t length = std::min<size_t>(name.size(), UINT8_MAX);
+        Append(length);
+        response_.insert(response_.end(), name.begin(),
+                         name.begin() + length);
+        EncodeConfig(member.get());
+      }
+      break;
+    }
+    case Config::LIST: {
+      const auto& list = *((const ConfigList*)config)->GetList();
+      Append<uint16_t>(list.size());
+      for (const auto& element : list) {
+        EncodeConfig(element.get());
+      }
+      break;
+    }
+    case Config::INTEGER: {
+      const ConfigInt* config_int = (const ConfigInt*)config;
+      const auto [min, max] = config_int->GetMinMax();
+      Append(config_int->GetValue());
+      Append(min);
+      Append(max);
+      break;
+    }
+    case Config::FLOAT: {
+      const ConfigFloat* config_float = (const ConfigFloat*)config;
+      const auto [min, max] = config_float->GetMinMax();
+      Append(config_float->GetValue());
+      Append(min);
+      Append(max);
+      Append(config_float->GetResolution());
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void RawHIDConfigDevice::SendResponse() {
+  if (!tud_hid_n_ready(ITF_RAW_HID)) {
+    return;
+  }
+  Packet packet = {0};
+  memcpy(packet.data(), response_header_, sizeof(response_header_));
+  const size_t remaining = response_.size() - response_offset_;
+  const size_t length =
+      std::min(remaining, packet.size() - kRawHIDResponseHeaderSize);
+  packet[3] = length | (remaining > length ? kRawHIDMoreFlag : 0);
+  memcpy(packet.data() + kRawHIDResponseHeaderSize,
+         response_.data() + response_offset_, length);
+  if (!tud_hid_n_report(ITF_RAW_HID, /*report_id=*/0, packet.data(),
+                        packet.size())) {
+    return;
+  }
+  response_offset_ += length;
+  response_pending_ = response_offset_ < response_.size();
+}
+
+Status RegisterRawHIDConfig(uint8_t tag) {
+  return DeviceRegistry::RegisterInputDevice(tag, []() {
+    // Only one instance can receive the reports of the interface
+    static std::shared_ptr<RawHIDConfigDevice> instance =
+        std::make_shared<RawHIDConfigDevice>();
+    return instance;
+  });
+}
@@ -0,0 +1,154 @@
+#ifndef RAW_HID_H_
+#define RAW_HID_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "configuration.h"
+#include "spsc_queue.h"
+#include "trace.h"
+#include "tusb.h"
+#include "usb.h"
+#include "utils.h"
+
+// Binary protocol to read and change the config over the vendor defined raw
+// HID interface. Every packet is kRawHIDPacketSize bytes, multi-byte values
+// are little endian.
+//
+//   Request:  | command | sequence | payload ...
+//   Response: | command | sequence | status | length | payload ...
+//
+// `sequence` is copied from the request. A response payload that doesn't fit
+// in one packet is split, with kRawHIDMoreFlag set in `length` of all but the
+// last packet.
+//
+// Paths are NUL terminated, with `/` between object member names and list
+// indices, e.g. "joystick/x_profile/1/0". The empty path is the root.
+//
+// Config nodes are encoded as a Config::Type byte followed by:
+//   OBJECT:  u16 count, then count times (u8 name length, name, node)
+//   LIST:    u16 count, then count nodes
+//   INTEGER: i32 value, i32 min, i32 max
+//   FLOAT:   f32 value, f32 min, f32 max, f32 resolution
+//
+// tools/raw_hid_client.py is the reference host client.
+
+constexpr size_t kRawHIDPacketSize = CFG_TUD_HID_EP_BUFSIZE;
+constexpr size_t kRawHIDResponseHeaderSize = 4;
+constexpr uint8_t kRawHIDMoreFlag = 0x80;
+constexpr uint8_t kRawHIDProtocolVersion = 1;
+constexpr size_t kRawHIDTraceChunkSize = 1024;
+
+enum RawHIDCommand : uint8_t {
+  // Response: u8 protocol version
+  RAW_HID_GET_VERSION = 0x01,
+  // Payload: path. Response: the encoded node.
+  RAW_HID_GET_CONFIG = 0x02,
+  // Payload: path, u8 Config::Type, then i32 or f32 value. Only INTEGER and
+  // FLOAT nodes can be set. The devices see the change on the next tick.
+  RAW_HID_SET_CONFIG = 0x03,
+  // Writes the config to flash
+  RAW_HID_SAVE_CONFIG = 0x04,
+  // Response: RawHIDTelemetry
+  RAW_HID_GET_TELEMETRY = 0x05,
+  // Payload: u32 offset. Response: u32 size of the trace dump, then up to
+  // kRawHIDTraceChunkSize bytes of it from the offset. Offset 0 stops the
+  // recording and the last chunk restarts it, see trace.h. RAW_HID_BUSY while
+  // the debug CDC port reads a dump. Only if CONFIG_DEBUG_TRACE is enabled.
+  RAW_HID_GET_TRACE = 0x06,
+};
+
+enum RawHIDStatus : uint8_t {
+  RAW_HID_OK = 0,
+  RAW_HID_UNKNOWN_COMMAND,
+  RAW_HID_INVALID_PATH,
+  RAW_HID_INVALID_VALUE,
+  // The trace dump is being read over the debug CDC port
+  RAW_HID_BUSY,
+};
+
+struct __attribute__((packed)) RawHIDTelemetry {
+  // runner::ScanJitterStats
+  uint32_t num_ticks;
+  uint32_t min_interval_us;
+  uint32_t max_interval_us;
+  uint32_t max_jitter_us;
+  uint64_t total_jitter_us;
+  uint32_t missed_ticks;
+  // USBKeyboardOutput::ReportQueueStats
+  uint32_t reports_queued;
+  uint32_t reports_coalesced;
+  uint32_t reports_overflowed;
+  // UINT32_MAX if CONFIG_DEBUG_IDLE_MONITOR is disabled
+  uint32_t tick_core_idle_permille;
+  // Requests dropped because too many were waiting
+  uint32_t requests_dropped;
+};
+
+class RawHIDConfigDevice : virtual public GenericInputDevice,
+                           public USBOutputAddIn {
+ public:
+  RawHIDConfigDevice();
+
+  void InputLoopStart() override {}
+  // Handles at most one request, and sends the response one packet per tick
+  void InputTick() override;
+
+  // Receives the requests from the USB task
+  void SetReport(hid_report_type_t report_type, const uint8_t* buffer,
+                 uint16_t bufsize) override;
+
+ protected:
+  using Packet = std::array<uint8_t, kRawHIDPacketSize>;
+
+  // Fills response_ and returns the status
+  RawHIDStatus HandleRequest(const Packet& request);
+  RawHIDStatus GetConfig(const uint8_t* payload, size_t size);
+  RawHIDStatus SetConfig(const uint8_t* payload, size_t size);
+  RawHIDStatus GetTelemetry();
+#if CONFIG_DEBUG_TRACE
+  RawHIDStatus GetTrace(const uint8_t* payload, size_t size);
+#endif /* CONFIG_DEBUG_TRACE */
+
+  // Reads the NUL terminated path at the start of `payload` and finds the
+  // node. `path_size` is set to the size of the path including the NUL.
+  Config* FindConfig(const uint8_t* payload, size_t size, size_t* path_size);
+  void EncodeConfig(const Config* config);
+
+  template <typename T>
+  void Append(T value) {
+    const uint8_t* bytes = (const uint8_t*)&value;
+    response_.insert(response_.end(), bytes, bytes + sizeof(T));
+  }
+
+  // Sends the next packet of the response if the endpoint is ready
+  void SendResponse();
+
+  // Written by the USB task, read by the input task
+  SPSCQueue<Packet, 4> requests_;
+  std::atomic<uint32_t> requests_dropped_;
+
+#if CONFIG_DEBUG_TRACE
+  // Set by RAW_HID_GET_TRACE at offset 0, 0 when no dump is being read
+  size_t trace_dump_size_;
+#endif /* CONFIG_DEBUG_TRACE */
+
+  // Fetched before the USB task starts, see usb_outputs in usb.cc
+  std::shared_ptr<USBKeyboardOutput> keyboard_;
+
+  // Only accessed by the input task
+  std::vector<uint8_t> response_;
+  size_t response_offset_;
+  bool response_pending_;
+  uint8_t response_header_[3];
+};
+
+Status RegisterRawHIDConfig(uint8_t tag);
+
+#endif /* RAW_HID_H_ */
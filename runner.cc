@@ -1,5 +1,7 @@
 #include "runner.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -11,7 +13,9 @@
 #include "hardware/watchdog.h"
 #include "semphr.h"
 #include "task.h"
+#include "telemetry.h"
 #include "timers.h"
+#include "trace.h"
 #include "usb.h"
 #include "utils.h"
 
@@ -25,10 +29,39 @@ static TaskHandle_t output_task_handle = NULL;
 static TimerHandle_t output_timer_handle = NULL;
 static TaskHandle_t slow_output_task_handle = NULL;
 static TimerHandle_t slow_output_timer_handle = NULL;
+#if CONFIG_DEBUG_IDLE_MONITOR
+static TaskHandle_t idle_monitor_task_handle = NULL;
+static volatile uint32_t tick_core_idle_permille = 0;
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
 
 static SemaphoreHandle_t semaphore;
 static bool is_config_mode;
 static bool update_config_flag;
+static bool reload_config_flag;
+// Written by the USB task, polled by both output tasks
+static std::atomic<uint8_t> host_led_state(0);
+
+using runner::kInputTickPeriodUs;
+static constexpr uint32_t kOutputTickPeriodUs =
+    CONFIG_SCAN_TICKS * (1000000 / configTICK_RATE_HZ);
+static constexpr uint32_t kSlowOutputTickPeriodUs =
+    CONFIG_SLOW_TICKS * (1000000 / configTICK_RATE_HZ);
+
+#if CONFIG_SCAN_PERIOD_US
+static int scan_alarm_num = -1;
+// Lower 32 bits of the target time of the alarm that fired last
+static volatile uint32_t scan_alarm_fired_target_us;
+static uint64_t scan_alarm_next_target_us;
+static volatile uint32_t scan_alarm_missed_ticks;
+#endif /* CONFIG_SCAN_PERIOD_US */
+
+// Protected by `semaphore`
+static runner::ScanJitterStats scan_jitter_stats;
+
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+// Input ticks outside config mode that touched the heap
+static std::atomic<uint32_t> allocating_ticks(0);
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
 
 namespace runner {
 
@@ -41,12 +74,13 @@ Status RunnerInit() {
   volatile size_t output_size = output_devices.size();
   volatile size_t slowoutput_size = slow_output_devices.size();
   volatile size_t input_size = input_devices.size();
-  if (USBInit() != OK) {
+  if (telemetry::TelemetryInit() != OK || USBInit() != OK) {
     return ERROR;
   }
 
   is_config_mode = false;
   update_config_flag = false;
+  reload_config_flag = false;
 
   semaphore = xSemaphoreCreateBinary();
   xSemaphoreGive(semaphore);
@@ -55,10 +89,18 @@ Status RunnerInit() {
 
 extern "C" void InputDeviceTask(void* parameter);
 extern "C" void InputDeviceTimerCallback(TimerHandle_t xTimer);
+extern "C" void InputDeviceAlarmCallback(uint alarm_num);
 extern "C" void OutputDeviceTask(void* parameter);
 extern "C" void OutputDeviceTimerCallback(TimerHandle_t xTimer);
 extern "C" void SlowOutputDeviceTask(void* parameter);
 extern "C" void SlowOutputDeviceTimerCallback(TimerHandle_t xTimer);
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+uint32_t GetAllocatingTickCount() { return allocating_ticks; }
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
+
+#if CONFIG_DEBUG_IDLE_MONITOR
+extern "C" void IdleMonitorTask(void* parameter);
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
 
 Status RunnerStart() {
   // Start USB task first
@@ -74,6 +116,8 @@ Status RunnerStart() {
   if (status != pdPASS || output_task_handle == NULL) {
     return ERROR;
   }
+  telemetry::RegisterTask(telemetry::OUTPUT_TASK, output_task_handle,
+                          kOutputTickPeriodUs);
 
   output_timer_handle = xTimerCreate("output_device_timer", CONFIG_SCAN_TICKS,
                                      pdTRUE,  // Auto reload
@@ -94,6 +138,8 @@ Status RunnerStart() {
   if (status != pdPASS || slow_output_task_handle == NULL) {
     return ERROR;
   }
+  telemetry::RegisterTask(telemetry::SLOW_OUTPUT_TASK, slow_output_task_handle,
+                          kSlowOutputTickPeriodUs);
 
   slow_output_timer_handle =
       xTimerCreate("slow_output_device_timer", CONFIG_SLOW_TICKS,
@@ -119,7 +165,24 @@ Status RunnerStart() {
   if (status != pdPASS || input_task_handle == NULL) {
     return ERROR;
   }
-
+  telemetry::RegisterTask(telemetry::INPUT_TASK, input_task_handle,
+                          kInputTickPeriodUs);
+
+#if CONFIG_SCAN_PERIOD_US
+  // Wake up the input task from a hardware alarm, so that the scan rate isn't
+  // limited by the RTOS tick. The alarm interrupt is enabled on the tick core
+  // as well.
+  scan_alarm_num = hardware_alarm_claim_unused(/*required=*/false);
+  if (scan_alarm_num < 0) {
+    return ERROR;
+  }
+  hardware_alarm_set_callback(scan_alarm_num, &InputDeviceAlarmCallback);
+  scan_alarm_next_target_us = time_us_64() + kInputTickPeriodUs;
+  if (hardware_alarm_set_target(
+          scan_alarm_num, from_us_since_boot(scan_alarm_next_target_us))) {
+    return ERROR;
+  }
+#else
   input_timer_handle = xTimerCreate("input_device_timer", CONFIG_SCAN_TICKS,
                                     pdTRUE,  // Auto reload
                                     NULL, &InputDeviceTimerCallback);
@@ -130,16 +193,49 @@ Status RunnerStart() {
   if (xTimerStart(input_timer_handle, 0) != pdPASS) {
     return ERROR;
   }
+#endif /* CONFIG_SCAN_PERIOD_US */
+
+#if CONFIG_DEBUG_IDLE_MONITOR
+  status = xTaskCreateAffinitySet(
+      &IdleMonitorTask, "idle_monitor_task", CONFIG_TASK_STACK_SIZE, NULL,
+      tskIDLE_PRIORITY, (1 << (configTICK_CORE)), &idle_monitor_task_handle);
+  if (status != pdPASS || idle_monitor_task_handle == NULL) {
+    return ERROR;
+  }
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
 
   watchdog_enable(/*delay_ms=*/100, /*pause_on_debug=*/true);
 
   return OK;
 }
 
+static void UpdateScanJitterStats(uint32_t interval_us, uint32_t jitter_us,
+                                  uint32_t missed_ticks) {
+  ScanJitterStats& stats = scan_jitter_stats;
+  if (interval_us > 0) {
+    stats.min_interval_us = std::min(stats.min_interval_us, interval_us);
+    stats.max_interval_us = std::max(stats.max_interval_us, interval_us);
+  }
+  stats.max_jitter_us = std::max(stats.max_jitter_us, jitter_us);
+  stats.total_jitter_us += jitter_us;
+  stats.missed_ticks = missed_ticks;
+  ++stats.num_ticks;
+}
+
 extern "C" void InputDeviceTask(void* parameter) {
   (void)parameter;
 
   bool local_is_config_mode = false;
+  uint64_t last_start_time = 0;
+  // The short sleep warning is logged at most once per second, with the
+  // number of ticks it covers, so that sub-millisecond periods don't flood
+  // the log
+  uint64_t last_sleep_warning_time = 0;
+  uint32_t short_sleeps = 0;
+
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+  SetAllocationCounterTask(xTaskGetCurrentTaskHandle());
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
 
   while (true) {
     // Initialization
@@ -171,18 +267,39 @@ extern "C" void InputDeviceTask(void* parameter) {
                       /*clear notification on exit*/ 0xffffffff,
                       /*pulNotificationValue=*/NULL, portMAX_DELAY);
       const uint64_t start_time = time_us_64();
-      if (start_time - sleep_time < 1000) {
-        LOG_WARNING(
-            "Input task didn't sleep enough. Remaining time budget less than "
-            "is less than 1ms.");
+      if (start_time - sleep_time < kInputTickPeriodUs / 5) {
+        ++short_sleeps;
+        if (start_time - last_sleep_warning_time >= 1000000) {
+          LOG_WARNING(
+              "Input task didn't sleep enough in %d ticks. Remaining time "
+              "budget is less than %d us.",
+              short_sleeps, kInputTickPeriodUs / 5);
+          last_sleep_warning_time = start_time;
+          short_sleeps = 0;
+        }
       }
+#if CONFIG_SCAN_PERIOD_US
+      // How late the task started compared to when the alarm was due
+      const uint32_t jitter_us =
+          (uint32_t)start_time - scan_alarm_fired_target_us;
+      const uint32_t missed_ticks = scan_alarm_missed_ticks;
+#else
+      const uint32_t jitter_us = 0;
+      const uint32_t missed_ticks = 0;
+#endif /* CONFIG_SCAN_PERIOD_US */
       bool should_change_config_mode;
       bool should_update_config;
+      bool should_reload_config;
       {
         LockSemaphore lock(semaphore);
+        UpdateScanJitterStats(
+            last_start_time == 0 ? 0 : start_time - last_start_time,
+            jitter_us, missed_ticks);
         should_change_config_mode = local_is_config_mode != is_config_mode;
         should_update_config = update_config_flag;
         update_config_flag = false;
+        should_reload_config = reload_config_flag;
+        reload_config_flag = false;
       }
       if (should_change_config_mode) {
         local_is_config_mode = !local_is_config_mode;
@@ -196,11 +313,20 @@ extern "C" void InputDeviceTask(void* parameter) {
           device->SetConfigMode(local_is_config_mode);
         }
       }
+      last_start_time = start_time;
       if (should_update_config) {
+        if (should_reload_config) {
+          DeviceRegistry::LoadConfig();
+        }
         // Rerun the initialization
+        last_start_time = 0;
         break;
       }
 
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+      const uint32_t allocation_count = GetAllocationCount();
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
+
       for (auto output_device : output_devices) {
         output_device->StartOfInputTick();
       }
@@ -209,7 +335,9 @@ extern "C" void InputDeviceTask(void* parameter) {
       }
 
       for (auto input_device : input_devices) {
+        TRACE_EVENT(INPUT_TICK_BEGIN, input_device->GetTag());
         input_device->InputTick();
+        TRACE_EVENT(INPUT_TICK_END, input_device->GetTag());
       }
 
       for (auto output_device : output_devices) {
@@ -219,9 +347,21 @@ extern "C" void InputDeviceTask(void* parameter) {
         output_device->FinalizeInputTickOutput();
       }
       const uint64_t end_time = time_us_64();
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+      if (GetAllocationCount() != allocation_count && !local_is_config_mode) {
+        ++allocating_ticks;
+        LOG_WARNING("Input task made %d heap operations in one tick",
+                    GetAllocationCount() - allocation_count);
+      }
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
+      telemetry::RecordIteration(telemetry::INPUT_TASK, start_time, end_time);
       LOG_DEBUG("Input task per iteration takes %d us", end_time - start_time);
       LOG_INFO("End input tick");
       watchdog_update();
+#if CONFIG_USB_MASS_STORAGE
+      // After the tick, as it may write the flash
+      CommitMassStorageFile();
+#endif /* CONFIG_USB_MASS_STORAGE */
     }
   }
 }
@@ -230,9 +370,47 @@ extern "C" void InputDeviceTimerCallback(TimerHandle_t xTimer) {
   xTaskNotifyGive(input_task_handle);
 }
 
+#if CONFIG_SCAN_PERIOD_US
+extern "C" void InputDeviceAlarmCallback(uint alarm_num) {
+  scan_alarm_fired_target_us = (uint32_t)scan_alarm_next_target_us;
+
+  // Schedule relative to the previous target rather than now so that the
+  // period doesn't drift. If the next target has already passed, skip ticks
+  // instead of firing back to back.
+  uint32_t missed_ticks = 0;
+  scan_alarm_next_target_us += kInputTickPeriodUs;
+  while (hardware_alarm_set_target(
+      alarm_num, from_us_since_boot(scan_alarm_next_target_us))) {
+    scan_alarm_next_target_us += kInputTickPeriodUs;
+    ++missed_ticks;
+  }
+  scan_alarm_missed_ticks = scan_alarm_missed_ticks + missed_ticks;
+
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  vTaskNotifyGiveFromISR(input_task_handle, &higher_priority_task_woken);
+  portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+#endif /* CONFIG_SCAN_PERIOD_US */
+
+// Passes the host LED state to `devices` if it differs from `*local_state`
+static void NotifyHostLEDState(
+    const std::vector<std::shared_ptr<GenericOutputDevice>>& devices,
+    uint8_t* local_state) {
+  const uint8_t state = host_led_state;
+  if (state == *local_state) {
+    return;
+  }
+  *local_state = state;
+  for (auto output_device : devices) {
+    output_device->OnHostLEDStateChange(state);
+  }
+}
+
 extern "C" void OutputDeviceTask(void* parameter) {
   (void)parameter;
 
+  uint8_t led_state = 0;
+
   while (true) {
     const uint64_t sleep_time = time_us_64();
     // Wait for the timer callback to wake it up. Running this outside the timer
@@ -246,10 +424,14 @@ extern "C" void OutputDeviceTask(void* parameter) {
           "Output task didn't sleep enough. Remaining time budget less than "
           "1ms.");
     }
+    NotifyHostLEDState(output_devices, &led_state);
     for (auto output_device : output_devices) {
+      TRACE_EVENT(OUTPUT_TICK_BEGIN, output_device->GetTag());
       output_device->OutputTick();
+      TRACE_EVENT(OUTPUT_TICK_END, output_device->GetTag());
     }
     const uint64_t end_time = time_us_64();
+    telemetry::RecordIteration(telemetry::OUTPUT_TASK, start_time, end_time);
     LOG_DEBUG("Output task per iteration takes %d us", end_time - start_time);
   }
 }
@@ -261,6 +443,8 @@ extern "C" void OutputDeviceTimerCallback(TimerHandle_t xTimer) {
 extern "C" void SlowOutputDeviceTask(void* parameter) {
   (void)parameter;
 
+  uint8_t led_state = 0;
+
   while (true) {
     const uint64_t sleep_time = time_us_64();
     // Wait for the timer callback to wake it up. Running this outside the timer
@@ -274,12 +458,23 @@ extern "C" void SlowOutputDeviceTask(void* parameter) {
           "Slow output task didn't sleep enough. Remaining time budget is less "
           "than 1ms.");
     }
+    NotifyHostLEDState(slow_output_devices, &led_state);
     for (auto output_device : slow_output_devices) {
+      TRACE_EVENT(SLOW_OUTPUT_TICK_BEGIN, output_device->GetTag());
       output_device->OutputTick();
+      TRACE_EVENT(SLOW_OUTPUT_TICK_END, output_device->GetTag());
     }
     const uint64_t end_time = time_us_64();
+    telemetry::RecordIteration(telemetry::SLOW_OUTPUT_TASK, start_time,
+                               end_time);
     LOG_DEBUG("Slow output task per iteration takes %d us",
               end_time - start_time);
+    // Not part of the iteration, so that the sampling doesn't show up in its
+    // duration
+    telemetry::Sample();
+#if CONFIG_DEBUG_TRACE
+    trace::UpdateTaskNames();
+#endif /* CONFIG_DEBUG_TRACE */
   }
 }
 
@@ -287,6 +482,49 @@ extern "C" void SlowOutputDeviceTimerCallback(TimerHandle_t xTimer) {
   xTaskNotifyGive(slow_output_task_handle);
 }
 
+ScanJitterStats GetScanJitterStats() {
+  LockSemaphore lock(semaphore);
+  return scan_jitter_stats;
+}
+
+void ResetScanJitterStats() {
+  LockSemaphore lock(semaphore);
+  scan_jitter_stats = ScanJitterStats();
+#if CONFIG_SCAN_PERIOD_US
+  scan_alarm_missed_ticks = 0;
+#endif /* CONFIG_SCAN_PERIOD_US */
+}
+
+#if CONFIG_DEBUG_IDLE_MONITOR
+extern "C" void IdleMonitorTask(void* parameter) {
+  (void)parameter;
+
+  // The task only runs when nothing else wants the core, so the time it
+  // spends spinning is idle time. A gap between two iterations means it was
+  // preempted by a task or an interrupt.
+  constexpr uint64_t kMaxIterationUs = 5;
+  uint64_t window_start = time_us_64();
+  uint64_t last = window_start;
+  uint64_t idle_us = 0;
+  while (true) {
+    const uint64_t now = time_us_64();
+    if (now - last <= kMaxIterationUs) {
+      idle_us += now - last;
+    }
+    last = now;
+    if (now - window_start >= 1000000) {
+      tick_core_idle_permille = idle_us * 1000 / (now - window_start);
+      LOG_DEBUG("Core %d idle: %d/1000", configTICK_CORE,
+                tick_core_idle_permille);
+      window_start = now;
+      idle_us = 0;
+    }
+  }
+}
+
+uint32_t GetTickCoreIdlePermille() { return tick_core_idle_permille; }
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
+
 void SetConfigMode(bool is_config) {
   LockSemaphore lock(semaphore);
   is_config_mode = is_config;
@@ -297,4 +535,12 @@ void NotifyConfigChange() {
   update_config_flag = true;
 }
 
+void NotifyConfigFileChange() {
+  LockSemaphore lock(semaphore);
+  update_config_flag = true;
+  reload_config_flag = true;
+}
+
+void SetHostLEDState(uint8_t state) { host_led_state = state; }
+
 }  // namespace runner
@@ -1,15 +1,59 @@
 #ifndef RUNNER_H_
 #define RUNNER_H_
 
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "config.h"
 #include "utils.h"
 
 namespace runner {
 
+// Period of the input ticks. Anything that moves at a speed per second, like
+// the joystick, scales its per tick step by it.
+#if CONFIG_SCAN_PERIOD_US
+constexpr uint32_t kInputTickPeriodUs = CONFIG_SCAN_PERIOD_US;
+#else
+constexpr uint32_t kInputTickPeriodUs =
+    CONFIG_SCAN_TICKS * (1000000 / configTICK_RATE_HZ);
+#endif /* CONFIG_SCAN_PERIOD_US */
+
+struct ScanJitterStats {
+  uint32_t num_ticks = 0;
+  // Time between the start of two consecutive input ticks
+  uint32_t min_interval_us = UINT32_MAX;
+  uint32_t max_interval_us = 0;
+  // How late the input task started compared to the alarm target. Only
+  // measured when CONFIG_SCAN_PERIOD_US is set.
+  uint32_t max_jitter_us = 0;
+  uint64_t total_jitter_us = 0;
+  // Alarm periods skipped because the previous one was handled too late
+  uint32_t missed_ticks = 0;
+};
+
 Status RunnerInit();
 Status RunnerStart();
 
 void SetConfigMode(bool is_config);
 void NotifyConfigChange();
+// The config file in flash was replaced, reload it before updating the devices
+void NotifyConfigFileChange();
+// New lock key LED state from the host, a mask of HostLED. The output devices
+// get it on their next output tick.
+void SetHostLEDState(uint8_t state);
+
+ScanJitterStats GetScanJitterStats();
+void ResetScanJitterStats();
+
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+// Input ticks outside config mode that made a heap operation
+uint32_t GetAllocatingTickCount();
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
+
+#if CONFIG_DEBUG_IDLE_MONITOR
+// Share of the last second core configTICK_CORE was idle, in 1/1000
+uint32_t GetTickCoreIdlePermille();
+#endif /* CONFIG_DEBUG_IDLE_MONITOR */
 
 }  // namespace runner
 
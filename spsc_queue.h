@@ -0,0 +1,63 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+
+// Bounded lock free queue between one producer task and one consumer task.
+// Elements are filled and read in place to avoid copies. Like TripleBuffer it
+// only relies on atomic loads and stores. N has to be a power of two.
+template <typename T, size_t N>
+class SPSCQueue {
+ public:
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+  SPSCQueue() : head_(0), tail_(0) {}
+
+  // Producer side. Returns the slot to fill, or NULL if the queue is full.
+  T* Back() {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == N) {
+      return NULL;
+    }
+    return &buffer_[tail % N];
+  }
+
+  // Producer side. Makes the slot returned by Back() visible to the consumer.
+  void Push() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  // Consumer side. Returns the oldest element, or NULL if the queue is empty.
+  const T* Front() {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &buffer_[head % N];
+  }
+
+  // Consumer side. Releases the element returned by Front().
+  void Pop() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::array<T, N> buffer_;
+  // Only written by the consumer
+  std::atomic<uint32_t> head_;
+  // Only written by the producer
+  std::atomic<uint32_t> tail_;
+};
+
+#endif /* SPSC_QUEUE_H_ */
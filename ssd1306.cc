@@ -14,6 +14,17 @@ using pico_ssd1306::Size;
 using pico_ssd1306::SSD1306;
 using pico_ssd1306::WriteMode;
 
+// "A" in the 8x8 font, one byte per column
+static constexpr std::array<uint8_t, 8> kCapsLockIndicator = {
+    0x7C, 0x7E, 0x13, 0x13, 0x7E, 0x7C, 0x00, 0x00};
+
+static std::array<uint8_t, FRAMEBUFFER_SIZE + 1> EmptyFrame() {
+  std::array<uint8_t, FRAMEBUFFER_SIZE + 1> frame;
+  frame.fill(0);
+  frame[0] = pico_ssd1306::SSD1306_STARTLINE;
+  return frame;
+}
+
 SSD1306Display::SSD1306Display(i2c_inst_t* i2c, uint8_t sda_pin,
                                uint8_t scl_pin, uint8_t i2c_addr,
                                NumRows num_rows, bool flip)
@@ -24,12 +35,16 @@ SSD1306Display::SSD1306Display(i2c_inst_t* i2c, uint8_t sda_pin,
       num_rows_(num_rows),
       num_cols_(128),
       sleep_s_(0),
-      buffer_idx_(0),
+      caps_lock_indicator_(true),
       buffer_changed_(false),
+      config_mode_(false),
+      frames_(EmptyFrame()),
       send_buffer_(true),
       last_active_s_(0),
       sleep_(false),
-      config_mode_(false) {
+      host_led_state_(0),
+      indicator_enabled_(true),
+      send_indicator_(false) {
   i2c_init(i2c_, 400 * 1000);
   gpio_set_function(sda_pin_, GPIO_FUNC_I2C);
   gpio_set_function(scl_pin_, GPIO_FUNC_I2C);
@@ -38,18 +53,14 @@ SSD1306Display::SSD1306Display(i2c_inst_t* i2c, uint8_t sda_pin,
 
   busy_wait_ms(250);
 
-  std::fill(double_buffer_[0].begin(), double_buffer_[0].end(), 0);
-  std::fill(double_buffer_[1].begin(), double_buffer_[1].end(), 0);
+  framebuffer_.fill(0);
   display_ = std::make_unique<SSD1306>(
       i2c_, i2c_addr_, num_rows_ == 64 ? Size::W128xH64 : Size::W128xH32);
-  display_->setBuffer(double_buffer_[1].data());
+  display_->setBuffer(framebuffer_.data());
   if (flip) {
     display_->setOrientation(0);
   }
 
-  semaphore_ = xSemaphoreCreateBinary();
-  xSemaphoreGive(semaphore_);
-
   busy_wait_ms(250);
 
   last_active_s_ = time_us_64() / 1000000;
@@ -58,7 +69,8 @@ SSD1306Display::SSD1306Display(i2c_inst_t* i2c, uint8_t sda_pin,
 std::pair<std::string, std::shared_ptr<Config>>
 SSD1306Display::CreateDefaultConfig() {
   auto config = CONFIG_OBJECT(
-      CONFIG_OBJECT_ELEM("sleep_seconds", CONFIG_INT(20, 0, 300)));
+      CONFIG_OBJECT_ELEM("sleep_seconds", CONFIG_INT(20, 0, 300)),
+      CONFIG_OBJECT_ELEM("caps_lock_indicator", CONFIG_INT(1, 0, 1)));
   return {"ssd1306", config};
 }
 
@@ -78,11 +90,20 @@ void SSD1306Display::OnUpdateConfig(const Config* config) {
     return;
   }
   sleep_s_ = ((ConfigInt*)it->second.get())->GetValue();
-  last_active_s_ = time_us_64() / 1000000;
+
+  it = root_map.find("caps_lock_indicator");
+  if (it == root_map.end()) {
+    LOG_ERROR("Can't find `caps_lock_indicator` in config");
+    return;
+  }
+  if (it->second->GetType() != Config::INTEGER) {
+    LOG_ERROR("`caps_lock_indicator` invalid type");
+    return;
+  }
+  caps_lock_indicator_ = ((ConfigInt*)it->second.get())->GetValue();
 }
 
 void SSD1306Display::SetConfigMode(bool is_config_mode) {
-  LockSemaphore lock(semaphore_);
   config_mode_ = is_config_mode;
 }
 
@@ -91,31 +112,35 @@ void SSD1306Display::OutputTick() {
 
   const uint32_t curr_s = time_us_64() / 1000000;
 
-  bool send_buffer = false;
-  std::array<uint8_t, FRAMEBUFFER_SIZE + 1> local_copy;
-  local_copy[0] = pico_ssd1306::SSD1306_STARTLINE;
-  {
-    LockSemaphore lock(semaphore_);
-    if (send_buffer_) {
-      std::copy(double_buffer_[buffer_idx_].begin(),
-                double_buffer_[buffer_idx_].end(), local_copy.begin() + 1);
-      send_buffer = send_buffer_;
-      last_active_s_ = curr_s;
-    }
-    send_buffer_ = false;
+  bool is_new;
+  const auto& frame = frames_.Read(&is_new);
+  send_buffer_ |= is_new;
+  const bool indicator_enabled = caps_lock_indicator_;
+  if (indicator_enabled != indicator_enabled_) {
+    indicator_enabled_ = indicator_enabled;
+    send_indicator_ = true;
+  }
+  if (send_buffer_ || send_indicator_) {
+    last_active_s_ = curr_s;
   }
 
-  if (!sleep_ && sleep_s_ > 0 && curr_s - last_active_s_ >= sleep_s_) {
+  const uint32_t sleep_s = sleep_s_;
+  if (!sleep_ && sleep_s > 0 && curr_s - last_active_s_ >= sleep_s) {
     sleep_ = true;
     CMD(pico_ssd1306::SSD1306_DISPLAY_OFF);
     return;
   }
 
-  if (send_buffer) {
-    if (sleep_) {
-      sleep_ = false;
-      CMD(pico_ssd1306::SSD1306_DISPLAY_ON);
-    }
+  if (sleep_ && (send_buffer_ || send_indicator_)) {
+    sleep_ = false;
+    CMD(pico_ssd1306::SSD1306_DISPLAY_ON);
+  }
+
+  if (send_buffer_) {
+    send_buffer_ = false;
+    // The frame from the input task doesn't have the indicator
+    send_indicator_ |=
+        indicator_enabled_ && (host_led_state_ & HOST_LED_CAPS_LOCK);
     CMD(pico_ssd1306::SSD1306_PAGEADDR);
     CMD(0x00);
     CMD(0x07);
@@ -123,22 +148,53 @@ void SSD1306Display::OutputTick() {
     CMD(0x00);
     CMD(127);
 
-    i2c_write_blocking(i2c_, i2c_addr_, local_copy.data(), local_copy.size(),
-                       false);
+    i2c_write_blocking(i2c_, i2c_addr_, frame.data(), frame.size(), false);
+  }
+
+  if (send_indicator_) {
+    send_indicator_ = false;
+    SendIndicator(frame);
+  }
+}
+
+void SSD1306Display::OnHostLEDStateChange(uint8_t state) {
+  if ((state ^ host_led_state_) & HOST_LED_CAPS_LOCK) {
+    send_indicator_ = true;
   }
+  host_led_state_ = state;
+}
+
+void SSD1306Display::SendIndicator(
+    const std::array<uint8_t, FRAMEBUFFER_SIZE + 1>& frame) {
+  // The framebuffer is one byte per column for each page of 8 rows
+  const uint8_t page = num_rows_ / 8 - 1;
+  const uint8_t start_col = num_cols_ - kCapsLockIndicator.size();
+  const uint8_t* area = frame.data() + 1 + page * num_cols_ + start_col;
+  const bool show =
+      indicator_enabled_ && (host_led_state_ & HOST_LED_CAPS_LOCK);
+
+  std::array<uint8_t, kCapsLockIndicator.size() + 1> data;
+  data[0] = pico_ssd1306::SSD1306_STARTLINE;
+  for (size_t i = 0; i < kCapsLockIndicator.size(); ++i) {
+    data[i + 1] = area[i] | (show ? kCapsLockIndicator[i] : 0);
+  }
+
+  CMD(pico_ssd1306::SSD1306_PAGEADDR);
+  CMD(page);
+  CMD(page);
+  CMD(pico_ssd1306::SSD1306_COLUMNADDR);
+  CMD(start_col);
+  CMD(num_cols_ - 1);
+  i2c_write_blocking(i2c_, i2c_addr_, data.data(), data.size(), false);
 }
 
 void SSD1306Display::StartOfInputTick() { buffer_changed_ = false; }
 
 void SSD1306Display::FinalizeInputTickOutput() {
-  LockSemaphore lock(semaphore_);
   if (buffer_changed_) {
-    const uint8_t buf_idx = (buffer_idx_ + 1) % 2;
-    std::copy(double_buffer_[buf_idx].begin(), double_buffer_[buf_idx].end(),
-              double_buffer_[buffer_idx_].begin());
-    display_->setBuffer(double_buffer_[buffer_idx_].data());
-    buffer_idx_ = buf_idx;
-    send_buffer_ = true;
+    auto& frame = frames_.WriteBuffer();
+    std::copy(framebuffer_.begin(), framebuffer_.end(), frame.begin() + 1);
+    frames_.Publish();
   }
 }
 
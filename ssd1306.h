@@ -2,14 +2,14 @@
 #define SSD1306_H_
 
 #include <array>
+#include <atomic>
 #include <memory>
 
-#include "FreeRTOS.h"
 #include "base.h"
 #include "configuration.h"
 #include "hardware/i2c.h"
 #include "pico-ssd1306/ssd1306.h"
-#include "semphr.h"
+#include "triple_buffer.h"
 
 class SSD1306Display : virtual public ScreenOutputDevice,
                        virtual public KeyboardOutputDevice {
@@ -25,12 +25,13 @@ class SSD1306Display : virtual public ScreenOutputDevice,
 
   void SetConfigMode(bool is_config_mode) override;
   void OutputTick() override;
+  // Draws the caps lock indicator in the bottom right corner
+  void OnHostLEDStateChange(uint8_t state) override;
 
   void StartOfInputTick() override;
   void FinalizeInputTickOutput() override;
 
-  void SendKeycode(uint8_t) override {}
-  void SendKeycode(const std::vector<uint8_t>&) override {}
+  void ProcessKeyEvents(const KeyEvent*, size_t) override {}
   void SendConsumerKeycode(uint16_t keycode) override {}
   void ChangeActiveLayers(const std::vector<bool>& layers) override;
 
@@ -54,6 +55,8 @@ class SSD1306Display : virtual public ScreenOutputDevice,
 
  protected:
   void CMD(uint8_t cmd);
+  // Sends only the indicator area of `frame`, with the indicator on top
+  void SendIndicator(const std::array<uint8_t, FRAMEBUFFER_SIZE + 1>& frame);
 
   i2c_inst_t* const i2c_;
   const uint8_t sda_pin_;
@@ -61,21 +64,28 @@ class SSD1306Display : virtual public ScreenOutputDevice,
   const uint8_t i2c_addr_;
   const size_t num_rows_;
   const size_t num_cols_;
-  uint32_t sleep_s_;
+  std::atomic<uint32_t> sleep_s_;
+  std::atomic<bool> caps_lock_indicator_;
 
   // pico_ssd1306::SSD1306 currently has memory leak issue. See
   // https://github.com/Harbys/pico-ssd1306/issues/8
   std::unique_ptr<pico_ssd1306::SSD1306> display_;
 
-  std::array<std::array<uint8_t, FRAMEBUFFER_SIZE>, 2> double_buffer_;
-  uint8_t buffer_idx_;
+  // What display_ draws into. Owned by the input task.
+  std::array<uint8_t, FRAMEBUFFER_SIZE> framebuffer_;
   bool buffer_changed_;
+  bool config_mode_;
+
+  // Frames prefixed with the start line command, ready to be sent over I2C
+  TripleBuffer<std::array<uint8_t, FRAMEBUFFER_SIZE + 1>> frames_;
+
+  // Owned by the output task
   bool send_buffer_;
   uint32_t last_active_s_;
   bool sleep_;
-  bool config_mode_;
-
-  SemaphoreHandle_t semaphore_;
+  uint8_t host_led_state_;
+  bool indicator_enabled_;
+  bool send_indicator_;
 };
 
 Status RegisterSSD1306(uint8_t screen_tag, uint8_t keyout_tag, i2c_inst_t* i2c,
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <memory>
 
 #include "FreeRTOS.h"
@@ -12,12 +13,15 @@
 #include "pico/platform.h"
 #include "semphr.h"
 #include "sync.h"
+#include "trace.h"
 
 extern "C" {
 #include "littlefs/lfs.h"
 
 static SemaphoreHandle_t __not_in_flash("storage") semaphore;
 static lfs_t __not_in_flash("storage") lfs;
+// Only modified while holding semaphore
+static std::atomic<uint32_t> generation;
 
 #define FS_OFFSET (PICO_FLASH_SIZE_BYTES - CONFIG_FLASH_FILESYSTEM_SIZE)
 
@@ -76,48 +80,27 @@ static int __no_inline_not_in_flash_func(prog)(const struct lfs_config* c,
                                                lfs_block_t block, lfs_off_t off,
                                                const void* buffer,
                                                lfs_size_t size) {
+  TRACE_EVENT(FLASH_PROGRAM_BEGIN, FS_OFFSET + (block * c->block_size) + off);
   const uint32_t irq = save_and_disable_interrupts();
   volatile uint32_t offset = FS_OFFSET + (block * c->block_size) + off;
   flash_range_program(FS_OFFSET + (block * c->block_size) + off,
                       (const uint8_t*)buffer, size);
   restore_interrupts(irq);
+  TRACE_EVENT(FLASH_PROGRAM_END, FS_OFFSET + (block * c->block_size) + off);
   return LFS_ERR_OK;
 }
 
 static int __no_inline_not_in_flash_func(erase)(const struct lfs_config* c,
                                                 lfs_block_t block) {
+  TRACE_EVENT(FLASH_ERASE_BEGIN, FS_OFFSET + (block * c->block_size));
   const uint32_t irq = save_and_disable_interrupts();
   flash_range_erase(FS_OFFSET + (block * c->block_size), c->block_size);
   restore_interrupts(irq);
+  TRACE_EVENT(FLASH_ERASE_END, FS_OFFSET + (block * c->block_size));
   return LFS_ERR_OK;
 }
 
 static int sync(const struct lfs_config* c) { return LFS_ERR_OK; }
-
-// TODO implement the USB mass storage class
-
-int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
-                          void* buffer, uint32_t bufsize) {
-  return 0;
-}
-
-int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
-                           uint8_t* buffer, uint32_t bufsize) {
-  return 0;
-}
-
-void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8],
-                        uint8_t product_id[16], uint8_t product_rev[4]) {}
-
-bool tud_msc_test_unit_ready_cb(uint8_t lun) { return true; }
-
-void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count,
-                         uint16_t* block_size) {}
-
-int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer,
-                        uint16_t bufsize) {
-  return 0;
-}
 }
 
 Status InitializeStorage() {
@@ -134,6 +117,11 @@ Status InitializeStorage() {
 }
 
 Status WriteStringToFile(const std::string& content, const std::string& name) {
+  return WriteBufferToFile(content.c_str(), content.size(), name);
+}
+
+Status WriteBufferToFile(const char* content, size_t size,
+                         const std::string& name) {
   LockSemaphore lock(semaphore);
 
   // Block the other core to avoid executing flash code when writing to flash
@@ -142,13 +130,14 @@ Status WriteStringToFile(const std::string& content, const std::string& name) {
     blocker = std::make_unique<CoreBlockerSection>();
   }
 
+  generation = generation + 1;
   lfs_file_t file;
-  if (lfs_file_open(&lfs, &file, name.c_str(), LFS_O_RDWR | LFS_O_CREAT) < 0) {
+  if (lfs_file_open(&lfs, &file, name.c_str(),
+                    LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC) < 0) {
     return ERROR;
   }
-  const lfs_ssize_t written =
-      lfs_file_write(&lfs, &file, content.c_str(), content.size());
-  if (written < 0 || written != content.size()) {
+  const lfs_ssize_t written = lfs_file_write(&lfs, &file, content, size);
+  if (written < 0 || written != size) {
     return ERROR;
   }
   if (lfs_file_close(&lfs, &file) < 0) {
@@ -191,6 +180,36 @@ Status ReadFileContent(const std::string& name, std::string* output) {
   return OK;
 }
 
+Status ReadFileToBuffer(const std::string& name, char* buffer,
+                        size_t buffer_size, size_t* size) {
+  LockSemaphore lock(semaphore);
+
+  // Block the other core to avoid executing flash code when writing to flash
+  std::unique_ptr<CoreBlockerSection> blocker;
+  if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+    blocker = std::make_unique<CoreBlockerSection>();
+  }
+
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, name.c_str(), LFS_O_RDONLY) < 0) {
+    return ERROR;
+  }
+
+  const lfs_soff_t file_size = lfs_file_size(&lfs, &file);
+  Status status = ERROR;
+  if (file_size >= 0) {
+    *size = file_size;
+    if ((size_t)file_size <= buffer_size &&
+        lfs_file_read(&lfs, &file, buffer, file_size) == file_size) {
+      status = OK;
+    }
+  }
+  if (lfs_file_close(&lfs, &file) < 0) {
+    return ERROR;
+  }
+  return status;
+}
+
 Status GetFileSize(const std::string& name, size_t* output) {
   LockSemaphore lock(semaphore);
 
@@ -223,8 +242,11 @@ Status RemoveFile(const std::string& name) {
     blocker = std::make_unique<CoreBlockerSection>();
   }
 
+  generation = generation + 1;
   if (lfs_remove(&lfs, name.c_str()) < 0) {
     return ERROR;
   }
   return OK;
 }
+
+uint32_t GetStorageGeneration() { return generation; }
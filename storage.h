@@ -1,6 +1,9 @@
 #ifndef STORAGE_H_
 #define STORAGE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <string>
 
 #include "utils.h"
@@ -8,8 +11,17 @@
 Status InitializeStorage();
 
 Status WriteStringToFile(const std::string& content, const std::string& name);
+Status WriteBufferToFile(const char* content, size_t size,
+                         const std::string& name);
 Status ReadFileContent(const std::string& name, std::string* output);
+// Reads the file into `buffer` without allocating a copy of it. Fails if it
+// doesn't fit in `buffer_size`. `size` is set to the file size either way.
+Status ReadFileToBuffer(const std::string& name, char* buffer,
+                        size_t buffer_size, size_t* size);
 Status GetFileSize(const std::string& name, size_t* output);
 Status RemoveFile(const std::string& name);
 
+// Incremented every time a file is written or removed
+uint32_t GetStorageGeneration();
+
 #endif /* STORAGE_H_ */
\ No newline at end of file
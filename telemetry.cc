@@ -0,0 +1,301 @@
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+
+#include "FreeRTOS.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "task.h"
+#include "timers.h"
+
+// Run time counter of FreeRTOS, see FreeRTOSConfig.h. Wraps every ~71
+// minutes, which is fine as only differences over a window are used.
+extern "C" uint32_t ulGetRunTimeCounterValue(void) { return time_us_32(); }
+
+namespace telemetry {
+
+namespace {
+
+constexpr uint64_t kWindowUs = 1000000;
+// uxTaskGetStackHighWaterMark() walks the stack, so the high water marks are
+// only sampled every this many windows
+constexpr uint32_t kStackSampleWindows = 10;
+// Tasks FindIdleTasks() can see at once. The firmware tasks, the idle task of
+// each core and some room for the debug ones.
+constexpr size_t kMaxTasks = 16;
+
+struct TrackedTask {
+  TaskHandle_t handle = NULL;
+  TaskStats stats;
+  uint64_t last_start_us = 0;
+  uint32_t last_run_time = 0;
+};
+
+constexpr std::array<const char*, NUM_TASKS> kTaskNames = {
+    "input", "output", "slow_out", "usb", "timer"};
+
+// A hardware spin lock, as RecordIteration() runs every tick of the periodic
+// tasks. Only held to copy a few values, never around a FreeRTOS call.
+spin_lock_t* lock = NULL;
+// Protected by lock
+std::array<TrackedTask, NUM_TASKS> tasks;
+uint32_t cpu_load_permille = UINT32_MAX;
+uint32_t window_count = 0;
+
+// Only accessed by Sample()
+uint64_t window_start_us = 0;
+uint32_t num_samples = 0;
+uint32_t last_total_run_time = 0;
+uint32_t last_idle_run_time = 0;
+std::array<TaskHandle_t, configNUM_CORES> idle_handles = {};
+size_t num_idle_handles = 0;
+
+TaskHandle_t GetHandle(TaskId id) {
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  const TaskHandle_t handle = tasks[id].handle;
+  spin_unlock(lock, irq_state);
+  return handle;
+}
+
+#if configGENERATE_RUN_TIME_STATS
+bool IsIdleTask(const TaskStatus_t& status) {
+  return strncmp(status.pcTaskName, configIDLE_TASK_NAME,
+                 strlen(configIDLE_TASK_NAME)) == 0;
+}
+
+// Looks up the idle task of each core. Only once, as uxTaskGetSystemState()
+// suspends the scheduler and walks every stack.
+void FindIdleTasks() {
+  static std::array<TaskStatus_t, kMaxTasks> statuses;
+  // Fills nothing if the array is too small
+  const size_t num_statuses =
+      uxTaskGetSystemState(statuses.data(), statuses.size(), NULL);
+  if (num_statuses == 0) {
+    LOG_WARNING("%u tasks, more than telemetry's kMaxTasks",
+                (unsigned)uxTaskGetNumberOfTasks());
+    return;
+  }
+  for (size_t i = 0; i < num_statuses; ++i) {
+    if (IsIdleTask(statuses[i]) && num_idle_handles < idle_handles.size()) {
+      idle_handles[num_idle_handles++] = statuses[i].xHandle;
+    }
+  }
+}
+
+uint32_t GetRunTime(TaskHandle_t handle) {
+  TaskStatus_t status;
+  // Neither the free stack nor the state are needed, passing them in skips
+  // the stack walk and the scheduler suspension
+  vTaskGetInfo(handle, &status, /*xGetFreeStackSpace=*/pdFALSE, eRunning);
+  return status.ulRunTimeCounter;
+}
+#endif /* configGENERATE_RUN_TIME_STATS */
+
+}  // namespace
+
+Status TelemetryInit() {
+  lock = spin_lock_instance(spin_lock_claim_unused(/*required=*/true));
+  return OK;
+}
+
+void RegisterTask(TaskId id, TaskHandle_t handle, uint32_t period_us) {
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  tasks[id].handle = handle;
+  tasks[id].stats.period_us = period_us;
+  spin_unlock(lock, irq_state);
+}
+
+void RecordIteration(TaskId id, uint64_t start_us, uint64_t end_us) {
+  const uint32_t duration_us =
+      std::min<uint64_t>(end_us - start_us, UINT32_MAX);
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  TrackedTask& task = tasks[id];
+  TaskStats& stats = task.stats;
+  stats.min_duration_us = std::min(stats.min_duration_us, duration_us);
+  stats.max_duration_us = std::max(stats.max_duration_us, duration_us);
+  stats.total_duration_us += duration_us;
+  ++stats.num_iterations;
+
+  bool missed = stats.period_us > 0 && duration_us > stats.period_us;
+  if (task.last_start_us != 0 && stats.period_us > 0) {
+    const uint64_t interval_us = start_us - task.last_start_us;
+    const uint32_t jitter_us = std::min<uint64_t>(
+        interval_us > stats.period_us ? interval_us - stats.period_us
+                                      : stats.period_us - interval_us,
+        UINT32_MAX);
+    stats.max_jitter_us = std::max(stats.max_jitter_us, jitter_us);
+    stats.total_jitter_us += jitter_us;
+    missed = missed || interval_us >= 2 * (uint64_t)stats.period_us;
+  }
+  if (missed) {
+    ++stats.missed_deadlines;
+  }
+  task.last_start_us = start_us;
+  spin_unlock(lock, irq_state);
+}
+
+void Sample() {
+  const uint64_t now = time_us_64();
+  if (now - window_start_us < kWindowUs) {
+    return;
+  }
+  window_start_us = now;
+
+  // The timer task is only created when the scheduler starts
+  if (GetHandle(TIMER_TASK) == NULL) {
+    RegisterTask(TIMER_TASK, xTimerGetTimerDaemonTaskHandle(), 0);
+  }
+
+  // Read before taking the lock, to keep it short
+  const bool sample_stacks = num_samples++ % kStackSampleWindows == 0;
+  std::array<TaskHandle_t, NUM_TASKS> handles;
+  std::array<uint32_t, NUM_TASKS> stack_high_waters = {};
+#if configGENERATE_RUN_TIME_STATS
+  std::array<uint32_t, NUM_TASKS> run_times = {};
+#endif /* configGENERATE_RUN_TIME_STATS */
+  for (size_t id = 0; id < NUM_TASKS; ++id) {
+    handles[id] = GetHandle((TaskId)id);
+    if (handles[id] == NULL) {
+      continue;
+    }
+    if (sample_stacks) {
+      stack_high_waters[id] = uxTaskGetStackHighWaterMark(handles[id]);
+    }
+#if configGENERATE_RUN_TIME_STATS
+    run_times[id] = GetRunTime(handles[id]);
+#endif /* configGENERATE_RUN_TIME_STATS */
+  }
+
+#if configGENERATE_RUN_TIME_STATS
+  if (num_idle_handles == 0) {
+    FindIdleTasks();
+  }
+  const uint32_t total_run_time = portGET_RUN_TIME_COUNTER_VALUE();
+  const uint32_t window_run_time = total_run_time - last_total_run_time;
+  last_total_run_time = total_run_time;
+
+  uint32_t idle_run_time = 0;
+  for (size_t i = 0; i < num_idle_handles; ++i) {
+    idle_run_time += GetRunTime(idle_handles[i]);
+  }
+  const uint32_t window_idle_run_time = idle_run_time - last_idle_run_time;
+  last_idle_run_time = idle_run_time;
+#endif /* configGENERATE_RUN_TIME_STATS */
+
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  for (size_t id = 0; id < NUM_TASKS; ++id) {
+    TrackedTask& task = tasks[id];
+    if (handles[id] == NULL) {
+      continue;
+    }
+    if (sample_stacks) {
+      task.stats.stack_high_water = stack_high_waters[id];
+    }
+#if configGENERATE_RUN_TIME_STATS
+    if (window_run_time > 0) {
+      task.stats.run_time_permille =
+          (uint64_t)(run_times[id] - task.last_run_time) * 1000 /
+          window_run_time;
+    }
+    task.last_run_time = run_times[id];
+#endif /* configGENERATE_RUN_TIME_STATS */
+  }
+#if configGENERATE_RUN_TIME_STATS
+  if (window_run_time > 0 && num_idle_handles > 0) {
+    const uint64_t idle_permille =
+        (uint64_t)window_idle_run_time * 1000 /
+        ((uint64_t)window_run_time * configNUM_CORES);
+    cpu_load_permille = 1000 - std::min<uint64_t>(idle_permille, 1000);
+  }
+#endif /* configGENERATE_RUN_TIME_STATS */
+  ++window_count;
+  spin_unlock(lock, irq_state);
+}
+
+const char* GetTaskName(TaskId id) { return kTaskNames[id]; }
+
+TaskStats GetTaskStats(TaskId id) {
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  const TaskStats stats = tasks[id].stats;
+  spin_unlock(lock, irq_state);
+  return stats;
+}
+
+uint32_t GetCPULoadPermille() {
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  const uint32_t load = cpu_load_permille;
+  spin_unlock(lock, irq_state);
+  return load;
+}
+
+uint32_t GetWindowCount() {
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  const uint32_t count = window_count;
+  spin_unlock(lock, irq_state);
+  return count;
+}
+
+void ResetTaskStats() {
+  const uint32_t irq_state = spin_lock_blocking(lock);
+  for (TrackedTask& task : tasks) {
+    TaskStats stats;
+    stats.period_us = task.stats.period_us;
+    stats.run_time_permille = task.stats.run_time_permille;
+    stats.stack_high_water = task.stats.stack_high_water;
+    task.stats = stats;
+    task.last_start_us = 0;
+  }
+  spin_unlock(lock, irq_state);
+}
+
+void PrintTaskStats() {
+  std::array<TaskStats, NUM_TASKS> stats;
+  for (size_t i = 0; i < NUM_TASKS; ++i) {
+    stats[i] = GetTaskStats((TaskId)i);
+  }
+  const uint32_t cpu_load = GetCPULoadPermille();
+
+  printf("%-12s %7s %9s %7s %7s %7s %7s %7s %6s %6s %6s\n", "task", "period",
+         "iters", "min_us", "avg_us", "max_us", "jit_avg", "jit_max",
+         "missed", "cpu%", "stack");
+  for (size_t i = 0; i < NUM_TASKS; ++i) {
+    const TaskStats& s = stats[i];
+    printf("%-12s %7lu %9lu ", GetTaskName((TaskId)i),
+           (unsigned long)s.period_us, (unsigned long)s.num_iterations);
+    if (s.num_iterations > 0) {
+      // The first iteration has no previous one to measure the jitter from
+      const uint32_t num_intervals =
+          std::max<uint32_t>(s.num_iterations - 1, 1);
+      printf("%7lu %7lu %7lu %7lu %7lu %6lu ",
+             (unsigned long)s.min_duration_us,
+             (unsigned long)(s.total_duration_us / s.num_iterations),
+             (unsigned long)s.max_duration_us,
+             (unsigned long)(s.total_jitter_us / num_intervals),
+             (unsigned long)s.max_jitter_us,
+             (unsigned long)s.missed_deadlines);
+    } else {
+      printf("%7s %7s %7s %7s %7s %6s ", "-", "-", "-", "-", "-", "-");
+    }
+    if (s.run_time_permille != UINT32_MAX) {
+      printf("%4lu.%lu ", (unsigned long)s.run_time_permille / 10,
+             (unsigned long)s.run_time_permille % 10);
+    } else {
+      printf("%6s ", "-");
+    }
+    if (s.stack_high_water != UINT32_MAX) {
+      printf("%6lu\n", (unsigned long)s.stack_high_water);
+    } else {
+      printf("%6s\n", "-");
+    }
+  }
+  if (cpu_load != UINT32_MAX) {
+    printf("cpu load %lu.%lu%% of %d cores\n", (unsigned long)cpu_load / 10,
+           (unsigned long)cpu_load % 10, configNUM_CORES);
+  }
+}
+
+}  // namespace telemetry
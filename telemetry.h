@@ -0,0 +1,81 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "utils.h"
+
+// Timing, CPU time and stack usage of the firmware tasks. The periodic tasks
+// report each iteration with RecordIteration(). Sample(), which the slow
+// output task calls every tick, takes the run time of the tracked tasks once
+// a second, and their stack high water marks every ten seconds.
+//
+// Shown on the config screen under "Task Stats", and printed on the debug CDC
+// port by sending "tasks" (see usb.cc).
+
+namespace telemetry {
+
+enum TaskId : uint8_t {
+  INPUT_TASK = 0,
+  OUTPUT_TASK,
+  SLOW_OUTPUT_TASK,
+  USB_TASK,
+  TIMER_TASK,
+  NUM_TASKS,
+};
+
+struct TaskStats {
+  // Nominal time between two iterations. 0 for the tasks that run on events,
+  // which have no iteration stats.
+  uint32_t period_us = 0;
+  uint32_t num_iterations = 0;
+  uint32_t min_duration_us = UINT32_MAX;
+  uint32_t max_duration_us = 0;
+  uint64_t total_duration_us = 0;
+  // Difference between the time from the previous iteration start and the
+  // period
+  uint32_t max_jitter_us = 0;
+  uint64_t total_jitter_us = 0;
+  // Iterations that ran longer than the period, or started a whole period
+  // late
+  uint32_t missed_deadlines = 0;
+  // Share of one core the task ran in the last window, in 1/1000. UINT32_MAX
+  // if configGENERATE_RUN_TIME_STATS is disabled.
+  uint32_t run_time_permille = UINT32_MAX;
+  // Least free stack the task ever had, in words. UINT32_MAX until sampled.
+  uint32_t stack_high_water = UINT32_MAX;
+};
+
+Status TelemetryInit();
+
+// Starts tracking a task. `period_us` is 0 for tasks that only run on events.
+void RegisterTask(TaskId id, TaskHandle_t handle, uint32_t period_us);
+
+// Called by the task itself at the end of each iteration
+void RecordIteration(TaskId id, uint64_t start_us, uint64_t end_us);
+
+// Updates the run time shares once a window has passed, and the stack high
+// water marks every few windows. Does nothing otherwise. Only looks at the
+// tracked tasks, and doesn't suspend the scheduler after the first window.
+void Sample();
+
+const char* GetTaskName(TaskId id);
+TaskStats GetTaskStats(TaskId id);
+// Share of all the cores that wasn't idle in the last window, in 1/1000.
+// UINT32_MAX if configGENERATE_RUN_TIME_STATS is disabled. The task of
+// CONFIG_DEBUG_IDLE_MONITOR counts as busy.
+uint32_t GetCPULoadPermille();
+// Incremented every time Sample() finishes a window
+uint32_t GetWindowCount();
+
+// Clears the iteration stats. The high water marks are kept.
+void ResetTaskStats();
+
+// Prints a table of all the tasks with printf
+void PrintTaskStats();
+
+}  // namespace telemetry
+
+#endif /* TELEMETRY_H_ */
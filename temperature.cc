@@ -123,16 +123,16 @@ void TemperatureInputDeivce::WriteTemp(int32_t temp) {
   }
 
   for (auto screen : *screen_output_) {
-    std::unique_ptr<char[]> buffer(new char[screen->GetNumCols() / 8]);
+    char buffer[32];
     const size_t padding = screen->GetNumCols() / 8 - 7;
-    size_t len = std::snprintf(buffer.get(), 16, "Temp:%*d%s", padding, temp,
+    size_t len = std::snprintf(buffer, 16, "Temp:%*d%s", padding, temp,
                                is_fahrenheit_ ? "F" : "C");
 
     // Clear the row first
     screen->DrawRect(screen->GetNumRows() - 8, 0, screen->GetNumRows(),
                      screen->GetNumCols(), true, ScreenOutputDevice::SUBTRACT);
     screen->DrawText(screen->GetNumRows() - 8, 0,
-                     std::string(buffer.get(), len), ScreenOutputDevice::F8X8,
+                     std::string(buffer, len), ScreenOutputDevice::F8X8,
                      ScreenOutputDevice::ADD);
   }
 }
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Builds the call site table for deferred logs and decodes them.
+
+See deferred_log.h for the record format. The build runs `table` to generate
+log_table.json next to the firmware, which `decode` needs to turn the records
+back into text. `table` fails if two different formats hash to the same id,
+as their records couldn't be told apart.
+
+  log_tool.py table -o log_table.json <sources...>
+  log_tool.py decode --table log_table.json [--port /dev/ttyACM0 | file]
+
+Reading from a port requires the `serial` package (pip install pyserial).
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+# Keep in sync with deferred_log.h
+RECORD_MAGIC = 0xFE
+RECORD_HEADER_SIZE = 2
+LEVEL_PREFIXES = {"ERROR": "E", "WARNING": "W", "INFO": "I", "DEBUG": "D"}
+
+CALL_PATTERN = re.compile(r"\bLOG_(ERROR|WARNING|INFO|DEBUG)\s*\(\s*")
+STRING_PATTERN = re.compile(r'"((?:[^"\\\n]|\\.)*)"\s*')
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "\\": "\\", '"': '"', "'": "'",
+           "0": "\0"}
+# printf conversions, with the flags, width and precision kept for Python
+CONVERSION_PATTERN = re.compile(
+    r"%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|j|z|t|L)?([diouxXeEfgGcsp%])")
+
+
+class TableError(Exception):
+    pass
+
+
+def log_id(text):
+    """FNV-1a of the UTF-8 bytes, same as deferred_log::LogId()."""
+    value = 2166136261
+    for byte in text.encode():
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def unescape(literal):
+    return re.sub(r"\\(.)", lambda m: ESCAPES.get(m.group(1), m.group(1)),
+                  literal)
+
+
+def scan(path, table):
+    with open(path, encoding="utf-8", errors="replace") as f:
+        source = f.read()
+    for call in CALL_PATTERN.finditer(source):
+        # Adjacent literals are concatenated by the compiler
+        offset = call.end()
+        parts = []
+        while True:
+            literal = STRING_PATTERN.match(source, offset)
+            if literal is None:
+                break
+            parts.append(unescape(literal.group(1)))
+            offset = literal.end()
+        if not parts:
+            # Not a call with a literal format, like the macro definitions
+            continue
+        level = call.group(1)
+        text = LEVEL_PREFIXES[level] + " " + "".join(parts)
+        line = source.count("\n", 0, call.start()) + 1
+        location = "%s:%d" % (os.path.relpath(path), line)
+        entry = table.setdefault("%08x" % log_id(text), {
+            "level": level,
+            "format": "".join(parts),
+            "locations": []
+        })
+        # The same text at several call sites decodes the same, but two texts
+        # with the same id can't be told apart
+        if entry["level"] != level or entry["format"] != "".join(parts):
+            raise TableError("%s has the id %08x of %s, change either format"
+                             % (location, log_id(text),
+                                entry["locations"][0]))
+        entry["locations"].append(location)
+
+
+def build_table(args):
+    table = {}
+    for path in args.sources:
+        scan(path, table)
+    with open(args.output, "w") as f:
+        json.dump(table, f, indent=1, sort_keys=True)
+
+
+def read_args(payload):
+    values = []
+    offset = 0
+    while offset < len(payload):
+        arg_type = chr(payload[offset])
+        offset += 1
+        if arg_type in "iufp":
+            fmt = {"i": "<i", "u": "<I", "f": "<f", "p": "<I"}[arg_type]
+            values.append(struct.unpack_from(fmt, payload, offset)[0])
+            offset += 4
+        elif arg_type in "qQ":
+            fmt = "<q" if arg_type == "q" else "<Q"
+            values.append(struct.unpack_from(fmt, payload, offset)[0])
+            offset += 8
+        elif arg_type == "s":
+            length = payload[offset]
+            values.append(payload[offset + 1:offset + 1 + length].decode(
+                errors="replace"))
+            offset += 1 + length
+        else:
+            raise ValueError("unknown argument type %r" % arg_type)
+    return values
+
+
+def format_record(entry, values):
+    values = list(values)
+
+    def convert(match):
+        spec, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        if not values:
+            return "<missing>"
+        value = values.pop(0)
+        if conversion == "p":
+            return "0x%08x" % value
+        if conversion in "diu":
+            conversion = "d"
+        elif conversion == "c":
+            value = chr(value)
+        try:
+            return ("%" + spec + conversion) % value
+        except (TypeError, ValueError):
+            return str(value)
+
+    return CONVERSION_PATTERN.sub(convert, entry["format"])
+
+
+def decode_stream(stream, table, out):
+    data = b""
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            break
+        data += chunk
+        while data:
+            start = data.find(bytes([RECORD_MAGIC]))
+            if start != 0:
+                # Plain text that didn't go through the LOG macros
+                text = data if start < 0 else data[:start]
+                out.write(text.decode(errors="replace"))
+                data = b"" if start < 0 else data[start:]
+                continue
+            if len(data) < RECORD_HEADER_SIZE or len(
+                    data) < RECORD_HEADER_SIZE + data[1]:
+                break
+            body = data[RECORD_HEADER_SIZE:RECORD_HEADER_SIZE + data[1]]
+            entry = None if len(body) < 8 else table.get(
+                "%08x" % struct.unpack_from("<I", body)[0])
+            if entry is None:
+                # Not a record, look for the next magic byte
+                out.write("<%02x>" % data[0])
+                data = data[1:]
+                continue
+            data = data[RECORD_HEADER_SIZE + len(body):]
+            (time_us,) = struct.unpack_from("<I", body, 4)
+            try:
+                message = format_record(entry, read_args(body[8:]))
+            except (ValueError, struct.error) as e:
+                message = "<undecodable: %s>" % e
+            out.write("%10.6f %s %s %s\n" %
+                      (time_us / 1e6, LEVEL_PREFIXES[entry["level"]],
+                       entry["locations"][0], message))
+        out.flush()
+
+
+class SerialStream:
+    """Returns whatever arrived instead of waiting for a full read."""
+
+    def __init__(self, port):
+        import serial
+        self.port = serial.Serial(port, timeout=0.1)
+
+    def read(self, size):
+        while True:
+            data = self.port.read(max(1, min(size, self.port.in_waiting)))
+            if data:
+                return data
+
+
+def decode(args):
+    with open(args.table) as f:
+        table = json.load(f)
+    if args.port:
+        stream = SerialStream(args.port)
+    elif args.input and args.input != "-":
+        stream = open(args.input, "rb")
+    else:
+        stream = sys.stdin.buffer
+    decode_stream(stream, table, sys.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    table_parser = commands.add_parser("table")
+    table_parser.add_argument("-o", "--output", required=True)
+    table_parser.add_argument("sources", nargs="+")
+    table_parser.set_defaults(func=build_table)
+
+    decode_parser = commands.add_parser("decode")
+    decode_parser.add_argument("--table", required=True)
+    decode_parser.add_argument("--port", help="serial port of the device")
+    decode_parser.add_argument("input", nargs="?", help="captured log file")
+    decode_parser.set_defaults(func=decode)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except TableError as e:
+        sys.exit("error: %s" % e)
@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""Reference host client for the raw HID config protocol in raw_hid.h.
+
+Requires the `hid` package (pip install hid), which wraps hidapi.
+
+  raw_hid_client.py version
+  raw_hid_client.py get [path]
+  raw_hid_client.py set <path> <value>
+  raw_hid_client.py save
+  raw_hid_client.py telemetry
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+import hid
+
+# Keep in sync with raw_hid.h and configs/default/config.h
+VID = 0xECEB
+PID = 0x3026
+USAGE_PAGE = 0xFF00
+PACKET_SIZE = 64
+RESPONSE_HEADER_SIZE = 4
+MORE_FLAG = 0x80
+PROTOCOL_VERSION = 1
+
+GET_VERSION = 0x01
+GET_CONFIG = 0x02
+SET_CONFIG = 0x03
+SAVE_CONFIG = 0x04
+GET_TELEMETRY = 0x05
+GET_TRACE = 0x06
+
+STATUS_NAMES = ["ok", "unknown command", "invalid path", "invalid value",
+                "busy"]
+
+# Config::Type
+OBJECT = 1
+LIST = 2
+INTEGER = 3
+FLOAT = 4
+
+TELEMETRY_FORMAT = "<4IQ4I2I"
+TELEMETRY_FIELDS = [
+    "num_ticks", "min_interval_us", "max_interval_us", "max_jitter_us",
+    "total_jitter_us", "missed_ticks", "reports_queued", "reports_coalesced",
+    "reports_overflowed", "tick_core_idle_permille", "requests_dropped"
+]
+
+
+class ProtocolError(Exception):
+    pass
+
+
+class Client:
+
+    def __init__(self, device, timeout_ms=1000):
+        self.device = device
+        self.timeout_ms = timeout_ms
+        self.sequence = 0
+
+    def request(self, command, payload=b""):
+        self.sequence = (self.sequence + 1) & 0xFF
+        packet = bytes([command, self.sequence]) + payload
+        if len(packet) > PACKET_SIZE:
+            raise ProtocolError("request too long")
+        # The leading 0 is the report ID, which the interface doesn't use
+        self.device.write(b"\0" + packet.ljust(PACKET_SIZE, b"\0"))
+
+        response = b""
+        while True:
+            packet = bytes(self.device.read(PACKET_SIZE, self.timeout_ms))
+            if not packet:
+                raise ProtocolError("timed out")
+            if packet[0] != command or packet[1] != self.sequence:
+                # Left over from an earlier request
+                continue
+            if packet[2] != 0:
+                status = packet[2]
+                name = (STATUS_NAMES[status]
+                        if status < len(STATUS_NAMES) else str(status))
+                raise ProtocolError(name)
+            length = packet[3] & ~MORE_FLAG
+            response += packet[RESPONSE_HEADER_SIZE:RESPONSE_HEADER_SIZE +
+                               length]
+            if not packet[3] & MORE_FLAG:
+                return response
+
+    def version(self):
+        return self.request(GET_VERSION)[0]
+
+    def get(self, path=""):
+        data = self.request(GET_CONFIG, path.encode() + b"\0")
+        node, _ = decode_node(data, 0)
+        return node
+
+    def set(self, path, value):
+        node = self.get(path)
+        if isinstance(node, dict) and "resolution" in node:
+            encoded = struct.pack("<Bf", FLOAT, float(value))
+        elif isinstance(node, dict) and "min" in node:
+            encoded = struct.pack("<Bi", INTEGER, int(value))
+        else:
+            raise ProtocolError("only integers and floats can be set")
+        self.request(SET_CONFIG, path.encode() + b"\0" + encoded)
+
+    def save(self):
+        self.request(SAVE_CONFIG)
+
+    def telemetry(self):
+        data = self.request(GET_TELEMETRY)
+        values = struct.unpack_from(TELEMETRY_FORMAT, data)
+        return dict(zip(TELEMETRY_FIELDS, values))
+
+    def trace(self):
+        """Returns the trace dump, see trace.h and trace_tool.py."""
+        dump = b""
+        while True:
+            data = self.request(GET_TRACE, struct.pack("<I", len(dump)))
+            (size,) = struct.unpack_from("<I", data)
+            dump += data[4:]
+            if len(dump) >= size:
+                return dump
+
+
+def decode_node(data, offset):
+    """Returns the node at `offset` and the offset after it."""
+    node_type = data[offset]
+    offset += 1
+    if node_type == OBJECT:
+        (count,) = struct.unpack_from("<H", data, offset)
+        offset += 2
+        members = {}
+        for _ in range(count):
+            length = data[offset]
+            name = data[offset + 1:offset + 1 + length].decode()
+            members[name], offset = decode_node(data, offset + 1 + length)
+        return members, offset
+    if node_type == LIST:
+        (count,) = struct.unpack_from("<H", data, offset)
+        offset += 2
+        elements = []
+        for _ in range(count):
+            element, offset = decode_node(data, offset)
+            elements.append(element)
+        return elements, offset
+    if node_type == INTEGER:
+        value, low, high = struct.unpack_from("<3i", data, offset)
+        return {"value": value, "min": low, "max": high}, offset + 12
+    if node_type == FLOAT:
+        value, low, high, resolution = struct.unpack_from("<4f", data, offset)
+        return {
+            "value": value,
+            "min": low,
+            "max": high,
+            "resolution": resolution
+        }, offset + 16
+    raise ProtocolError("unknown node type %d" % node_type)
+
+
+def strip_limits(node):
+    """Leaves only the values, in the same shape as the JSON config file."""
+    if isinstance(node, list):
+        return [strip_limits(element) for element in node]
+    if "min" in node:
+        return node["value"]
+    return {name: strip_limits(member) for name, member in node.items()}
+
+
+def open_device(vid, pid):
+    for info in hid.enumerate(vid, pid):
+        if info["usage_page"] == USAGE_PAGE:
+            device = hid.device()
+            device.open_path(info["path"])
+            return device
+    raise ProtocolError("no raw HID interface found for %04x:%04x" % (vid, pid))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("--vid", type=lambda x: int(x, 0), default=VID)
+    parser.add_argument("--pid", type=lambda x: int(x, 0), default=PID)
+    parser.add_argument("--limits",
+                        action="store_true",
+                        help="also print the min and max of each value")
+    parser.add_argument("command",
+                        choices=["version", "get", "set", "save", "telemetry"])
+    parser.add_argument("args", nargs="*")
+    args = parser.parse_args()
+
+    client = Client(open_device(args.vid, args.pid))
+    if client.version() != PROTOCOL_VERSION:
+        raise ProtocolError("unsupported protocol version")
+
+    if args.command == "version":
+        print(PROTOCOL_VERSION)
+    elif args.command == "get":
+        node = client.get(args.args[0] if args.args else "")
+        print(json.dumps(node if args.limits else strip_limits(node),
+                         indent=2))
+    elif args.command == "set":
+        if len(args.args) != 2:
+            parser.error("set needs a path and a value")
+        client.set(args.args[0], args.args[1])
+    elif args.command == "save":
+        client.save()
+    elif args.command == "telemetry":
+        print(json.dumps(client.telemetry(), indent=2))
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except ProtocolError as e:
+        sys.exit("error: %s" % e)
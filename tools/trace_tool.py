@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""Captures the trace dumps of CONFIG_DEBUG_TRACE and converts them to Chrome
+trace JSON. See trace.h for the dump format.
+
+  trace_tool.py capture --port /dev/ttyACM0 -o trace.bin
+  trace_tool.py capture --hid -o trace.bin
+  trace_tool.py convert trace.bin -o trace.json
+
+Open the JSON in chrome://tracing or https://ui.perfetto.dev. The "cores"
+process shows which task ran on each core, and the "tasks" process what each
+task was doing. Capturing from a port requires the `serial` package (pip
+install pyserial), and over raw HID the `hid` package, see raw_hid_client.py.
+"""
+
+import argparse
+import json
+import struct
+import sys
+import time
+
+# Keep in sync with trace.h
+DUMP_MAGIC = 0x544B4D50
+DUMP_VERSION = 1
+HEADER_FORMAT = "<IBBBBII"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+RECORD_FORMAT = "<II"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+TASK_SWITCHED_IN = 1
+# EventType of the begin records: (name, EventType of the end record)
+SPANS = {
+    2: ("input tick", 3),
+    4: ("output tick", 5),
+    6: ("slow output tick", 7),
+    8: ("semaphore wait", 9),
+    10: ("flash erase", 11),
+    12: ("flash program", 13),
+}
+END_TYPES = {end: begin for begin, (_, end) in SPANS.items()}
+
+# tid of the events recorded before the first task switch of their core
+UNKNOWN_TASK = -1
+
+
+class DumpError(Exception):
+    pass
+
+
+def parse_header(data):
+    if len(data) < HEADER_SIZE:
+        raise DumpError("dump too short")
+    (magic, version, num_cores, num_tasks, name_size, ring_size,
+     dump_time_us) = struct.unpack_from(HEADER_FORMAT, data)
+    if magic != DUMP_MAGIC:
+        raise DumpError("not a trace dump")
+    if version != DUMP_VERSION:
+        raise DumpError("unsupported dump version %d" % version)
+    return {
+        "num_cores": num_cores,
+        "num_tasks": num_tasks,
+        "name_size": name_size,
+        "ring_size": ring_size,
+        "dump_time_us": dump_time_us,
+    }
+
+
+def dump_size(header):
+    return (HEADER_SIZE + header["num_tasks"] * (4 + header["name_size"]) +
+            header["num_cores"] * (4 + header["ring_size"] * RECORD_SIZE))
+
+
+def parse_dump(data):
+    """Returns the task names by id and the records, oldest first.
+
+    Each record is (age_us, core, event type, arg), where the age is counted
+    back from the dump, so that time_us_32() wrapping doesn't matter.
+    """
+    header = parse_header(data)
+    if len(data) < dump_size(header):
+        raise DumpError("dump truncated, %d of %d bytes" %
+                        (len(data), dump_size(header)))
+    offset = HEADER_SIZE
+    tasks = {}
+    for _ in range(header["num_tasks"]):
+        (task_id,) = struct.unpack_from("<I", data, offset)
+        name = data[offset + 4:offset + 4 + header["name_size"]]
+        tasks[task_id] = name.split(b"\0")[0].decode(errors="replace")
+        offset += 4 + header["name_size"]
+
+    num_cores = header["num_cores"]
+    ring_size = header["ring_size"]
+    counts = struct.unpack_from("<%dI" % num_cores, data, offset)
+    offset += 4 * num_cores
+    records = []
+    for core, count in enumerate(counts):
+        ring_offset = offset + core * ring_size * RECORD_SIZE
+        for i in range(count - min(count, ring_size), count):
+            time_us, info = struct.unpack_from(
+                RECORD_FORMAT, data,
+                ring_offset + (i % ring_size) * RECORD_SIZE)
+            age_us = (header["dump_time_us"] - time_us) & 0xFFFFFFFF
+            records.append((age_us, (info >> 7) & 1, info & 0x7F, info >> 8))
+    # Stable, so the records of one core with the same time keep their order
+    records.sort(key=lambda record: -record[0])
+    return tasks, records
+
+
+def span_name(event_type, arg):
+    name = SPANS[event_type][0]
+    if event_type in (2, 4, 6):
+        return "%s (tag %d)" % (name, arg)
+    if event_type == 8:
+        return "%s 0x%06x" % (name, arg)
+    return name
+
+
+def to_chrome_trace(tasks, records):
+    if not records:
+        return {"traceEvents": []}
+    oldest_us = records[0][0]
+    end_us = oldest_us - records[-1][0]
+    events = [
+        {"ph": "M", "pid": 0, "name": "process_name",
+         "args": {"name": "cores"}},
+        {"ph": "M", "pid": 1, "name": "process_name",
+         "args": {"name": "tasks"}},
+    ]
+
+    def task_name(task_id):
+        if task_id == UNKNOWN_TASK:
+            return "unknown"
+        return tasks.get(task_id, "task 0x%06x" % task_id)
+
+    # Per core: (task id, start) of the task running
+    running = {}
+    # Per task: stack of (begin EventType, name) of the open spans
+    open_spans = {}
+    for age_us, core, event_type, arg in records:
+        ts = oldest_us - age_us
+        if event_type == TASK_SWITCHED_IN:
+            if core in running:
+                task_id, start = running[core]
+                events.append({"ph": "X", "pid": 0, "tid": core, "ts": start,
+                               "dur": ts - start, "name": task_name(task_id)})
+            running[core] = (arg, ts)
+            open_spans.setdefault(arg, [])
+            continue
+        task_id = running.get(core, (UNKNOWN_TASK, 0))[0]
+        stack = open_spans.setdefault(task_id, [])
+        if event_type in SPANS:
+            name = span_name(event_type, arg)
+            stack.append((event_type, name))
+            events.append({"ph": "B", "pid": 1, "tid": task_id, "ts": ts,
+                           "name": name, "args": {"core": core}})
+        elif event_type in END_TYPES:
+            # The begin can be older than the ring
+            if stack and stack[-1][0] == END_TYPES[event_type]:
+                stack.pop()
+                events.append({"ph": "E", "pid": 1, "tid": task_id, "ts": ts})
+
+    # Whatever was still going on at the last record
+    for core, (task_id, start) in running.items():
+        events.append({"ph": "X", "pid": 0, "tid": core, "ts": start,
+                       "dur": end_us - start, "name": task_name(task_id)})
+    for task_id, stack in open_spans.items():
+        for _ in stack:
+            events.append({"ph": "E", "pid": 1, "tid": task_id, "ts": end_us})
+
+    for core in sorted(running):
+        events.append({"ph": "M", "pid": 0, "tid": core, "name": "thread_name",
+                       "args": {"name": "core %d" % core}})
+    for task_id in sorted(open_spans):
+        events.append({"ph": "M", "pid": 1, "tid": task_id,
+                       "name": "thread_name",
+                       "args": {"name": task_name(task_id)}})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def capture_serial(port, timeout_s):
+    import serial
+    device = serial.Serial(port, timeout=0.1)
+    device.write(b"trace\n")
+    data = b""
+    deadline = time.monotonic() + timeout_s
+    size = None
+    while size is None or len(data) < size:
+        if time.monotonic() > deadline:
+            raise DumpError("timed out, is CONFIG_DEBUG_TRACE enabled?")
+        data += device.read(max(1, device.in_waiting))
+        if size is None:
+            # Skip the logs sent before the dump
+            start = data.find(struct.pack("<I", DUMP_MAGIC))
+            if start < 0 and b"Trace dump busy" in data:
+                raise DumpError("a dump is being read over raw HID")
+            if start < 0 or len(data) < start + HEADER_SIZE:
+                continue
+            data = data[start:]
+            size = dump_size(parse_header(data))
+    return data[:size]
+
+
+def capture_hid(vid, pid):
+    import raw_hid_client
+    try:
+        client = raw_hid_client.Client(
+            raw_hid_client.open_device(vid or raw_hid_client.VID,
+                                       pid or raw_hid_client.PID))
+        return client.trace()
+    except raw_hid_client.ProtocolError as e:
+        raise DumpError(e)
+
+
+def capture(args):
+    if args.port:
+        data = capture_serial(args.port, args.timeout)
+    else:
+        data = capture_hid(args.vid, args.pid)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    tasks, records = parse_dump(data)
+    print("%d records, %d tasks" % (len(records), len(tasks)))
+
+
+def convert(args):
+    with open(args.input, "rb") as f:
+        tasks, records = parse_dump(f.read())
+    trace = to_chrome_trace(tasks, records)
+    if args.output and args.output != "-":
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    capture_parser = commands.add_parser("capture")
+    source = capture_parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--port", help="debug CDC port of the device")
+    source.add_argument("--hid", action="store_true",
+                        help="read over the raw HID interface")
+    capture_parser.add_argument("--vid", type=lambda x: int(x, 0))
+    capture_parser.add_argument("--pid", type=lambda x: int(x, 0))
+    capture_parser.add_argument("--timeout", type=float, default=10,
+                                help="seconds to wait for the dump")
+    capture_parser.add_argument("-o", "--output", required=True)
+    capture_parser.set_defaults(func=capture)
+
+    convert_parser = commands.add_parser("convert")
+    convert_parser.add_argument("input", help="captured dump")
+    convert_parser.add_argument("-o", "--output", help="JSON file")
+    convert_parser.set_defaults(func=convert)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except DumpError as e:
+        sys.exit("error: %s" % e)
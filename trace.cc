@@ -0,0 +1,169 @@
+#include "trace.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if CONFIG_DEBUG_TRACE
+
+#include <string.h>
+
+#include <array>
+#include <atomic>
+
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/platform.h"
+
+namespace trace {
+
+namespace {
+
+static_assert((CONFIG_DEBUG_TRACE_BUFFER_SIZE &
+               (CONFIG_DEBUG_TRACE_BUFFER_SIZE - 1)) == 0,
+              "CONFIG_DEBUG_TRACE_BUFFER_SIZE must be a power of two");
+
+std::array<std::array<Record, CONFIG_DEBUG_TRACE_BUFFER_SIZE>, configNUM_CORES>
+    rings;
+// Only written by the core of the ring, with interrupts disabled
+std::array<uint32_t, configNUM_CORES> num_written;
+std::atomic<bool> recording(true);
+// Checked and set in a critical section, as the readers can run on either core
+DumpReader dump_reader = NO_READER;
+
+// Tasks named in the dump at most
+constexpr size_t kMaxTasks = 16;
+
+struct TaskName {
+  uint32_t id;
+  char name[configMAX_TASK_NAME_LEN];
+};
+
+// Filled by UpdateTaskNames() and read by PrepareDump(), in critical sections
+std::array<TaskName, kMaxTasks> task_names;
+size_t num_task_names = 0;
+
+constexpr size_t kDumpHeaderMaxSize = 16 +
+                                      kMaxTasks * sizeof(TaskName) +
+                                      configNUM_CORES * sizeof(uint32_t);
+static_assert(sizeof(TaskName) == 4 + configMAX_TASK_NAME_LEN,
+              "TaskName is copied into the dump as is");
+
+// Everything before the rings, filled by PrepareDump()
+std::array<uint8_t, kDumpHeaderMaxSize> dump_header;
+size_t dump_header_size = 0;
+
+template <typename T>
+void Append(const T& value) {
+  memcpy(dump_header.data() + dump_header_size, &value, sizeof(T));
+  dump_header_size += sizeof(T);
+}
+
+}  // namespace
+
+// In RAM, so that it doesn't miss the XIP cache and can be called around the
+// flash operations of storage.cc
+void __not_in_flash_func(RecordEvent)(EventType type, uint32_t arg) {
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const uint32_t irq = save_and_disable_interrupts();
+#if configNUM_CORES > 1
+  const uint32_t core = get_core_num();
+#else
+  const uint32_t core = 0;
+#endif
+  Record& record =
+      rings[core][num_written[core]++ % CONFIG_DEBUG_TRACE_BUFFER_SIZE];
+  record.time_us = time_us_32();
+  record.info = type | (core << 7) | (arg << 8);
+  restore_interrupts(irq);
+}
+
+void UpdateTaskNames() {
+  // uxTaskGetSystemState() suspends the scheduler and walks every stack, so
+  // the names are only taken again when the number of tasks changes
+  static UBaseType_t last_num_tasks = 0;
+  static std::array<TaskStatus_t, kMaxTasks> statuses;
+  const UBaseType_t num_tasks = uxTaskGetNumberOfTasks();
+  if (num_tasks == last_num_tasks) {
+    return;
+  }
+  last_num_tasks = num_tasks;
+  // 0 if there are more tasks than kMaxTasks, the dump then has no names
+  const size_t num_statuses =
+      uxTaskGetSystemState(statuses.data(), statuses.size(), NULL);
+
+  taskENTER_CRITICAL();
+  for (size_t i = 0; i < num_statuses; ++i) {
+    TaskName& task_name = task_names[i];
+    task_name.id = HandleId(statuses[i].xHandle);
+    memset(task_name.name, 0, sizeof(task_name.name));
+    strncpy(task_name.name, statuses[i].pcTaskName,
+            sizeof(task_name.name) - 1);
+  }
+  num_task_names = num_statuses;
+  taskEXIT_CRITICAL();
+}
+
+size_t PrepareDump(DumpReader reader) {
+  taskENTER_CRITICAL();
+  const bool taken = dump_reader != NO_READER && dump_reader != reader;
+  if (!taken) {
+    dump_reader = reader;
+  }
+  taskEXIT_CRITICAL();
+  if (taken) {
+    return 0;
+  }
+  recording = false;
+
+  dump_header_size = 0;
+  taskENTER_CRITICAL();
+  Append(kDumpMagic);
+  Append(kDumpVersion);
+  Append((uint8_t)configNUM_CORES);
+  Append((uint8_t)num_task_names);
+  Append((uint8_t)configMAX_TASK_NAME_LEN);
+  Append((uint32_t)CONFIG_DEBUG_TRACE_BUFFER_SIZE);
+  Append((uint32_t)time_us_32());
+  for (size_t i = 0; i < num_task_names; ++i) {
+    Append(task_names[i]);
+  }
+  taskEXIT_CRITICAL();
+  for (uint32_t count : num_written) {
+    Append(count);
+  }
+  return dump_header_size + sizeof(rings);
+}
+
+size_t GetDumpData(size_t offset, const uint8_t** data) {
+  if (offset < dump_header_size) {
+    *data = dump_header.data() + offset;
+    return dump_header_size - offset;
+  }
+  offset -= dump_header_size;
+  if (offset < sizeof(rings)) {
+    *data = (const uint8_t*)rings.data() + offset;
+    return sizeof(rings) - offset;
+  }
+  return 0;
+}
+
+void FinishDump(DumpReader reader) {
+  taskENTER_CRITICAL();
+  if (dump_reader == reader) {
+    dump_reader = NO_READER;
+    recording = true;
+  }
+  taskEXIT_CRITICAL();
+}
+
+}  // namespace trace
+
+// traceTASK_SWITCHED_IN() of FreeRTOSConfig.h. In RAM like RecordEvent(), as
+// it runs on every context switch.
+extern "C" void __not_in_flash_func(vTraceTaskSwitchedIn)(void* task) {
+  trace::RecordEvent(trace::TASK_SWITCHED_IN, trace::HandleId(task));
+}
+
+#endif /* CONFIG_DEBUG_TRACE */
@@ -0,0 +1,104 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// Records what the cores were doing into a RAM ring per core when
+// CONFIG_DEBUG_TRACE is enabled: task switches, the ticks of each device,
+// semaphore waits and flash operations. Each core only writes its own ring
+// with interrupts disabled, so recording takes no lock and stays well under a
+// microsecond.
+//
+// The rings are dumped with the "trace" command of the debug CDC port or with
+// RAW_HID_GET_TRACE, and tools/trace_tool.py turns a dump into Chrome trace
+// JSON. Dump layout, multi-byte values are little endian:
+//
+//   | kDumpMagic | u8 version | u8 num cores | u8 num tasks | u8 name size
+//   | u32 records per core | u32 time_us_32() of the dump
+//   | num tasks times (u32 task id, name padded with NULs to name size)
+//   | num cores times u32 records written to the ring
+//   | num cores times the ring of Records
+//
+// Ring i holds the last records of core i, the oldest one at the number
+// written modulo the ring size once the ring has wrapped.
+
+namespace trace {
+
+constexpr uint32_t kDumpMagic = 0x544b4d50;  // "PMKT"
+constexpr uint8_t kDumpVersion = 1;
+
+enum EventType : uint8_t {
+  // arg: task id of the task that starts running
+  TASK_SWITCHED_IN = 1,
+  // arg: tag of the device
+  INPUT_TICK_BEGIN,
+  INPUT_TICK_END,
+  OUTPUT_TICK_BEGIN,
+  OUTPUT_TICK_END,
+  SLOW_OUTPUT_TICK_BEGIN,
+  SLOW_OUTPUT_TICK_END,
+  // arg: id of the semaphore. The end is when the semaphore was taken.
+  SEMAPHORE_WAIT_BEGIN,
+  SEMAPHORE_WAIT_END,
+  // arg: offset in flash
+  FLASH_ERASE_BEGIN,
+  FLASH_ERASE_END,
+  FLASH_PROGRAM_BEGIN,
+  FLASH_PROGRAM_END,
+};
+
+struct Record {
+  uint32_t time_us;
+  // Bits 0-6 the EventType, bit 7 the core, bits 8-31 the argument
+  uint32_t info;
+};
+static_assert(sizeof(Record) == 8, "Record is part of the dump format");
+
+// Task and semaphore handles are identified by the low 24 bits of their
+// address, which covers the whole SRAM
+inline uint32_t HandleId(const void* handle) {
+  return (uint32_t)(uintptr_t)handle & 0xffffff;
+}
+
+#if CONFIG_DEBUG_TRACE
+
+void RecordEvent(EventType type, uint32_t arg);
+
+// Owner of the dump, as the debug CDC port and raw HID are read from different
+// tasks and only one dump can be read at a time
+enum DumpReader : uint8_t {
+  NO_READER = 0,
+  CDC_READER,
+  RAW_HID_READER,
+};
+
+// Takes the task names for the dump again if the number of tasks changed.
+// Called from the slow output task, so that the readers don't stall the
+// scheduler.
+void UpdateTaskNames();
+
+// Stops the recording for `reader`, with the task names of the last
+// UpdateTaskNames(). Returns the size of the dump, or 0 while another reader's
+// dump is being read. The same reader can start over. Doesn't allocate.
+size_t PrepareDump(DumpReader reader);
+// Points `data` at the dump bytes from `offset` on and returns how many are
+// contiguous, 0 past the end. Only for the reader that prepared the dump.
+size_t GetDumpData(size_t offset, const uint8_t** data);
+// Restarts the recording if `reader` owns the dump
+void FinishDump(DumpReader reader);
+
+#endif /* CONFIG_DEBUG_TRACE */
+
+}  // namespace trace
+
+// Compiled out along with its arguments if CONFIG_DEBUG_TRACE is disabled
+#if CONFIG_DEBUG_TRACE
+#define TRACE_EVENT(type, arg) trace::RecordEvent(trace::type, (arg))
+#else
+#define TRACE_EVENT(type, arg) ((void)0)
+#endif /* CONFIG_DEBUG_TRACE */
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,93 @@
+#ifndef TRIPLE_BUFFER_H_
+#define TRIPLE_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+
+// Lock free handoff of the latest value from one producer task to one
+// consumer task. The producer fills the write buffer and publishes it, the
+// consumer always reads the most recently published buffer. Neither side ever
+// waits for the other, and a value that is overwritten before the consumer
+// gets to it is simply skipped.
+//
+// Only atomic loads and stores are used, since the Cortex-M0+ has no
+// exclusive access instructions for read-modify-write atomics.
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() : TripleBuffer(T()) {}
+  explicit TripleBuffer(const T& initial)
+      : buffers_{{initial, initial, initial}},
+        latest_(0),
+        reading_(0),
+        write_idx_(1),
+        read_sequence_(0) {}
+
+  // Producer side. The content of the write buffer is whatever was published
+  // from it two swaps ago, not the last published value.
+  T& WriteBuffer() { return buffers_[write_idx_]; }
+
+  // Producer side. The value published by the last Publish() call. The
+  // consumer may be reading it at the same time, so it can't be modified.
+  const T& Published() const {
+    return buffers_[latest_.load(std::memory_order_relaxed) & kIndexMask];
+  }
+
+  // Producer side. Makes the write buffer the latest value, and switches to a
+  // buffer that is neither the latest nor being read.
+  void Publish() {
+    const uint32_t sequence =
+        (latest_.load(std::memory_order_relaxed) >> kSequenceShift) + 1;
+    latest_.store((sequence << kSequenceShift) | write_idx_);
+    const uint8_t reading = reading_.load();
+    for (uint8_t i = 0; i < 3; ++i) {
+      if (i != write_idx_ && i != reading) {
+        write_idx_ = i;
+        break;
+      }
+    }
+  }
+
+  // Consumer side. Returns the latest published value, which stays valid
+  // until the next Read(). `is_new` is set if something was published since
+  // the previous Read().
+  const T& Read(bool* is_new = NULL) {
+    uint32_t latest = latest_.load();
+    while (true) {
+      // Claim the buffer, then make sure the producer hasn't moved on and
+      // possibly started writing into it before seeing the claim.
+      reading_.store(latest & kIndexMask);
+      const uint32_t check = latest_.load();
+      if (check == latest) {
+        break;
+      }
+      latest = check;
+    }
+    const uint32_t sequence = latest >> kSequenceShift;
+    if (is_new != NULL) {
+      *is_new = sequence != read_sequence_;
+    }
+    read_sequence_ = sequence;
+    return buffers_[latest & kIndexMask];
+  }
+
+ private:
+  static constexpr uint32_t kSequenceShift = 2;
+  static constexpr uint32_t kIndexMask = (1 << kSequenceShift) - 1;
+
+  std::array<T, 3> buffers_;
+  // Index of the latest published buffer, and the publish count above it
+  std::atomic<uint32_t> latest_;
+  // Index of the buffer claimed by the consumer
+  std::atomic<uint8_t> reading_;
+
+  // Only accessed by the producer
+  uint8_t write_idx_;
+  // Only accessed by the consumer
+  uint32_t read_sequence_;
+};
+
+#endif /* TRIPLE_BUFFER_H_ */
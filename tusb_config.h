@@ -68,9 +68,10 @@
   #error "Incorrect RHPort configuration"
 #endif
 
-#ifndef CFG_TUSB_OS
-#define CFG_TUSB_OS               OPT_OS_NONE
-#endif
+// Let tud_task() block on a FreeRTOS queue until the USB interrupt posts an
+// event, instead of polling. pico-sdk defines CFG_TUSB_OS on the command line.
+#undef CFG_TUSB_OS
+#define CFG_TUSB_OS               OPT_OS_FREERTOS
 
 // CFG_TUSB_DEBUG is defined by compiler in DEBUG build
 // #define CFG_TUSB_DEBUG           0
@@ -99,9 +100,9 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID               3  // We have two HID interface
+#define CFG_TUD_HID               4  // Keyboard, mouse, consumer and raw HID
 #define CFG_TUD_CDC               1
-#define CFG_TUD_MSC               1
+#define CFG_TUD_MSC               CONFIG_USB_MASS_STORAGE
 #define CFG_TUD_MIDI              0
 #define CFG_TUD_VENDOR            0
 
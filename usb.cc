@@ -1,16 +1,25 @@
 #include "usb.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <vector>
 
 #include "FreeRTOS.h"
 #include "config.h"
+#include "device/usbd_pvt.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
 #include "pico/stdio.h"
 #include "pico/stdio/driver.h"
+#include "runner.h"
 #include "semphr.h"
 #include "task.h"
+#include "telemetry.h"
 #include "timers.h"
+#include "trace.h"
 #include "tusb.h"
 #include "utils.h"
 
@@ -88,9 +97,89 @@ uint8_t const desc_hid_keyboard_report[] = {
     HID_OUTPUT(HID_CONSTANT),  //
     HID_COLLECTION_END};
 
-// Use the standard mouse report descriptor.
-uint8_t const desc_hid_mouse_report[] = {TUD_HID_REPORT_DESC_MOUSE()};
+// Same layout as the standard mouse report, but with 16-bit axes so that fast
+// movements don't have to be split across reports. The boot protocol report
+// is sent instead when the host asks for it.
+uint8_t const desc_hid_mouse_report[] = {
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),      //
+    HID_USAGE(HID_USAGE_DESKTOP_MOUSE),          //
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),  //
+    HID_USAGE(HID_USAGE_DESKTOP_POINTER),        //
+    HID_COLLECTION(HID_COLLECTION_PHYSICAL),     //
+
+    // 5 buttons: left, right, middle, backward, forward
+    HID_USAGE_PAGE(HID_USAGE_PAGE_BUTTON),              //
+    HID_USAGE_MIN(1),                                   //
+    HID_USAGE_MAX(5),                                   //
+    HID_LOGICAL_MIN(0),                                 //
+    HID_LOGICAL_MAX(1),                                 //
+    HID_REPORT_COUNT(5),                                //
+    HID_REPORT_SIZE(1),                                 //
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),  //
+    // 3 bits padding
+    HID_REPORT_COUNT(1),      //
+    HID_REPORT_SIZE(3),       //
+    HID_INPUT(HID_CONSTANT),  //
+
+    // X, Y, 16 bits each
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),             //
+    HID_USAGE(HID_USAGE_DESKTOP_X),                     //
+    HID_USAGE(HID_USAGE_DESKTOP_Y),                     //
+    HID_LOGICAL_MIN_N(INT16_MIN + 1, 2),                //
+    HID_LOGICAL_MAX_N(INT16_MAX, 2),                    //
+    HID_REPORT_COUNT(2),                                //
+    HID_REPORT_SIZE(16),                                //
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE),  //
+
+    // Vertical wheel. The resolution multiplier feature applies to the wheel
+    // in the same logical collection. Once the host sets it to 1, each wheel
+    // count is 1/CONFIG_USB_WHEEL_RESOLUTION_MULTIPLIER of a detent.
+    HID_COLLECTION(HID_COLLECTION_LOGICAL),                   //
+    HID_USAGE(HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER),       //
+    HID_LOGICAL_MIN(0),                                       //
+    HID_LOGICAL_MAX(1),                                       //
+    HID_PHYSICAL_MIN(1),                                      //
+    HID_PHYSICAL_MAX(CONFIG_USB_WHEEL_RESOLUTION_MULTIPLIER),  //
+    HID_REPORT_COUNT(1),                                      //
+    HID_REPORT_SIZE(2),                                       //
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),      //
+    HID_PHYSICAL_MIN(0),                                      //
+    HID_PHYSICAL_MAX(0),                                      //
+    HID_USAGE(HID_USAGE_DESKTOP_WHEEL),                       //
+    HID_LOGICAL_MIN_N(INT16_MIN + 1, 2),                      //
+    HID_LOGICAL_MAX_N(INT16_MAX, 2),                          //
+    HID_REPORT_SIZE(16),                                      //
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE),        //
+    HID_COLLECTION_END,                                       //
+
+    // Horizontal wheel, with its own multiplier
+    HID_COLLECTION(HID_COLLECTION_LOGICAL),                   //
+    HID_USAGE(HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER),       //
+    HID_LOGICAL_MIN(0),                                       //
+    HID_LOGICAL_MAX(1),                                       //
+    HID_PHYSICAL_MIN(1),                                      //
+    HID_PHYSICAL_MAX(CONFIG_USB_WHEEL_RESOLUTION_MULTIPLIER),  //
+    HID_REPORT_SIZE(2),                                       //
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),      //
+    HID_PHYSICAL_MIN(0),                                      //
+    HID_PHYSICAL_MAX(0),                                      //
+    HID_USAGE_PAGE(HID_USAGE_PAGE_CONSUMER),                  //
+    HID_USAGE_N(HID_USAGE_CONSUMER_AC_PAN, 2),                //
+    HID_LOGICAL_MIN_N(INT16_MIN + 1, 2),                      //
+    HID_LOGICAL_MAX_N(INT16_MAX, 2),                          //
+    HID_REPORT_SIZE(16),                                      //
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE),        //
+    HID_COLLECTION_END,                                       //
+
+    // Feature report padding to a whole byte
+    HID_REPORT_SIZE(4),         //
+    HID_FEATURE(HID_CONSTANT),  //
+    HID_COLLECTION_END,         //
+    HID_COLLECTION_END};
 uint8_t const desc_hid_consumer_report[] = {TUD_HID_REPORT_DESC_CONSUMER()};
+// Vendor defined reports for the config protocol, see raw_hid.h
+uint8_t const desc_hid_raw_report[] = {
+    TUD_HID_REPORT_DESC_GENERIC_INOUT(CFG_TUD_HID_EP_BUFSIZE)};
 
 // Configuration descripter and all the interface, HID, endpoint descriptors.
 // This is required by the USB protocol that all the
@@ -98,13 +187,22 @@ uint8_t const desc_hid_consumer_report[] = {TUD_HID_REPORT_DESC_CONSUMER()};
 #define ENDPOINT_IN_ADDR(ENDPOINT) (0x80 | (((ENDPOINT) + 1) & 0x7))
 #define ENDPOINT_OUT_ADDR(ENDPOINT) (((ENDPOINT) + 1) & 0x7)
 
+#if CONFIG_USB_MASS_STORAGE
+#define DESC_MSC_LEN TUD_MSC_DESC_LEN
+#else
+#define DESC_MSC_LEN 0
+#endif /* CONFIG_USB_MASS_STORAGE */
+
 #if CONFIG_DEBUG_ENABLE_USB_SERIAL
-#define DESC_CONFIG_TOTAL_LEN \
-  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN * 3 + TUD_CDC_DESC_LEN)
+#define DESC_CDC_LEN TUD_CDC_DESC_LEN
 #else
-#define DESC_CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN * 3)
+#define DESC_CDC_LEN 0
 #endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
 
+#define DESC_CONFIG_TOTAL_LEN                                           \
+  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN * 3 + TUD_HID_INOUT_DESC_LEN + \
+   DESC_MSC_LEN + DESC_CDC_LEN)
+
 uint8_t const desc_configuration[] = {
     TUD_CONFIG_DESCRIPTOR(1,                      // bConfigurationValue
                           ITF_TOTAL,              // bNumInterfaces
@@ -134,10 +232,26 @@ uint8_t const desc_configuration[] = {
                        ENDPOINT_IN_ADDR(ITF_CONSUMER),    // Endpoint address
                        CFG_TUD_HID_EP_BUFSIZE,  // Endpoint buffer size
                        CONFIG_USB_POLL_MS),     // Pulling interval
+    TUD_HID_INOUT_DESCRIPTOR(ITF_RAW_HID,            // bInterfaceNumber
+                             7,                      // iInterface (string idx)
+                             HID_ITF_PROTOCOL_NONE,  // Non boot
+                             sizeof(desc_hid_raw_report),    // Raw HID size
+                             ENDPOINT_OUT_ADDR(ITF_RAW_HID),  // Out endpoint
+                             ENDPOINT_IN_ADDR(ITF_RAW_HID),   // In endpoint
+                             CFG_TUD_HID_EP_BUFSIZE,  // Endpoint buffer size
+                             CONFIG_USB_POLL_MS),     // Pulling interval
+
+#if CONFIG_USB_MASS_STORAGE
+    TUD_MSC_DESCRIPTOR(ITF_MSC,                     // bInterfaceNumber
+                       9,                           // iInterface (string idx)
+                       ENDPOINT_OUT_ADDR(ITF_MSC),  // Out endpoint
+                       ENDPOINT_IN_ADDR(ITF_MSC),   // In endpoint
+                       64),                         // Full speed bulk size
+#endif /* CONFIG_USB_MASS_STORAGE */
 
 #if CONFIG_DEBUG_ENABLE_USB_SERIAL
     TUD_CDC_DESCRIPTOR(ITF_CDC_CTRL,  // bInterfaceNumber
-                       7,             // iInterface (string idx)
+                       8,             // iInterface (string idx)
                        ENDPOINT_IN_ADDR(ITF_CDC_CTRL),  // Notification endpoint
                        CONFIG_DEBUG_USB_SERIAL_CDC_CMD_MAX_SIZE,  // Buffer size
                        ENDPOINT_OUT_ADDR(ITF_CDC_DATA),  // Avoid conflict
@@ -154,7 +268,9 @@ char const *string_desc_arr[] = {
     "Keyboard",               // 4: Keyboard interface
     "Mouse",                  // 5: Mouse interface
     "Consumer",               // 6: Consumer interface
-    "Serial",                 // 7: CDC interface
+    "Config",                 // 7: Raw HID interface
+    "Serial",                 // 8: CDC interface
+    "Storage",                // 9: MSC interface
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -176,6 +292,8 @@ uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance) {
       return desc_hid_mouse_report;
     case ITF_CONSUMER:
       return desc_hid_consumer_report;
+    case ITF_RAW_HID:
+      return desc_hid_raw_report;
     default:
       // Shouldn't reach here, unless something is horribly wrong.
       return NULL;
@@ -221,28 +339,73 @@ uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
 
 // Request callbacks
 
+// USB outputs that need callbacks from the USB task. Only modified while the
+// devices are created, before the USB task starts.
+static std::vector<USBOutputAddIn *> usb_outputs;
+
 extern "C" uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
                                           hid_report_type_t report_type,
                                           uint8_t *buffer, uint16_t reqlen) {
+  for (auto *output : usb_outputs) {
+    if (output->GetInterface() == instance) {
+      return output->GetReport(report_type, buffer, reqlen);
+    }
+  }
+  // Stall the request
   return 0;
 }
 
 extern "C" void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                                       hid_report_type_t report_type,
                                       uint8_t const *buffer, uint16_t bufsize) {
+  for (auto *output : usb_outputs) {
+    if (output->GetInterface() == instance) {
+      output->SetReport(report_type, buffer, bufsize);
+    }
+  }
+}
+
+extern "C" void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol) {
+  for (auto *output : usb_outputs) {
+    if (output->GetInterface() == instance) {
+      output->SetBoot(protocol == HID_PROTOCOL_BOOT);
+    }
+  }
 }
 
-extern "C" void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol) {}
+extern "C" void tud_hid_report_complete_cb(uint8_t instance,
+                                           uint8_t const *report,
+                                           HIDReportCompleteLength len) {
+  for (auto *output : usb_outputs) {
+    output->ReportComplete(instance);
+  }
+}
 
 extern "C" bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate) {
+  for (auto *output : usb_outputs) {
+    if (output->GetInterface() == instance) {
+      output->SetIdle(idle_rate);
+      return true;
+    }
+  }
+  // Stall the request
   return false;
 }
 
-extern "C" void tud_hid_report_complete_cb(uint8_t instance,
-                                           uint8_t const *report, uint8_t len) {
+#if CONFIG_USB_SOF_SYNC
+extern "C" void tud_sof_cb(uint32_t frame_count) {
+  (void)frame_count;
+  for (auto *output : usb_outputs) {
+    output->StartOfFrame();
+  }
 }
+#endif /* CONFIG_USB_SOF_SYNC */
 
-extern "C" void tud_mount_cb(void) {}
+extern "C" void tud_mount_cb(void) {
+  for (auto *output : usb_outputs) {
+    output->Mount();
+  }
+}
 
 extern "C" void tud_umount_cb(void) {}
 
@@ -252,43 +415,139 @@ extern "C" void tud_resume_cb(void) {}
 
 extern "C" void USBTask(void *parameter);
 
-// Semaphore for data accessed between USB task and other tasks. Should not be
-// used between callbacks.
-static SemaphoreHandle_t semaphore = NULL;
-
 #if CONFIG_DEBUG_ENABLE_USB_SERIAL
 
-extern "C" {
-static void stdio_usb_out_chars(const char *buf, int length) {
-  static uint64_t last_avail_time;
-
-  LockSemaphore lock(semaphore);
-
-  if (tud_cdc_connected()) {
-    for (int i = 0; i < length;) {
-      int n = length - i;
-      int avail = (int)tud_cdc_write_available();
-      if (n > avail) n = avail;
-      if (n) {
-        int n2 = (int)tud_cdc_write(buf + i, (uint32_t)n);
-        tud_cdc_write_flush();
-        i += n2;
-        last_avail_time = time_us_64();
-      } else {
-        tud_cdc_write_flush();
-        if (!tud_cdc_connected() ||
-            (!tud_cdc_write_available() &&
-             time_us_64() > last_avail_time + CONFIG_DEBUG_USB_TIMEOUT_US)) {
-          break;
-        }
-      }
+// Log output waiting to be sent over CDC. Tasks on both cores append to it and
+// the USB task drains it when the CDC FIFO has room, so logging never waits
+// for the host. A hardware spin lock serializes the producers as the M0+ has
+// no compare and swap, and it only covers the copy. The consumer doesn't take
+// it.
+static std::array<char, CONFIG_DEBUG_USB_LOG_BUFFER_SIZE> log_buffer;
+static_assert((CONFIG_DEBUG_USB_LOG_BUFFER_SIZE &
+               (CONFIG_DEBUG_USB_LOG_BUFFER_SIZE - 1)) == 0,
+              "CONFIG_DEBUG_USB_LOG_BUFFER_SIZE must be a power of two");
+static spin_lock_t *log_lock = NULL;
+// Only written by the producers, holding log_lock
+static std::atomic<uint32_t> log_tail(0);
+static std::atomic<uint32_t> log_dropped_bytes(0);
+static std::atomic<uint32_t> log_dropped_writes(0);
+// A DrainLog() call is queued for the USB task. Set by the producers holding
+// log_lock, cleared by the USB task.
+static std::atomic<bool> log_drain_pending(false);
+// Set once tusb_init() returned. Logs before that are discarded, as they were
+// when the stdio driver wasn't enabled yet.
+static std::atomic<bool> log_started(false);
+// Only written by the USB task
+static std::atomic<uint32_t> log_head(0);
+static uint32_t log_reported_dropped_bytes = 0;
+
+#if CONFIG_DEBUG_TRACE
+// Trace dump being sent in place of the logs, see trace.h. Only accessed by
+// the USB task.
+static size_t trace_dump_size = 0;
+static size_t trace_dump_offset = 0;
+
+// Returns whether the dump is done. Logs queued in the meantime are sent after
+// it, so that they don't end up in the middle of the dump.
+static bool SendTraceDump() {
+  const uint8_t *data;
+  size_t length;
+  while (trace_dump_offset < trace_dump_size &&
+         (length = std::min<size_t>(
+              trace::GetDumpData(trace_dump_offset, &data),
+              tud_cdc_write_available())) > 0) {
+    trace_dump_offset += tud_cdc_write(data, length);
+  }
+  if (trace_dump_offset < trace_dump_size) {
+    return false;
+  }
+  trace::FinishDump(trace::CDC_READER);
+  trace_dump_size = 0;
+  return true;
+}
+#endif /* CONFIG_DEBUG_TRACE */
+
+// Runs in the USB task. Sends as much of the buffer as the CDC FIFO takes, the
+// rest is sent from tud_cdc_tx_complete_cb().
+static void DrainLog(void *param) {
+  (void)param;
+  // Kept until a terminal opens the port, see tud_cdc_line_state_cb(). No
+  // need to queue more calls until then.
+  if (!tud_cdc_connected()) {
+    return;
+  }
+  // Cleared first so that anything logged from now on queues another call
+  log_drain_pending = false;
+
+#if CONFIG_DEBUG_TRACE
+  if (trace_dump_size > 0 && !SendTraceDump()) {
+    tud_cdc_write_flush();
+    return;
+  }
+#endif /* CONFIG_DEBUG_TRACE */
+
+  uint32_t head = log_head.load(std::memory_order_relaxed);
+  const uint32_t tail = log_tail.load(std::memory_order_acquire);
+  while (head != tail) {
+    const uint32_t offset = head % log_buffer.size();
+    const uint32_t length = std::min<uint32_t>(
+        {tail - head, (uint32_t)log_buffer.size() - offset,
+         tud_cdc_write_available()});
+    if (length == 0) {
+      break;
+    }
+    head += tud_cdc_write(&log_buffer[offset], length);
+  }
+  log_head.store(head, std::memory_order_release);
+
+  const uint32_t dropped_bytes = log_dropped_bytes;
+  if (head == tail && dropped_bytes != log_reported_dropped_bytes) {
+    char note[48];
+    const int length =
+        snprintf(note, sizeof(note), "W usb.cc: %u log bytes dropped\n",
+                 (unsigned)(dropped_bytes - log_reported_dropped_bytes));
+    if (length > 0 && (uint32_t)length <= tud_cdc_write_available()) {
+      tud_cdc_write(note, length);
+      log_reported_dropped_bytes = dropped_bytes;
     }
+  }
+  tud_cdc_write_flush();
+}
+
+void USBLogWrite(const char *buf, size_t length) {
+  if (!log_started) {
+    return;
+  }
+  const uint32_t irq_state = spin_lock_blocking(log_lock);
+  const uint32_t tail = log_tail.load(std::memory_order_relaxed);
+  const uint32_t free_size =
+      log_buffer.size() - (tail - log_head.load(std::memory_order_acquire));
+  if (length > free_size) {
+    // Dropped whole so that lines and records aren't cut
+    log_dropped_bytes.store(log_dropped_bytes + length);
+    log_dropped_writes.store(log_dropped_writes + 1);
   } else {
-    // reset our timeout
-    last_avail_time = 0;
+    const uint32_t offset = tail % log_buffer.size();
+    const uint32_t first =
+        std::min<uint32_t>(length, log_buffer.size() - offset);
+    memcpy(&log_buffer[offset], buf, first);
+    memcpy(&log_buffer[0], buf + first, length - first);
+    log_tail.store(tail + length, std::memory_order_release);
+  }
+  const bool queue_drain = !log_drain_pending;
+  log_drain_pending = true;
+  spin_unlock(log_lock, irq_state);
+
+  if (queue_drain) {
+    usbd_defer_func(&DrainLog, NULL, /*in_isr=*/false);
   }
 }
 
+extern "C" {
+static void stdio_usb_out_chars(const char *buf, int length) {
+  USBLogWrite(buf, length);
+}
+
 stdio_driver_t stdio_usb = {
     .out_chars = stdio_usb_out_chars,
     .in_chars = NULL,
@@ -298,11 +557,81 @@ stdio_driver_t stdio_usb = {
 };
 }
 
+extern "C" void tud_cdc_tx_complete_cb(uint8_t itf) {
+  (void)itf;
+  DrainLog(NULL);
+}
+
+extern "C" void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts) {
+  (void)itf;
+  (void)rts;
+  if (dtr) {
+    DrainLog(NULL);
+  }
+}
+
+// Commands typed on the debug port, one per line:
+//   tasks  Prints the task telemetry, see telemetry.h
+//   reset  Clears the iteration stats of the tasks
+//   trace  Sends the binary trace dump, see trace.h
+static std::array<char, 16> command_buffer;
+static size_t command_length = 0;
+
+static void RunCommand(const char *command) {
+  if (strcmp(command, "tasks") == 0) {
+    telemetry::PrintTaskStats();
+  } else if (strcmp(command, "reset") == 0) {
+    telemetry::ResetTaskStats();
+#if CONFIG_DEBUG_TRACE
+  } else if (strcmp(command, "trace") == 0) {
+    if (trace_dump_size == 0) {
+      trace_dump_size = trace::PrepareDump(trace::CDC_READER);
+      trace_dump_offset = 0;
+      if (trace_dump_size == 0) {
+        printf("Trace dump busy\n");
+      }
+      DrainLog(NULL);
+    }
+#endif /* CONFIG_DEBUG_TRACE */
+  } else {
+    printf("Unknown command %s\n", command);
+  }
+}
+
+// Runs in the USB task
+extern "C" void tud_cdc_rx_cb(uint8_t itf) {
+  (void)itf;
+  char buffer[16];
+  uint32_t count;
+  while ((count = tud_cdc_read(buffer, sizeof(buffer))) > 0) {
+    for (uint32_t i = 0; i < count; ++i) {
+      if (buffer[i] != '\r' && buffer[i] != '\n') {
+        // Longer lines are cut and end up as an unknown command
+        if (command_length + 1 < command_buffer.size()) {
+          command_buffer[command_length++] = buffer[i];
+        }
+        continue;
+      }
+      if (command_length > 0) {
+        command_buffer[command_length] = '\0';
+        RunCommand(command_buffer.data());
+        command_length = 0;
+      }
+    }
+  }
+}
+
+USBLogStats GetUSBLogStats() {
+  return USBLogStats{.dropped_bytes = log_dropped_bytes,
+                     .dropped_writes = log_dropped_writes};
+}
+
 #endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
 
 status USBInit() {
-  semaphore = xSemaphoreCreateBinary();
-  xSemaphoreGive(semaphore);
+#if CONFIG_DEBUG_ENABLE_USB_SERIAL
+  log_lock = spin_lock_instance(spin_lock_claim_unused(/*required=*/true));
+#endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
   return OK;
 }
 
@@ -318,6 +647,8 @@ status StartUSBTask() {
   if (status != pdPASS || usb_task_handle == NULL) {
     return ERROR;
   }
+  telemetry::RegisterTask(telemetry::USB_TASK, usb_task_handle,
+                          /*period_us=*/0);
   return OK;
 }
 
@@ -326,18 +657,30 @@ extern "C" void USBTask(void *parameter) {
 
   tusb_init();
 
+#if CONFIG_USB_SOF_SYNC
+  tud_sof_cb_enable(true);
+#endif /* CONFIG_USB_SOF_SYNC */
+
 #if CONFIG_DEBUG_ENABLE_USB_SERIAL
+  log_started = true;
   stdio_set_driver_enabled(&stdio_usb, true);
 #endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
 
   while (true) {
+    // Blocks until the USB interrupt posts an event
     tud_task();
   }
 }
 
-USBOutputAddIn::USBOutputAddIn() {
+USBOutputAddIn::USBOutputAddIn(uint8_t itf)
+    : itf_(itf),
+      idle_rate_(0),
+      is_boot_protocol_(false),
+      last_report_us_(0),
+      report_pending_(false) {
   semaphore_ = xSemaphoreCreateBinary();
   xSemaphoreGive(semaphore_);
+  usb_outputs.push_back(this);
 }
 
 void USBOutputAddIn::SetIdle(uint8_t idle_rate) {
@@ -350,6 +693,16 @@ void USBOutputAddIn::SetBoot(bool is_boot_protocol) {
   is_boot_protocol_ = is_boot_protocol;
 }
 
+void USBOutputAddIn::Mount() {
+  // The protocol goes back to report protocol when the host enumerates again
+  SetBoot(false);
+}
+
+bool USBOutputAddIn::IdleExpired() const {
+  return idle_rate_ != 0 &&
+         time_us_64() - last_report_us_ >= (uint64_t)idle_rate_ * 4000;
+}
+
 std::shared_ptr<USBKeyboardOutput> USBKeyboardOutput::GetUSBKeyboardOutput() {
   static std::shared_ptr<USBKeyboardOutput> singleton = NULL;
   if (singleton == NULL) {
@@ -362,62 +715,181 @@ void USBKeyboardOutput::OutputTick() {
   LockSemaphore lock(semaphore_);
   if (is_config_mode_) {
     // Don't report key strokes to host if in config mode
+    while (reports_.Front() != NULL) {
+      reports_.Pop();
+    }
     return;
   }
-  if (!tud_hid_n_ready(ITF_KEYBOARD)) {
-    return;
-  }
+#if CONFIG_USB_SOF_SYNC
+  // There's no start of frame while suspended, so wake up the host from here
   if (tud_suspended() && has_key_output_) {
     tud_remote_wakeup();
   }
-  auto &buffer = double_buffer_[active_buffer_];
-  tud_hid_n_report(ITF_KEYBOARD, /*report_id=*/0, buffer.data(), buffer.size());
-  tud_hid_n_report(ITF_CONSUMER, /*report_id=*/0, &consumer_keycode_, 2);
+#else
+  SendNextReport();
+#endif /* CONFIG_USB_SOF_SYNC */
 }
 
-void USBKeyboardOutput::SetConfigMode(bool is_config_mode) {
+void USBKeyboardOutput::StartOfFrame() {
   LockSemaphore lock(semaphore_);
-  is_config_mode_ = is_config_mode;
+  if (!is_config_mode_) {
+    SendNextReport();
+  }
 }
 
-void USBKeyboardOutput::StartOfInputTick() {
-  // No need to lock as Tick() does not modify reads active_buffer_.
-  const uint8_t buf_idx = (active_buffer_ + 1) % 2;
-  std::fill(double_buffer_[buf_idx].begin(), double_buffer_[buf_idx].end(), 0);
+void USBKeyboardOutput::ReportComplete(uint8_t instance) {
+  if (instance != ITF_KEYBOARD && instance != ITF_CONSUMER) {
+    return;
+  }
+  // Drain the queue as fast as the host polls
   LockSemaphore lock(semaphore_);
-  consumer_keycode_ = 0;
+  if (!is_config_mode_) {
+    SendNextReport();
+  }
+}
+
+void USBKeyboardOutput::SendNextReport() {
+  if (!tud_hid_n_ready(ITF_KEYBOARD) || !tud_hid_n_ready(ITF_CONSUMER)) {
+    return;
+  }
+  for (const Report *next = reports_.Front(); next != NULL;
+       next = reports_.Front()) {
+    current_ = *next;
+    reports_.Pop();
+    if (SendReport(/*force=*/false)) {
+      return;
+    }
+  }
+  if (IdleExpired()) {
+    SendReport(/*force=*/true);
+  }
+}
+
+bool USBKeyboardOutput::SendReport(bool force) {
+  bool sent = false;
+  if (force || current_.keys != last_sent_.keys) {
+    if (tud_suspended() && has_key_output_) {
+      tud_remote_wakeup();
+    }
+    tud_hid_n_report(ITF_KEYBOARD, /*report_id=*/0, current_.keys.data(),
+                     current_.keys.size());
+    sent = true;
+  }
+  if (force || current_.consumer_keycode != last_sent_.consumer_keycode) {
+    tud_hid_n_report(ITF_CONSUMER, /*report_id=*/0, &current_.consumer_keycode,
+                     2);
+    sent = true;
+  }
+  if (sent) {
+    last_sent_ = current_;
+    last_report_us_ = time_us_64();
+  }
+  return sent;
+}
+
+USBKeyboardOutput::ReportQueueStats USBKeyboardOutput::GetReportQueueStats()
+    const {
+  return {.queued = num_queued_,
+          .coalesced = num_coalesced_,
+          .overflowed = num_overflowed_};
 }
 
+void USBKeyboardOutput::SetConfigMode(bool is_config_mode) {
+  is_config_mode_ = is_config_mode;
+}
+
+void USBKeyboardOutput::StartOfInputTick() { consumer_keycode_ = 0; }
+
 void USBKeyboardOutput::FinalizeInputTickOutput() {
-  LockSemaphore lock(semaphore_);
-  active_buffer_ = (active_buffer_ + 1) % 2;
-  has_key_output_ = boot_protocol_kc_count_ > 0;
-  boot_protocol_kc_count_ = 0;
+  // The key state is kept across ticks, so a report only needs to be queued
+  // when it changed.
+  if (keys_changed_) {
+    UpdateBootProtocolKeys(&keys_);
+    queue_pending_ = true;
+    keys_changed_ = false;
+  }
+  if (consumer_keycode_ != last_queued_.consumer_keycode) {
+    queue_pending_ = true;
+  }
+  has_key_output_ = num_pressed_keys_ > 0;
+  if (!queue_pending_) {
+    return;
+  }
+
+  if (keys_ == last_queued_.keys &&
+      consumer_keycode_ == last_queued_.consumer_keycode) {
+    // E.g. a key was pressed and released between two ticks
+    num_coalesced_ = num_coalesced_ + 1;
+    queue_pending_ = false;
+    return;
+  }
+  Report *report = reports_.Back();
+  if (report == NULL) {
+    // Try again next tick with whatever the state is by then
+    num_overflowed_ = num_overflowed_ + 1;
+    return;
+  }
+  report->keys = keys_;
+  report->consumer_keycode = consumer_keycode_;
+  last_queued_ = *report;
+  reports_.Push();
+  num_queued_ = num_queued_ + 1;
+  queue_pending_ = false;
 }
 
-void USBKeyboardOutput::SendKeycode(uint8_t keycode) {
-  auto &buffer = double_buffer_[(active_buffer_ + 1) % 2];
-  buffer[keycode / 8 + 8] |= (1 << (keycode % 8));
-  if (boot_protocol_kc_count_ < 6) {
-    buffer[2 + (boot_protocol_kc_count_)++] = keycode;
-  } else if (buffer[2] != 0x01) {
-    for (size_t i = 2; i < 8; ++i) {
-      buffer[i] = 0x01;  // ErrorRollOver
+void USBKeyboardOutput::ProcessKeyEvents(const KeyEvent *events, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    const uint8_t keycode = events[i].keycode;
+    if (events[i].pressed) {
+      if (key_counts_[keycode]++ == 0) {
+        keys_[keycode / 8 + 8] |= (1 << (keycode % 8));
+        ++num_pressed_keys_;
+      }
+    } else if (key_counts_[keycode] > 0 && --key_counts_[keycode] == 0) {
+      keys_[keycode / 8 + 8] &= ~(1 << (keycode % 8));
+      --num_pressed_keys_;
     }
   }
+  keys_changed_ = true;
 }
 
-void USBKeyboardOutput::SendKeycode(const std::vector<uint8_t> &keycode) {
-  for (auto code : keycode) {
-    SendKeycode(code);
+void USBKeyboardOutput::UpdateBootProtocolKeys(
+    std::array<uint8_t, 8 + 256 / 8> *buffer) {
+  if (num_pressed_keys_ > 6) {
+    for (size_t i = 2; i < 8; ++i) {
+      (*buffer)[i] = 0x01;  // ErrorRollOver
+    }
+    return;
+  }
+  size_t count = 0;
+  for (size_t byte = 8; byte < buffer->size() && count < 6; ++byte) {
+    const uint8_t bits = (*buffer)[byte];
+    for (uint8_t bit = 0; bits != 0 && bit < 8 && count < 6; ++bit) {
+      if (bits & (1 << bit)) {
+        (*buffer)[2 + count++] = (byte - 8) * 8 + bit;
+      }
+    }
+  }
+  for (size_t i = 2 + count; i < 8; ++i) {
+    (*buffer)[i] = 0;
   }
 }
 
 void USBKeyboardOutput::SendConsumerKeycode(uint16_t keycode) {
-  LockSemaphore lock(semaphore_);
   consumer_keycode_ = keycode;
 }
 
+void USBKeyboardOutput::SetReport(hid_report_type_t report_type,
+                                  const uint8_t *buffer, uint16_t bufsize) {
+  if (report_type != HID_REPORT_TYPE_OUTPUT || bufsize < 1) {
+    return;
+  }
+  // Same single byte in boot and report protocol
+  runner::SetHostLEDState(buffer[0] & (HOST_LED_NUM_LOCK | HOST_LED_CAPS_LOCK |
+                                       HOST_LED_SCROLL_LOCK | HOST_LED_COMPOSE |
+                                       HOST_LED_KANA));
+}
+
 std::shared_ptr<USBMouseOutput> USBMouseOutput::GetUSBMouseOutput() {
   static std::shared_ptr<USBMouseOutput> singleton = NULL;
   if (singleton == NULL) {
@@ -427,39 +899,139 @@ std::shared_ptr<USBMouseOutput> USBMouseOutput::GetUSBMouseOutput() {
 }
 
 USBKeyboardOutput::USBKeyboardOutput()
-    : USBOutputAddIn(),
-      active_buffer_(0),
-      boot_protocol_kc_count_(0),
+    : USBOutputAddIn(ITF_KEYBOARD),
+      current_(Report{.keys = {0}, .consumer_keycode = 0}),
+      last_sent_(Report{.keys = {0}, .consumer_keycode = 0}),
+      num_pressed_keys_(0),
+      keys_changed_(false),
+      consumer_keycode_(0),
+      last_queued_(Report{.keys = {0}, .consumer_keycode = 0}),
+      queue_pending_(false),
+      num_queued_(0),
+      num_coalesced_(0),
+      num_overflowed_(0),
       is_config_mode_(false),
-      has_key_output_(false) {}
+      has_key_output_(false) {
+  keys_.fill(0);
+  key_counts_.fill(0);
+}
 
 void USBMouseOutput::OutputTick() {
+#if !CONFIG_USB_SOF_SYNC
+  SendNextReport();
+#endif /* CONFIG_USB_SOF_SYNC */
+}
+
+void USBMouseOutput::StartOfFrame() { SendNextReport(); }
+
+void USBMouseOutput::SendNextReport() {
   LockSemaphore lock(semaphore_);
+  const Report &report = reports_.Read();
   if (is_config_mode_) {
-    // Don't report key strokes to host if in config mode
+    // Don't report mouse movements to host if in config mode
+    sent_totals_ = report.totals;
+    return;
+  }
+  SendReport(report);
+}
+
+void USBMouseOutput::SendReport(const Report &report) {
+  const bool is_boot_protocol = is_boot_protocol_;
+  const int32_t limit = is_boot_protocol ? INT8_MAX : INT16_MAX;
+  const uint8_t high_res_wheels = high_res_wheels_;
+  // Fixed point value of one count in the report
+  std::array<int32_t, NUM_AXES> units;
+  units.fill(kMouseUnit);
+  if (high_res_wheels & HIGH_RES_WHEEL) {
+    units[AXIS_WHEEL] = kWheelHighResUnit;
+  }
+  if (high_res_wheels & HIGH_RES_PAN) {
+    units[AXIS_PAN] = kWheelHighResUnit;
+  }
+  std::array<int32_t, NUM_AXES> deltas;
+  bool has_motion = false;
+  for (size_t i = 0; i < NUM_AXES; ++i) {
+    // Whole counts not sent yet. The fraction stays in the totals.
+    const int32_t delta =
+        (int32_t)(report.totals[i] - sent_totals_[i]) / units[i];
+    deltas[i] = std::clamp(delta, -limit, limit);
+    has_motion |= deltas[i] != 0;
+  }
+  if (is_boot_protocol) {
+    // The boot report has no wheels, drop the scrolling instead of letting it
+    // pile up until the host switches back to report protocol.
+    sent_totals_[AXIS_WHEEL] = report.totals[AXIS_WHEEL];
+    sent_totals_[AXIS_PAN] = report.totals[AXIS_PAN];
+    has_motion = deltas[AXIS_X] != 0 || deltas[AXIS_Y] != 0;
+  }
+
+  // Movement is relative, so a report without motion and with the same
+  // buttons doesn't change anything on host. Sending it anyway would also
+  // reset the pointer acceleration of some hosts.
+  if (!has_motion && report.buttons == last_buttons_ && !IdleExpired()) {
     return;
   }
   if (!tud_hid_n_ready(ITF_MOUSE)) {
     return;
   }
-  auto &buffer = double_buffer_[active_buffer_];
-  tud_hid_n_mouse_report(ITF_MOUSE, /*report_id=*/0, buffer[0], buffer[1],
-                         buffer[2], buffer[3], buffer[4]);
+
+  if (is_boot_protocol) {
+    const int8_t boot_report[3] = {(int8_t)report.buttons,
+                                   (int8_t)deltas[AXIS_X],
+                                   (int8_t)deltas[AXIS_Y]};
+    tud_hid_n_report(ITF_MOUSE, /*report_id=*/0, boot_report,
+                     sizeof(boot_report));
+    deltas[AXIS_WHEEL] = 0;
+    deltas[AXIS_PAN] = 0;
+  } else {
+    const HIDReport hid_report = {
+        .buttons = report.buttons,
+        .x = (int16_t)deltas[AXIS_X],
+        .y = (int16_t)deltas[AXIS_Y],
+        .wheel = (int16_t)deltas[AXIS_WHEEL],
+        .pan = (int16_t)deltas[AXIS_PAN],
+    };
+    tud_hid_n_report(ITF_MOUSE, /*report_id=*/0, &hid_report,
+                     sizeof(hid_report));
+  }
+  for (size_t i = 0; i < NUM_AXES; ++i) {
+    sent_totals_[i] += deltas[i] * units[i];
+  }
+  last_buttons_ = report.buttons;
+  last_report_us_ = time_us_64();
+}
+
+void USBMouseOutput::Mount() {
+  USBOutputAddIn::Mount();
+  high_res_wheels_ = 0;
+}
+
+uint16_t USBMouseOutput::GetReport(hid_report_type_t report_type,
+                                   uint8_t *buffer, uint16_t reqlen) {
+  if (report_type != HID_REPORT_TYPE_FEATURE || reqlen < 1) {
+    return 0;
+  }
+  buffer[0] = high_res_wheels_;
+  return 1;
+}
+
+void USBMouseOutput::SetReport(hid_report_type_t report_type,
+                               const uint8_t *buffer, uint16_t bufsize) {
+  if (report_type != HID_REPORT_TYPE_FEATURE || bufsize < 1) {
+    return;
+  }
+  high_res_wheels_ = buffer[0] & (HIGH_RES_WHEEL | HIGH_RES_PAN);
 }
 
 void USBMouseOutput::SetConfigMode(bool is_config_mode) {
-  LockSemaphore lock(semaphore_);
   is_config_mode_ = is_config_mode;
 }
 
-void USBMouseOutput::StartOfInputTick() {
-  const uint8_t buf_idx = (active_buffer_ + 1) % 2;
-  std::fill(double_buffer_[buf_idx].begin(), double_buffer_[buf_idx].end(), 0);
-}
+void USBMouseOutput::StartOfInputTick() { next_.buttons = 0; }
 
 void USBMouseOutput::FinalizeInputTickOutput() {
-  LockSemaphore lock(semaphore_);
-  active_buffer_ = (active_buffer_ + 1) % 2;
+  reports_.WriteBuffer() = next_;
+  reports_.Publish();
 }
 
 void USBMouseOutput::MouseKeycode(uint8_t keycode) {
@@ -467,21 +1039,27 @@ void USBMouseOutput::MouseKeycode(uint8_t keycode) {
     return;
   }
 
-  double_buffer_[(active_buffer_ + 1) % 2][0] |= (1 << keycode);
+  next_.buttons |= (1 << keycode);
 }
 
-void USBMouseOutput::MouseMovement(int8_t x, int8_t y) {
-  double_buffer_[(active_buffer_ + 1) % 2][1] = x;
-  double_buffer_[(active_buffer_ + 1) % 2][2] = y;
+void USBMouseOutput::MouseMovement(int32_t x, int32_t y) {
+  next_.totals[AXIS_X] += x;
+  next_.totals[AXIS_Y] += y;
 }
 
-void USBMouseOutput::Pan(int8_t x, int8_t y) {
-  double_buffer_[(active_buffer_ + 1) % 2][3] = y;
-  double_buffer_[(active_buffer_ + 1) % 2][4] = x;
+void USBMouseOutput::Pan(int32_t x, int32_t y) {
+  next_.totals[AXIS_WHEEL] += y;
+  next_.totals[AXIS_PAN] += x;
 }
 
 USBMouseOutput::USBMouseOutput()
-    : USBOutputAddIn(), active_buffer_(0), is_config_mode_(false) {}
+    : USBOutputAddIn(ITF_MOUSE),
+      next_(Report{.buttons = 0, .totals = {0}}),
+      reports_(Report{.buttons = 0, .totals = {0}}),
+      sent_totals_({0}),
+      last_buttons_(0),
+      high_res_wheels_(0),
+      is_config_mode_(false) {}
 
 Status RegisterUSBKeyboardOutput(uint8_t tag) {
   return DeviceRegistry::RegisterKeyboardOutputDevice(
@@ -4,33 +4,91 @@
 #include <stdint.h>
 
 #include <array>
+#include <atomic>
 #include <memory>
 
 #include "FreeRTOS.h"
 #include "base.h"
 #include "config.h"
 #include "semphr.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
+#include "tusb.h"
 #include "utils.h"
 
 status USBInit();
 
 status StartUSBTask();
 
+#if CONFIG_DEBUG_ENABLE_USB_SERIAL
+struct USBLogStats {
+  // Log output that didn't fit in CONFIG_DEBUG_USB_LOG_BUFFER_SIZE
+  uint32_t dropped_bytes;
+  uint32_t dropped_writes;
+};
+
+USBLogStats GetUSBLogStats();
+// Queues `buf` to be sent over the CDC interface, or drops it if there's no
+// room. Never waits for the host. Can be called from any task.
+void USBLogWrite(const char* buf, size_t length);
+#endif /* CONFIG_DEBUG_ENABLE_USB_SERIAL */
+
 class USBOutputAddIn {
  public:
-  USBOutputAddIn();
+  // `itf` is the HID interface the idle rate applies to
+  USBOutputAddIn(uint8_t itf);
+
+  uint8_t GetInterface() const { return itf_; }
 
+  // Idle rate in 4 ms units requested by the host. 0 means a report is only
+  // sent when it changes.
   virtual void SetIdle(uint8_t idle_rate);
   virtual void SetBoot(bool is_boot_protocol);
+  // Called from the USB task when the device is configured by the host
+  virtual void Mount();
+
+  // GET_REPORT and SET_REPORT requests from the host. GetReport() returns the
+  // number of bytes written to `buffer`, 0 to stall the request.
+  virtual uint16_t GetReport(hid_report_type_t report_type, uint8_t* buffer,
+                             uint16_t reqlen) {
+    return 0;
+  }
+  virtual void SetReport(hid_report_type_t report_type, const uint8_t* buffer,
+                         uint16_t bufsize) {}
+
+  // Called from the USB task at every start of frame when CONFIG_USB_SOF_SYNC
+  // is enabled. Sends the report published by the last input tick, if any.
+  virtual void StartOfFrame() {}
+  // Called from the USB task when a report on `instance` was delivered
+  virtual void ReportComplete(uint8_t instance) {}
 
  protected:
+  // Whether the unchanged report has to be sent again because of the idle
+  // rate. Must hold semaphore_.
+  bool IdleExpired() const;
+
+  const uint8_t itf_;
   SemaphoreHandle_t semaphore_;
   uint8_t idle_rate_;
   bool is_boot_protocol_;
+  // When the last report was sent. Guarded by semaphore_.
+  uint64_t last_report_us_;
+  // A report was published and hasn't been sent yet. Only accessed by the
+  // task sending the reports.
+  bool report_pending_;
 };
 
 class USBKeyboardOutput : public KeyboardOutputDevice, public USBOutputAddIn {
  public:
+  struct ReportQueueStats {
+    // Reports added to the queue
+    uint32_t queued;
+    // Reports identical to the previously queued one, so not queued
+    uint32_t coalesced;
+    // Ticks where the queue was full and the report had to wait
+    uint32_t overflowed;
+  };
+
   static std::shared_ptr<USBKeyboardOutput> GetUSBKeyboardOutput();
 
   void OutputTick() override;
@@ -39,20 +97,66 @@ class USBKeyboardOutput : public KeyboardOutputDevice, public USBOutputAddIn {
   void StartOfInputTick() override;
   void FinalizeInputTickOutput() override;
 
-  void SendKeycode(uint8_t keycode) override;
-  void SendKeycode(const std::vector<uint8_t>& keycode) override;
+  void ProcessKeyEvents(const KeyEvent* events, size_t num) override;
   void SendConsumerKeycode(uint16_t keycode) override;
   void ChangeActiveLayers(const std::vector<bool>&) override {}
 
+  // Receives the LED output report
+  void SetReport(hid_report_type_t report_type, const uint8_t* buffer,
+                 uint16_t bufsize) override;
+  void StartOfFrame() override;
+  void ReportComplete(uint8_t instance) override;
+
+  ReportQueueStats GetReportQueueStats() const;
+
  protected:
+  struct Report {
+    std::array<uint8_t, 8 + 256 / 8> keys;
+    uint16_t consumer_keycode;
+
+    bool operator==(const Report& other) const {
+      return keys == other.keys && consumer_keycode == other.consumer_keycode;
+    }
+  };
+
   USBKeyboardOutput();
 
-  std::array<std::array<uint8_t, 8 + 256 / 8>, 2> double_buffer_;
-  uint8_t active_buffer_;
-  uint8_t boot_protocol_kc_count_;
+  // Rebuild the 6 key roll over array for boot protocol from the bitmap
+  void UpdateBootProtocolKeys(std::array<uint8_t, 8 + 256 / 8>* buffer);
+
+  // Sends the parts of current_ that differ from what host has, or all of it
+  // if `force`. Both endpoints have to be ready, and must hold semaphore_.
+  // Returns false if nothing had to be sent.
+  bool SendReport(bool force);
+  // Sends the oldest queued report, or repeats the current one if the idle
+  // rate expired. Must hold semaphore_.
+  void SendNextReport();
+
+  // Every distinct report produced by the input task, so that a tap shorter
+  // than the time the endpoint is busy isn't lost.
+  SPSCQueue<Report, CONFIG_USB_REPORT_QUEUE_SIZE> reports_;
+  // Last report taken from the queue, and what host has been sent. Guarded by
+  // semaphore_.
+  Report current_;
+  Report last_sent_;
+
+  // Key state owned by the input task
+  std::array<uint8_t, 8 + 256 / 8> keys_;
+  // Number of pressed switches mapped to each keycode
+  std::array<uint8_t, 256> key_counts_;
+  uint16_t num_pressed_keys_;
+  bool keys_changed_;
   uint16_t consumer_keycode_;
-  bool is_config_mode_;
-  bool has_key_output_;
+  // Last report added to the queue
+  Report last_queued_;
+  // The current state still has to be queued
+  bool queue_pending_;
+  std::atomic<uint32_t> num_queued_;
+  std::atomic<uint32_t> num_coalesced_;
+  std::atomic<uint32_t> num_overflowed_;
+
+  std::atomic<bool> is_config_mode_;
+  std::atomic<bool> has_key_output_;
 };
 
 class USBMouseOutput : public MouseOutputDevice, public USBOutputAddIn {
@@ -66,21 +170,73 @@ class USBMouseOutput : public MouseOutputDevice, public USBOutputAddIn {
   void FinalizeInputTickOutput() override;
 
   void MouseKeycode(uint8_t keycode) override;
-  void MouseMovement(int8_t x, int8_t y) override;
-  void Pan(int8_t x, int8_t y) override;
+  void MouseMovement(int32_t x, int32_t y) override;
+  void Pan(int32_t x, int32_t y) override;
+
+  void StartOfFrame() override;
+  void Mount() override;
+  uint16_t GetReport(hid_report_type_t report_type, uint8_t* buffer,
+                     uint16_t reqlen) override;
+  void SetReport(hid_report_type_t report_type, const uint8_t* buffer,
+                 uint16_t bufsize) override;
 
  protected:
+  enum Axis { AXIS_X = 0, AXIS_Y, AXIS_WHEEL, AXIS_PAN, NUM_AXES };
+
+  // Bits of the resolution multiplier feature report
+  enum HighResWheel : uint8_t { HIGH_RES_WHEEL = 1 << 0, HIGH_RES_PAN = 1 << 2 };
+
+  static_assert(kMouseUnit % CONFIG_USB_WHEEL_RESOLUTION_MULTIPLIER == 0,
+                "The wheel resolution has to divide kMouseUnit");
+  static constexpr int32_t kWheelHighResUnit =
+      kMouseUnit / CONFIG_USB_WHEEL_RESOLUTION_MULTIPLIER;
+
+  struct Report {
+    uint8_t buttons;
+    // Sum of all the movements so far in 1/kMouseUnit counts. Only the
+    // difference to what was sent matters, so they are allowed to wrap.
+    std::array<uint32_t, NUM_AXES> totals;
+  };
+
+  // Matches desc_hid_mouse_report
+  struct __attribute__((packed)) HIDReport {
+    uint8_t buttons;
+    int16_t x;
+    int16_t y;
+    int16_t wheel;
+    int16_t pan;
+  };
+
   USBMouseOutput();
 
-  std::array<std::array<int8_t, 5>, 2> double_buffer_;
-  uint8_t active_buffer_;
-  bool is_config_mode_;
+  // Sends the whole counts moved since the last report, clamped to what fits
+  // in the report. The rest is sent in the following reports. Nothing is sent
+  // if there is no motion and the buttons didn't change, unless the idle rate
+  // expired. Must hold semaphore_.
+  void SendReport(const Report& report);
+
+  void SendNextReport();
+
+  // Only accessed by the input task
+  Report next_;
+  TripleBuffer<Report> reports_;
+  // Guarded by semaphore_
+  std::array<uint32_t, NUM_AXES> sent_totals_;
+  uint8_t last_buttons_;
+  // Wheels the host enabled the resolution multiplier for
+  std::atomic<uint8_t> high_res_wheels_;
+  std::atomic<bool> is_config_mode_;
 };
 
 enum InterfaceID {
   ITF_KEYBOARD = 0,
   ITF_MOUSE,
   ITF_CONSUMER,
+  ITF_RAW_HID,
+
+#if CONFIG_USB_MASS_STORAGE
+  ITF_MSC,
+#endif /* CONFIG_USB_MASS_STORAGE */
 
 #if CONFIG_DEBUG_ENABLE_USB_SERIAL
   ITF_CDC_CTRL,
@@ -93,4 +249,22 @@ enum InterfaceID {
 Status RegisterUSBKeyboardOutput(uint8_t tag);
 Status RegisterUSBMouseOutput(uint8_t tag);
 
+// Type of the `len` argument of tud_hid_report_complete_cb(), which TinyUSB
+// changed from uint8_t to uint16_t. Taken from the declaration in tusb.h, so
+// that the definition matches whichever version pico-sdk brings.
+template <typename T>
+struct HIDReportCompleteLengthOf;
+template <typename L>
+struct HIDReportCompleteLengthOf<void (*)(uint8_t, uint8_t const *, L)> {
+  using type = L;
+};
+using HIDReportCompleteLength =
+    HIDReportCompleteLengthOf<decltype(&tud_hid_report_complete_cb)>::type;
+
+#if CONFIG_USB_MASS_STORAGE
+// Writes the config file the host saved on the mass storage volume, if any,
+// see usb_msc.cc. Called by the input task.
+void CommitMassStorageFile();
+#endif /* CONFIG_USB_MASS_STORAGE */
+
 #endif /* USB_H_ */
\ No newline at end of file
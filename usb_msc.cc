@@ -0,0 +1,568 @@
+// USB mass storage view of the config file. The host sees a small FAT12
+// volume with CONFIG_FLASH_JSON_FILE_NAME in the root directory. The volume
+// is synthesized from a RAM copy of the file, which is only read from flash
+// again when the file changes, so the reads of the host never block the
+// other core. Writes of the host are kept in RAM. Once they settle, or the
+// host flushes or ejects the volume, and they add up to a valid JSON file with
+// that name, the input task replaces the config file with it. Writing the
+// flash stops the other core, which the USB task must not do from a SCSI
+// callback.
+//
+// All the buffers are static, sized by CONFIG_USB_MASS_STORAGE_MAX_FILE_SIZE,
+// so that a large file or a lot of host writes can't exhaust the heap. Larger
+// files are left out of the volume, and larger files written by the host are
+// ignored.
+//
+// The volume is only resynthesized when the file changed from elsewhere and
+// the host isn't writing, so that its view of the FAT stays consistent.
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <string>
+
+#include "cJSON/cJSON.h"
+#include "config.h"
+#include "hardware/timer.h"
+#include "runner.h"
+#include "storage.h"
+#include "tusb.h"
+#include "usb.h"
+#include "utils.h"
+
+#if CONFIG_USB_MASS_STORAGE
+
+namespace {
+
+constexpr uint32_t kSectorSize = 512;
+constexpr uint32_t kNumFats = 2;
+constexpr uint32_t kRootDirSectors = 4;
+constexpr uint32_t kRootDirEntries = kRootDirSectors * kSectorSize / 32;
+// One sector per cluster
+constexpr uint32_t kDataSectors = 128;
+constexpr uint32_t kMaxFileSize = CONFIG_USB_MASS_STORAGE_MAX_FILE_SIZE;
+constexpr uint32_t kMaxFileSectors =
+    (kMaxFileSize + kSectorSize - 1) / kSectorSize;
+// Data sectors written by the host kept in RAM at most. Room for the new copy
+// of the file next to the old one, as hosts write it to free clusters first.
+constexpr uint32_t kMaxWrittenSectors = 2 * kMaxFileSectors;
+// The host is considered done writing after this long without a write
+constexpr uint64_t kWriteSettleUs = 500000;
+// Not named by TinyUSB. Sent by hosts when flushing their cache.
+constexpr uint8_t kScsiSynchronizeCache10 = 0x35;
+
+constexpr uint32_t kFatStart = 1;
+constexpr uint32_t kRootDirStart = kFatStart + kNumFats;
+constexpr uint32_t kDataStart = kRootDirStart + kRootDirSectors;
+constexpr uint32_t kTotalSectors = kDataStart + kDataSectors;
+
+// The whole FAT12 table has to fit in one sector
+static_assert((kDataSectors + 2) * 3 / 2 < kSectorSize);
+static_assert(kMaxWrittenSectors <= kDataSectors,
+              "CONFIG_USB_MASS_STORAGE_MAX_FILE_SIZE is too large");
+
+constexpr uint8_t kAttrVolumeLabel = 0x08;
+constexpr uint8_t kAttrDirectory = 0x10;
+constexpr uint8_t kAttrArchive = 0x20;
+constexpr uint8_t kAttrLongName = 0x0f;
+
+// 2022-01-01 00:00
+constexpr uint16_t kFatDate = ((2022 - 1980) << 9) | (1 << 5) | 1;
+
+using Sector = std::array<uint8_t, kSectorSize>;
+
+// Boot sector, FATs and root directory. Modified in place by host writes.
+std::array<uint8_t, kDataStart * kSectorSize> metadata;
+// Data sectors written by the host, and their LBAs
+std::array<Sector, kMaxWrittenSectors> written_sectors;
+std::array<uint32_t, kMaxWrittenSectors> written_lbas;
+uint32_t num_written_sectors = 0;
+// Content of the config file the volume was synthesized from
+std::array<char, kMaxFileSize> file_content;
+uint32_t file_size = 0;
+uint32_t file_generation = 0;
+bool is_loaded = false;
+// Tell the host the medium changed on the next TEST UNIT READY
+bool medium_changed = false;
+// The host wrote since the last commit check, and when it last did
+bool is_dirty = false;
+uint64_t last_write_us = 0;
+// Size and hash of the last file content handed to the input task. Seeing it
+// in flash isn't a change from elsewhere.
+bool has_committed = false;
+uint32_t committed_size = 0;
+uint32_t committed_hash = 0;
+
+// Handoff of the file content to the input task. The USB task only writes
+// pending_content while commit_ready is false, and the input task only reads
+// it while it's true. One more byte for the NUL cJSON needs.
+std::array<char, kMaxFileSize + 1> pending_content;
+uint32_t pending_size = 0;
+std::atomic<bool> commit_ready(false);
+
+// FNV-1a
+uint32_t Hash(const char* data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void Write16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+void Write32(uint8_t* p, uint32_t v) {
+  Write16(p, v & 0xffff);
+  Write16(p + 2, v >> 16);
+}
+
+uint16_t Read16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+uint32_t Read32(const uint8_t* p) { return Read16(p) | (Read16(p + 2) << 16); }
+
+// 8.3 name of a file name in the directory entry format, e.g. CONFIG~1JSO
+void ShortName(const std::string& name, uint8_t output[11]) {
+  memset(output, ' ', 11);
+  const size_t dot = name.rfind('.');
+  const std::string base = name.substr(0, dot);
+  const std::string ext = dot == std::string::npos ? "" : name.substr(dot + 1);
+  const bool needs_tail = base.size() > 8 || ext.size() > 3;
+  const size_t base_size = std::min<size_t>(base.size(), needs_tail ? 6 : 8);
+  for (size_t i = 0; i < base_size; ++i) {
+    output[i] = toupper((unsigned char)base[i]);
+  }
+  if (needs_tail) {
+    output[base_size] = '~';
+    output[base_size + 1] = '1';
+  }
+  for (size_t i = 0; i < std::min<size_t>(ext.size(), 3); ++i) {
+    output[8 + i] = toupper((unsigned char)ext[i]);
+  }
+}
+
+uint8_t ShortNameChecksum(const uint8_t short_name[11]) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < 11; ++i) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + short_name[i];
+  }
+  return sum;
+}
+
+// Offsets of the 13 UTF-16 characters in a long file name entry
+constexpr uint8_t kLongNameOffsets[13] = {1,  3,  5,  7,  9,  14, 16,
+                                          18, 20, 22, 24, 28, 30};
+
+void SetFatEntry(uint8_t* fat, uint16_t cluster, uint16_t value) {
+  uint8_t* p = fat + cluster * 3 / 2;
+  if (cluster & 1) {
+    p[0] = (p[0] & 0x0f) | (value << 4);
+    p[1] = value >> 4;
+  } else {
+    p[0] = value;
+    p[1] = (p[1] & 0xf0) | ((value >> 8) & 0x0f);
+  }
+}
+
+uint16_t GetFatEntry(const uint8_t* fat, uint16_t cluster) {
+  const uint16_t v = Read16(fat + cluster * 3 / 2);
+  return (cluster & 1) ? v >> 4 : v & 0xfff;
+}
+
+void SynthesizeMetadata() {
+  metadata.fill(0);
+
+  uint8_t* boot = metadata.data();
+  memcpy(boot, "\xeb\x3c\x90MSDOS5.0", 11);
+  Write16(boot + 11, kSectorSize);
+  boot[13] = 1;  // Sectors per cluster
+  Write16(boot + 14, kFatStart);
+  boot[16] = kNumFats;
+  Write16(boot + 17, kRootDirEntries);
+  Write16(boot + 19, kTotalSectors);
+  boot[21] = 0xf8;       // Media descriptor
+  Write16(boot + 22, 1);  // Sectors per FAT
+  Write16(boot + 24, 1);  // Sectors per track
+  Write16(boot + 26, 1);  // Number of heads
+  boot[36] = 0x80;        // Drive number
+  boot[38] = 0x29;        // Extended boot signature
+  Write32(boot + 39, CONFIG_USB_PID);
+  memcpy(boot + 43, "PICOMK     ", 11);
+  memcpy(boot + 54, "FAT12   ", 8);
+  boot[510] = 0x55;
+  boot[511] = 0xaa;
+
+  const uint32_t num_clusters = (file_size + kSectorSize - 1) / kSectorSize;
+  for (uint32_t i = 0; i < kNumFats; ++i) {
+    uint8_t* fat = metadata.data() + (kFatStart + i) * kSectorSize;
+    SetFatEntry(fat, 0, 0xff8);
+    SetFatEntry(fat, 1, 0xfff);
+    for (uint32_t c = 0; c < num_clusters; ++c) {
+      SetFatEntry(fat, 2 + c, c + 1 == num_clusters ? 0xfff : 3 + c);
+    }
+  }
+
+  uint8_t* entry = metadata.data() + kRootDirStart * kSectorSize;
+  memcpy(entry, "PICOMK     ", 11);
+  entry[11] = kAttrVolumeLabel;
+  entry += 32;
+  if (file_size == 0) {
+    return;
+  }
+
+  const std::string name = CONFIG_FLASH_JSON_FILE_NAME;
+  uint8_t short_name[11];
+  ShortName(name, short_name);
+  const uint8_t checksum = ShortNameChecksum(short_name);
+
+  // Long file name entries come in reverse order before the short entry
+  const size_t num_long_entries = name.size() / 13 + 1;
+  for (size_t n = num_long_entries; n > 0; --n) {
+    entry[0] = n | (n == num_long_entries ? 0x40 : 0);
+    entry[11] = kAttrLongName;
+    entry[13] = checksum;
+    for (size_t i = 0; i < 13; ++i) {
+      const size_t idx = (n - 1) * 13 + i;
+      uint16_t c = 0xffff;
+      if (idx < name.size()) {
+        c = name[idx];
+      } else if (idx == name.size()) {
+        c = 0;
+      }
+      Write16(entry + kLongNameOffsets[i], c);
+    }
+    entry += 32;
+  }
+  memcpy(entry, short_name, 11);
+  entry[11] = kAttrArchive;
+  Write16(entry + 16, kFatDate);  // Creation date
+  Write16(entry + 18, kFatDate);  // Access date
+  Write16(entry + 24, kFatDate);  // Modification date
+  Write16(entry + 26, 2);         // First cluster
+  Write32(entry + 28, file_size);
+}
+
+bool IsHostWriting() {
+  return commit_ready ||
+         (is_dirty && time_us_64() - last_write_us < kWriteSettleUs);
+}
+
+// Reloads the file and resets the volume if the file changed in flash, unless
+// the host is in the middle of writing or the change is its own commit
+void Refresh() {
+  const uint32_t generation = GetStorageGeneration();
+  if (is_loaded && generation == file_generation) {
+    return;
+  }
+  if (is_loaded && IsHostWriting()) {
+    return;
+  }
+  size_t size = 0;
+  if (ReadFileToBuffer(CONFIG_FLASH_JSON_FILE_NAME, file_content.data(),
+                       file_content.size(), &size) != OK) {
+    if (size > file_content.size()) {
+      LOG_WARNING("Config file too large for USB mass storage");
+    }
+    size = 0;
+  }
+  file_size = size;
+  file_generation = generation;
+  if (is_loaded && has_committed && size == committed_size &&
+      Hash(file_content.data(), size) == committed_hash) {
+    // The volume already shows it the way the host laid it out
+    return;
+  }
+  // The host only has to be told if it may have seen the old volume
+  medium_changed = is_loaded;
+  is_loaded = true;
+  has_committed = false;
+  is_dirty = false;
+  num_written_sectors = 0;
+  SynthesizeMetadata();
+}
+
+Sector* FindWrittenSector(uint32_t lba) {
+  for (uint32_t i = 0; i < num_written_sectors; ++i) {
+    if (written_lbas[i] == lba) {
+      return &written_sectors[i];
+    }
+  }
+  return NULL;
+}
+
+void ReadSector(uint32_t lba, uint8_t* output) {
+  if (lba < kDataStart) {
+    memcpy(output, metadata.data() + lba * kSectorSize, kSectorSize);
+    return;
+  }
+  const Sector* written = FindWrittenSector(lba);
+  if (written != NULL) {
+    memcpy(output, written->data(), kSectorSize);
+    return;
+  }
+  const size_t offset = (lba - kDataStart) * kSectorSize;
+  memset(output, 0, kSectorSize);
+  if (offset < file_size) {
+    memcpy(output, file_content.data() + offset,
+           std::min<size_t>(kSectorSize, file_size - offset));
+  }
+}
+
+bool WriteSector(uint32_t lba, const uint8_t* input) {
+  if (lba < kDataStart) {
+    memcpy(metadata.data() + lba * kSectorSize, input, kSectorSize);
+    return true;
+  }
+  Sector* written = FindWrittenSector(lba);
+  if (written == NULL) {
+    if (num_written_sectors >= kMaxWrittenSectors) {
+      return false;
+    }
+    written_lbas[num_written_sectors] = lba;
+    written = &written_sectors[num_written_sectors++];
+  }
+  memcpy(written->data(), input, kSectorSize);
+  return true;
+}
+
+// Finds the config file in the root directory as the host left it
+bool FindFile(uint16_t* cluster, uint32_t* size) {
+  const uint8_t* entries = metadata.data() + kRootDirStart * kSectorSize;
+  // Long file names have at most 20 entries of 13 characters
+  std::array<char, 20 * 13 + 1> long_name;
+  size_t long_name_size = 0;
+  for (uint32_t i = 0; i < kRootDirEntries; ++i) {
+    const uint8_t* entry = entries + i * 32;
+    if (entry[0] == 0x00) {
+      break;
+    }
+    if (entry[0] == 0xe5) {
+      long_name_size = 0;
+      continue;
+    }
+    if (entry[11] == kAttrLongName) {
+      // The last part comes first, and its number gives the entry count
+      const size_t n = entry[0] & 0x1f;
+      if (n == 0 || n > 20) {
+        long_name_size = 0;
+        continue;
+      }
+      char* part = long_name.data() + (n - 1) * 13;
+      size_t part_size = 0;
+      for (const uint8_t offset : kLongNameOffsets) {
+        const uint16_t c = Read16(entry + offset);
+        if (c == 0 || c == 0xffff) {
+          break;
+        }
+        part[part_size++] = c < 0x80 ? c : '?';
+      }
+      if (entry[0] & 0x40) {
+        long_name_size = (n - 1) * 13 + part_size;
+      }
+      continue;
+    }
+    if (entry[11] & (kAttrVolumeLabel | kAttrDirectory)) {
+      long_name_size = 0;
+      continue;
+    }
+
+    if (long_name_size == 0) {
+      for (size_t j = 0; j < 8 && entry[j] != ' '; ++j) {
+        long_name[long_name_size++] = entry[j];
+      }
+      if (entry[8] != ' ') {
+        long_name[long_name_size++] = '.';
+        for (size_t j = 8; j < 11 && entry[j] != ' '; ++j) {
+          long_name[long_name_size++] = entry[j];
+        }
+      }
+    }
+    long_name[long_name_size] = '\0';
+    long_name_size = 0;
+    if (strcasecmp(long_name.data(), CONFIG_FLASH_JSON_FILE_NAME) == 0) {
+      *cluster = Read16(entry + 26);
+      *size = Read32(entry + 28);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Hands the file to the input task if the host wrote a complete and valid
+// one. Unless `flush`, waits for the writes to settle first.
+void TryCommit(bool flush) {
+  if (!is_dirty || commit_ready ||
+      (!flush && time_us_64() - last_write_us < kWriteSettleUs)) {
+    return;
+  }
+  is_dirty = false;
+
+  uint16_t cluster;
+  uint32_t size;
+  if (!FindFile(&cluster, &size) || size == 0) {
+    return;
+  }
+  if (size > kMaxFileSize) {
+    LOG_WARNING("Config file written over USB mass storage is too large");
+    return;
+  }
+
+  // Not handed to the input task yet, see commit_ready
+  char* content = pending_content.data();
+  const uint8_t* fat = metadata.data() + kFatStart * kSectorSize;
+  Sector sector;
+  for (uint32_t offset = 0; offset < size; offset += kSectorSize) {
+    if (cluster < 2 || cluster >= 2 + kDataSectors) {
+      return;
+    }
+    ReadSector(kDataStart + cluster - 2, sector.data());
+    memcpy(content + offset, sector.data(),
+           std::min<uint32_t>(kSectorSize, size - offset));
+    cluster = GetFatEntry(fat, cluster);
+  }
+  content[size] = '\0';
+  const uint32_t hash = Hash(content, size);
+  const bool is_unchanged =
+      has_committed
+          ? size == committed_size && hash == committed_hash
+          : size == file_size && memcmp(content, file_content.data(), size) == 0;
+  if (is_unchanged) {
+    return;
+  }
+
+  // Partially written files are very unlikely to be valid JSON. Parsing
+  // allocates, bounded by kMaxFileSize.
+  cJSON* json = cJSON_ParseWithOpts(content, NULL,
+                                    /*require_null_terminated=*/true);
+  const bool is_valid = cJSON_IsObject(json);
+  cJSON_Delete(json);
+  if (!is_valid) {
+    return;
+  }
+
+  has_committed = true;
+  committed_size = size;
+  committed_hash = hash;
+  pending_size = size;
+  commit_ready = true;
+}
+
+}  // namespace
+
+void CommitMassStorageFile() {
+  if (!commit_ready) {
+    return;
+  }
+  LOG_INFO("Config file replaced over USB mass storage");
+  if (WriteBufferToFile(pending_content.data(), pending_size,
+                        CONFIG_FLASH_JSON_FILE_NAME) != OK) {
+    LOG_ERROR("Failed to write the config file");
+  } else {
+    runner::NotifyConfigFileChange();
+  }
+  commit_ready = false;
+}
+
+extern "C" {
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8],
+                        uint8_t product_id[16], uint8_t product_rev[4]) {
+  memcpy(vendor_id, "PicoMK  ", 8);
+  memcpy(product_id, "Config          ", 16);
+  memcpy(product_rev, "1.0 ", 4);
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+  // Hosts poll this while the volume is mounted
+  TryCommit(/*flush=*/false);
+  Refresh();
+  if (medium_changed) {
+    medium_changed = false;
+    // Makes the host drop its cached copy of the volume
+    tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+    return false;
+  }
+  return true;
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count,
+                         uint16_t* block_size) {
+  *block_count = kTotalSectors;
+  *block_size = kSectorSize;
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
+                          void* buffer, uint32_t bufsize) {
+  Refresh();
+  Sector sector;
+  uint8_t* output = (uint8_t*)buffer;
+  for (uint32_t i = 0; i < bufsize;) {
+    const uint32_t sector_lba = lba + (offset + i) / kSectorSize;
+    const uint32_t sector_offset = (offset + i) % kSectorSize;
+    const uint32_t n = std::min(bufsize - i, kSectorSize - sector_offset);
+    if (sector_lba >= kTotalSectors) {
+      return -1;
+    }
+    ReadSector(sector_lba, sector.data());
+    memcpy(output + i, sector.data() + sector_offset, n);
+    i += n;
+  }
+  return bufsize;
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
+                           uint8_t* buffer, uint32_t bufsize) {
+  Refresh();
+  Sector sector;
+  for (uint32_t i = 0; i < bufsize;) {
+    const uint32_t sector_lba = lba + (offset + i) / kSectorSize;
+    const uint32_t sector_offset = (offset + i) % kSectorSize;
+    const uint32_t n = std::min(bufsize - i, kSectorSize - sector_offset);
+    if (sector_lba >= kTotalSectors) {
+      return -1;
+    }
+    ReadSector(sector_lba, sector.data());
+    memcpy(sector.data() + sector_offset, buffer + i, n);
+    if (!WriteSector(sector_lba, sector.data())) {
+      LOG_WARNING("Too many sectors written over USB mass storage");
+      return -1;
+    }
+    i += n;
+  }
+  is_dirty = true;
+  last_write_us = time_us_64();
+  return bufsize;
+}
+
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start,
+                           bool load_eject) {
+  // Ejecting the volume
+  if (!start && load_eject) {
+    TryCommit(/*flush=*/true);
+  }
+  return true;
+}
+
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer,
+                        uint16_t bufsize) {
+  switch (scsi_cmd[0]) {
+    case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+      return 0;
+    case kScsiSynchronizeCache10:
+      TryCommit(/*flush=*/true);
+      return 0;
+    default:
+      tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+      return -1;
+  }
+}
+}
+
+#endif /* CONFIG_USB_MASS_STORAGE */
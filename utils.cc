@@ -1,10 +1,49 @@
 #include "utils.h"
 
+#include <atomic>
+
 #include "task.h"
+#include "trace.h"
+
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+
+static TaskHandle_t allocation_counter_task = NULL;
+static std::atomic<uint32_t> allocation_count(0);
+
+void SetAllocationCounterTask(TaskHandle_t task) {
+  allocation_counter_task = task;
+}
+
+uint32_t GetAllocationCount() { return allocation_count; }
+
+void CountHeapOperation() {
+  if (allocation_counter_task != NULL &&
+      xTaskGetCurrentTaskHandle() == allocation_counter_task) {
+    ++allocation_count;
+  }
+}
+
+#if PICO_ON_DEVICE
+
+// newlib takes this lock on every malloc, realloc and free, including the ones
+// from operator new and delete. pico_malloc already wraps malloc, so the build
+// wraps the lock instead (--wrap=__malloc_lock) and forwards to it.
+extern "C" void __real___malloc_lock(struct _reent* reent);
+
+extern "C" void __wrap___malloc_lock(struct _reent* reent) {
+  __real___malloc_lock(reent);
+  CountHeapOperation();
+}
+
+#endif /* PICO_ON_DEVICE */
+
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
 
 LockSemaphore::LockSemaphore(SemaphoreHandle_t semaphore)
     : semaphore_(semaphore) {
+  TRACE_EVENT(SEMAPHORE_WAIT_BEGIN, trace::HandleId(semaphore_));
   xSemaphoreTake(semaphore_, portMAX_DELAY);
+  TRACE_EVENT(SEMAPHORE_WAIT_END, trace::HandleId(semaphore_));
 }
 
 LockSemaphore::~LockSemaphore() { xSemaphoreGive(semaphore_); }
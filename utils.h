@@ -7,7 +7,9 @@
 
 #include "FreeRTOS.h"
 #include "config.h"
+#include "deferred_log.h"
 #include "semphr.h"
+#include "task.h"
 
 // TODO: rename this
 enum status { OK, ERROR };
@@ -15,6 +17,21 @@ using Status = status;
 
 enum LogLevel { L_ERROR = 1, L_WARNING = 2, L_INFO = 3, L_DEBUG = 4 };
 
+#if CONFIG_DEBUG_LOG_DEFERRED
+
+// Only the arguments are sent, see deferred_log.h. The id is computed at
+// compile time, so the format string isn't kept in the binary.
+#define LOG(LEVEL, prefix, format, ...)                                   \
+  ({                                                                      \
+    if (CONFIG_DEBUG_LOG_LEVEL >= LEVEL) {                                \
+      constexpr uint32_t kLogId = deferred_log::LogId(prefix " " format); \
+      deferred_log::Write(kLogId __VA_OPT__(, ) __VA_ARGS__);             \
+    }                                                                     \
+    0;                                                                    \
+  })
+
+#else
+
 #define __FILENAME__ (__FILE__ + SOURCE_PATH_SIZE)
 #define LOG(LEVEL, prefix, format, ...)                     \
   ({                                                        \
@@ -25,6 +42,8 @@ enum LogLevel { L_ERROR = 1, L_WARNING = 2, L_INFO = 3, L_DEBUG = 4 };
     0;                                                      \
   })
 
+#endif /* CONFIG_DEBUG_LOG_DEFERRED */
+
 #define LOG_ERROR(format, ...) \
   LOG(LogLevel::L_ERROR, "E", format __VA_OPT__(, ) __VA_ARGS__)
 #define LOG_WARNING(format, ...) \
@@ -34,6 +53,18 @@ enum LogLevel { L_ERROR = 1, L_WARNING = 2, L_INFO = 3, L_DEBUG = 4 };
 #define LOG_DEBUG(format, ...) \
   LOG(LogLevel::L_DEBUG, "D", format __VA_OPT__(, ) __VA_ARGS__)
 
+#if CONFIG_DEBUG_ALLOCATION_COUNTER
+
+// Counts the heap operations (malloc, realloc and free) made by the tracked
+// task.
+void SetAllocationCounterTask(TaskHandle_t task);
+uint32_t GetAllocationCount();
+// Called by the allocator hook on each heap operation: the __malloc_lock wrap
+// of utils.cc on the device, host/malloc_host.cc on the host
+void CountHeapOperation();
+
+#endif /* CONFIG_DEBUG_ALLOCATION_COUNTER */
+
 class LockSemaphore {
  public:
   LockSemaphore(SemaphoreHandle_t semaphore);
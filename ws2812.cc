@@ -1,13 +1,12 @@
 #include "ws2812.h"
 
+#include <algorithm>
 #include <vector>
 
-#include "FreeRTOS.h"
 #include "configuration.h"
 #include "hardware/clocks.h"
 #include "hardware/pio.h"
 #include "hardware/timer.h"
-#include "semphr.h"
 #include "utils.h"
 #include "ws2812.pio.h"
 
@@ -19,17 +18,26 @@ WS2812::WS2812(uint8_t pin, uint8_t num_pixels, float max_brightness, PIO pio,
       max_brightness_(max_brightness > 1 ? 1 : max_brightness),
       brightness_(0.25 < max_brightness ? 0.25 : max_brightness),
       mode_(ROTATE),
-      redraw_(false),
       enabled_(true),
-      buffer_changed_(false),
-      active_buffer_(0),
       tick_divider_(0),
+      caps_lock_pixel_(-1),
+      pixels_(num_pixels),
+      pixels_changed_(false),
+      redraw_(false),
+      frames_(Frame{.pixels = std::vector<uint32_t>(num_pixels),
+                    .brightness = brightness_,
+                    .mode = mode_,
+                    .enabled = enabled_,
+                    .tick_divider = tick_divider_,
+                    .caps_lock_pixel = caps_lock_pixel_}),
+      pending_redraw_(false),
       counter_(0),
-      double_buffer_(2, std::vector<uint32_t>(num_pixels)),
-      rotate_idx_(0) {
-  semaphore_ = xSemaphoreCreateBinary();
-  xSemaphoreGive(semaphore_);
-
+      rotate_idx_(0),
+      host_led_state_(0),
+      redraw_now_(false),
+      put_idx_(0),
+      indicator_idx_(-1),
+      indicator_value_(0) {
   // Initialize PIO
   const uint32_t offset = pio_add_program(pio, &ws2812_program);
   ws2812_program_init(pio, sm_, offset, pin, 800000, false);
@@ -38,52 +46,47 @@ WS2812::WS2812(uint8_t pin, uint8_t num_pixels, float max_brightness, PIO pio,
 void WS2812::OutputTick() {
   const uint64_t start_time = time_us_64();
 
-  Mode mode;
-  bool enabled;
-  float brightness;
-  {
-    LockSemaphore lock(semaphore_);
-    if (!enabled_ && !redraw_) {
-      return;
-    }
-    if (!redraw_) {
-      return;
-    }
-    if (counter_++ < tick_divider_) {
-      return;
-    }
-    counter_ = 0;
-    mode = mode_;
-    brightness = brightness_;
-    redraw_ = false;
-    enabled = enabled_;
+  bool is_new;
+  const Frame& frame = frames_.Read(&is_new);
+  pending_redraw_ |= is_new;
+  if (!pending_redraw_) {
+    return;
+  }
+  if (counter_++ < frame.tick_divider && !redraw_now_) {
+    return;
   }
+  counter_ = 0;
+  pending_redraw_ = false;
+  redraw_now_ = false;
+  put_idx_ = 0;
+  indicator_idx_ = -1;
 
-  if (!enabled) {
+  if (!frame.enabled) {
     for (size_t i = 0; i < NumPixels(); ++i) {
       PutPixel(0);
     }
     return;
   }
 
-  switch (mode) {
-    case SET_PIXEL: {
-      std::vector<uint32_t> copy;
-      copy.reserve(NumPixels());
-      {
-        LockSemaphore lock(semaphore_);
-        std::copy(double_buffer_[active_buffer_].begin(),
-                  double_buffer_[active_buffer_].end(), copy.begin());
-      }
-      for (const uint32_t pixel : copy) {
-        PutPixel(RescaleByBrightness(brightness, pixel));
+  if (host_led_state_ & HOST_LED_CAPS_LOCK) {
+    indicator_idx_ = frame.caps_lock_pixel;
+    indicator_value_ =
+        RescaleByBrightness(frame.brightness, CombineColors(0xff, 0xff, 0xff));
+  }
+
+  switch (frame.mode) {
+    case SET_PIXEL:
+      for (const uint32_t pixel : frame.pixels) {
+        PutPixel(RescaleByBrightness(frame.brightness, pixel));
       }
-    }
+      break;
     case RANDOM:
-      RandomAnimation(brightness);
+      RandomAnimation(frame.brightness);
       break;
     case ROTATE:
-      RotateAnimation(brightness);
+      RotateAnimation(frame.brightness);
+      break;
+    default:
       break;
   }
 
@@ -91,23 +94,40 @@ void WS2812::OutputTick() {
   LOG_DEBUG("LED write time: %d us", end_time - start_time);
 }
 
+void WS2812::OnHostLEDStateChange(uint8_t state) {
+  host_led_state_ = state;
+  pending_redraw_ = true;
+  redraw_now_ = true;
+}
+
 void WS2812::StartOfInputTick() {
-  LockSemaphore lock(semaphore_);
   if (mode_ != SET_PIXEL && enabled_) {
     redraw_ = true;
   }
 }
 
 void WS2812::FinalizeInputTickOutput() {
-  LockSemaphore lock(semaphore_);
-  if (mode_ == SET_PIXEL && buffer_changed_ && enabled_) {
-    active_buffer_ = (active_buffer_ + 1) % 2;
+  if (mode_ == SET_PIXEL && pixels_changed_ && enabled_) {
     redraw_ = true;
   }
+  if (!redraw_) {
+    return;
+  }
+  Frame& frame = frames_.WriteBuffer();
+  if (mode_ == SET_PIXEL) {
+    std::copy(pixels_.begin(), pixels_.end(), frame.pixels.begin());
+  }
+  frame.brightness = brightness_;
+  frame.mode = mode_;
+  frame.enabled = enabled_;
+  frame.tick_divider = tick_divider_;
+  frame.caps_lock_pixel = caps_lock_pixel_;
+  frames_.Publish();
+  pixels_changed_ = false;
+  redraw_ = false;
 }
 
 void WS2812::IncreaseBrightness() {
-  LockSemaphore lock(semaphore_);
   if (!enabled_) {
     return;
   }
@@ -119,7 +139,6 @@ void WS2812::IncreaseBrightness() {
 }
 
 void WS2812::DecreaseBrightness() {
-  LockSemaphore lock(semaphore_);
   if (!enabled_) {
     return;
   }
@@ -131,7 +150,6 @@ void WS2812::DecreaseBrightness() {
 }
 
 void WS2812::IncreaseAnimationSpeed() {
-  LockSemaphore lock(semaphore_);
   if (!enabled_) {
     return;
   }
@@ -142,7 +160,6 @@ void WS2812::IncreaseAnimationSpeed() {
 }
 
 void WS2812::DecreaseAnimationSpeed() {
-  LockSemaphore lock(semaphore_);
   if (!enabled_) {
     return;
   }
@@ -153,38 +170,22 @@ void WS2812::DecreaseAnimationSpeed() {
 }
 
 void WS2812::SetFixedColor(uint8_t w, uint8_t r, uint8_t g, uint8_t b) {
-  {
-    LockSemaphore lock(semaphore_);
-    if (!enabled_) {
-      return;
-    }
-  }
-  if (mode_ != SET_PIXEL) {
+  if (!enabled_ || mode_ != SET_PIXEL) {
     return;
   }
-  const uint32_t color = CombineColors(r, g, b);
-  auto& buffer = double_buffer_[(active_buffer_ + 1) % 2];
-  std::fill(buffer.begin(), buffer.end(), color);
-  buffer_changed_ = true;
+  std::fill(pixels_.begin(), pixels_.end(), CombineColors(r, g, b));
+  pixels_changed_ = true;
 }
 
 void WS2812::SetPixel(size_t idx, uint8_t w, uint8_t r, uint8_t g, uint8_t b) {
-  {
-    LockSemaphore lock(semaphore_);
-    if (!enabled_) {
-      return;
-    }
-  }
-  if (mode_ != SET_PIXEL || idx >= NumPixels()) {
+  if (!enabled_ || mode_ != SET_PIXEL || idx >= NumPixels()) {
     return;
   }
-  auto& buffer = double_buffer_[(active_buffer_ + 1) % 2];
-  buffer[idx] = CombineColors(r, g, b);
-  buffer_changed_ = true;
+  pixels_[idx] = CombineColors(r, g, b);
+  pixels_changed_ = true;
 }
 
 void WS2812::OnUpdateConfig(const Config* config) {
-  LockSemaphore lock(semaphore_);
   if (config->GetType() != Config::OBJECT) {
     LOG_ERROR("Root config has to be an object.");
     return;
@@ -211,7 +212,6 @@ void WS2812::OnUpdateConfig(const Config* config) {
     return;
   }
   tick_divider_ = ((ConfigInt*)it->second.get())->GetValue();
-  counter_ = 0;
 
   it = root_map.find("enabled");
   if (it == root_map.end()) {
@@ -234,20 +234,32 @@ void WS2812::OnUpdateConfig(const Config* config) {
     return;
   }
   mode_ = (Mode)(((ConfigInt*)it->second.get())->GetValue());
-}
 
-void WS2812::SetConfigMode(bool is_config_mode) {
-  LockSemaphore lock(semaphore_);
+  it = root_map.find("caps_lock_pixel");
+  if (it == root_map.end()) {
+    LOG_ERROR("Can't find `caps_lock_pixel` in config");
+    return;
+  }
+  if (it->second->GetType() != Config::INTEGER) {
+    LOG_ERROR("`caps_lock_pixel` invalid type");
+    return;
+  }
+  caps_lock_pixel_ = ((ConfigInt*)it->second.get())->GetValue();
   redraw_ = true;
 }
 
+void WS2812::SetConfigMode(bool is_config_mode) { redraw_ = true; }
+
 std::pair<std::string, std::shared_ptr<Config>> WS2812::CreateDefaultConfig() {
   auto config = CONFIG_OBJECT(
       CONFIG_OBJECT_ELEM("brightness",
                          CONFIG_FLOAT(0.25, 0.0, max_brightness_, 0.02)),
       CONFIG_OBJECT_ELEM("tick_dividier", CONFIG_INT(10, 1, 250)),
       CONFIG_OBJECT_ELEM("enabled", CONFIG_INT(1, 0, 1)),
-      CONFIG_OBJECT_ELEM("animation", CONFIG_INT(ROTATE, 0, TOTAL - 1)));
+      CONFIG_OBJECT_ELEM("animation", CONFIG_INT(ROTATE, 0, TOTAL - 1)),
+      // -1 to disable the caps lock indicator
+      CONFIG_OBJECT_ELEM("caps_lock_pixel",
+                         CONFIG_INT(-1, -1, (int32_t)NumPixels() - 1)));
   return {"ws2812", config};
 }
 
@@ -272,6 +284,9 @@ void WS2812::SeparateColors(uint32_t pixel, uint8_t* r, uint8_t* g,
 }
 
 void WS2812::PutPixel(uint32_t pixel) {
+  if (put_idx_++ == indicator_idx_) {
+    pixel = indicator_value_;
+  }
   pio_sm_put_blocking(pio_, sm_, pixel << 8u);
 }
 
@@ -5,11 +5,10 @@
 
 #include <vector>
 
-#include "FreeRTOS.h"
 #include "base.h"
 #include "configuration.h"
 #include "hardware/pio.h"
-#include "semphr.h"
+#include "triple_buffer.h"
 #include "utils.h"
 
 class WS2812 : public LEDOutputDevice {
@@ -20,6 +19,8 @@ class WS2812 : public LEDOutputDevice {
          uint8_t state_machine);
 
   void OutputTick() override;
+  // Lights up the caps lock pixel, if configured, in the next output tick
+  void OnHostLEDStateChange(uint8_t state) override;
 
   void StartOfInputTick() override;
   void FinalizeInputTickOutput() override;
@@ -28,7 +29,7 @@ class WS2812 : public LEDOutputDevice {
   void DecreaseBrightness() override;
   void IncreaseAnimationSpeed() override;
   void DecreaseAnimationSpeed() override;
-  size_t NumPixels() const override { return double_buffer_[0].size(); }
+  size_t NumPixels() const override { return pixels_.size(); }
   void SetFixedColor(uint8_t w, uint8_t r, uint8_t g, uint8_t b) override;
   void SetPixel(size_t idx, uint8_t w, uint8_t r, uint8_t g,
                 uint8_t b) override;
@@ -47,23 +48,48 @@ class WS2812 : public LEDOutputDevice {
   void RandomAnimation(float brightness);
   void RotateAnimation(float brightness);
 
+  // Everything the output task needs to draw
+  struct Frame {
+    std::vector<uint32_t> pixels;
+    float brightness;
+    Mode mode;
+    bool enabled;
+    uint8_t tick_divider;
+    // -1 if no pixel shows the caps lock state
+    int16_t caps_lock_pixel;
+  };
+
   const uint8_t pin_;
   const PIO pio_;
   const uint8_t sm_;
   const float max_brightness_;
+
+  // Owned by the input task
   float brightness_;
   Mode mode_;
-  bool redraw_;
   bool enabled_;
-  bool buffer_changed_;
-  uint8_t active_buffer_;
   uint8_t tick_divider_;
+  int16_t caps_lock_pixel_;
+  std::vector<uint32_t> pixels_;
+  bool pixels_changed_;
+  // The frame has to be published at the end of the input tick
+  bool redraw_;
+
+  TripleBuffer<Frame> frames_;
+
+  // Owned by the output task
+  bool pending_redraw_;
   uint8_t counter_;
-  std::vector<std::vector<uint32_t>> double_buffer_;
   std::vector<uint32_t> rotate_buffer_;
   uint8_t rotate_idx_;
-
-  SemaphoreHandle_t semaphore_;
+  uint8_t host_led_state_;
+  // Redraw without waiting for the tick divider
+  bool redraw_now_;
+  // Index of the next pixel PutPixel() sends, and the pixel to replace with
+  // indicator_value_, or -1
+  int16_t put_idx_;
+  int16_t indicator_idx_;
+  uint32_t indicator_value_;
 };
 
 Status RegisterWS2812(uint8_t tag, uint8_t pin, uint8_t num_pixels,